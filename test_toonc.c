@@ -53,6 +53,10 @@
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 
 /* ============================================================================
  * Test Framework Macros
@@ -783,95 +787,2285 @@ static int test_edge_cases(void) {
     return 0;
 }
 
+/* Diagnostic collector used by the error reporting tests. */
+typedef struct {
+    int count;
+    toonError first;
+} DiagSink;
+
+static void collect_diag(const toonError *err, void *userdata) {
+    DiagSink *sink = userdata;
+    if (sink->count++ == 0) sink->first = *err;
+}
+
+/**
+ * Test 6b: Structured Error Reporting
+ *
+ * Diagnostics go to a user handler instead of stderr, and strict mode
+ * aborts on the first error.
+ */
+static int test_error_reporting(void) {
+    TEST_BEGIN("Structured error reporting");
+    clock_t start = test_timer_start();
+
+    const char *malformed =
+        "valid: ok\n"
+        "no_colon\n"
+        "table[1]{a,b:\n"
+        "another: valid\n";
+
+    /* Lenient mode: errors are reported, parsing continues. */
+    DiagSink sink = {0, {0, 0, 0}};
+    toonParseOptions opts = {0, collect_diag, &sink, NULL};
+    toonObject *root = TOONc_parseStringWithOptions(malformed, &opts);
+    ASSERT_NOT_NULL(root);
+    ASSERT(sink.count >= 2);
+    ASSERT_EQ(sink.first.code, TOON_ERR_EXPECTED_COLON);
+    ASSERT_EQ(sink.first.line, 2);
+    ASSERT_EQ(sink.first.col, 9);
+    ASSERT_STR_EQ(TOONc_strerror(sink.first.code), "expected ':' after key");
+    ASSERT_NOT_NULL(TOONc_get(root, "another"));
+    TOONc_free(root);
+
+    /* Strict mode: the first error aborts the parse. */
+    DiagSink strict_sink = {0, {0, 0, 0}};
+    toonParseOptions strict = {TOON_PARSE_STRICT, collect_diag, &strict_sink, NULL};
+    root = TOONc_parseStringWithOptions(malformed, &strict);
+    ASSERT_NULL(root);
+    ASSERT_EQ(strict_sink.count, 1);
+
+    /* Well-formed input is unaffected by strict mode. */
+    root = TOONc_parseStringWithOptions("a: 1\nb:\n  c: 2\n", &strict);
+    ASSERT_NOT_NULL(root);
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(root, "b.c")), 2);
+    TOONc_free(root);
+
+    /* No handler: nothing is reported and nothing is printed. */
+    root = TOONc_parseString(malformed);
+    ASSERT_NOT_NULL(root);
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Error reporting");
+    return 0;
+}
+
+/**
+ * Test 7: Object Creation API
+ * 
+ * Tests programmatic object creation and manipulation.
+ */
+static int test_object_creation(void) {
+    TEST_BEGIN("Object creation API");
+    clock_t start = test_timer_start();
+    
+    /* Create root object */
+    toonObject *root = TOONc_newObject(KV_OBJ);
+    ASSERT_NOT_NULL(root);
+    
+    /* Create various typed properties */
+    toonObject *name = TOONc_newStringObj("Test User", 9);
+    name->key = strdup("name");
+    
+    toonObject *age = TOONc_newIntObj(42);
+    age->key = strdup("age");
+    
+    toonObject *score = TOONc_newDoubleObj(95.5);
+    score->key = strdup("score");
+    
+    toonObject *active = TOONc_newBoolObj(1);
+    active->key = strdup("active");
+    
+    toonObject *null_val = TOONc_newNullObj();
+    null_val->key = strdup("null_field");
+    
+    /* Create array */
+    toonObject *tags = TOONc_newListObj();
+    tags->key = strdup("tags");
+    TOONc_listPush(tags, TOONc_newStringObj("admin", 5));
+    TOONc_listPush(tags, TOONc_newStringObj("user", 4));
+    TOONc_listPush(tags, TOONc_newStringObj("tester", 6));
+    
+    /* Link properties as siblings */
+    root->child = name;
+    name->next = age;
+    age->next = score;
+    score->next = active;
+    active->next = null_val;
+    null_val->next = tags;
+    
+    /* Verify all properties */
+    ASSERT_TYPE(name, TOON_IS_STRING);
+    ASSERT_STR_EQ(TOON_GET_STRING(name), "Test User");
+    
+    ASSERT_TYPE(age, TOON_IS_INT);
+    ASSERT_EQ(TOON_GET_INT(age), 42);
+    
+    ASSERT_TYPE(score, TOON_IS_DOUBLE);
+    ASSERT_FLOAT_EQ(TOON_GET_DOUBLE(score), 95.5, 0.0001);
+    
+    ASSERT_TYPE(active, TOON_IS_BOOL);
+    ASSERT_EQ(TOON_GET_BOOL(active), 1);
+    
+    ASSERT_TYPE(null_val, TOON_IS_NULL);
+    
+    ASSERT_TYPE(tags, TOON_IS_LIST);
+    ASSERT_EQ(TOONc_getArrayLength(tags), 3);
+    
+    /* Test TOONc_get on created structure */
+    toonObject *found = TOONc_get(root, "name");
+    ASSERT_NOT_NULL(found);
+    ASSERT(found == name);
+    
+    /* Print for visual verification */
+    printf("  Programmatically created object:\n");
+    debug_print_object(root->child, 2);
+    
+    /* Test JSON export */
+    printf("  JSON representation:\n");
+    FILE *json_out = tmpfile();
+    ASSERT_NOT_NULL(json_out);
+    TOONc_toJSON(root, json_out, 0);
+    rewind(json_out);
+    
+    char json_buf[1024];
+    size_t read = fread(json_buf, 1, sizeof(json_buf) - 1, json_out);
+    json_buf[read] = '\0';
+    printf("    %s\n", json_buf);
+    fclose(json_out);
+    
+    TOONc_free(root);
+    
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Object creation");
+    return 0;
+}
+
+/**
+ * Test 7b: TOON Encoder
+ *
+ * Tests TOONc_toTOON(): nesting, inline arrays, automatic tables,
+ * expanded lists and minimal quoting.
+ */
+static int test_toon_encoder(void) {
+    TEST_BEGIN("TOON encoder");
+    clock_t start = test_timer_start();
+
+    const char *toon =
+        "context:\n"
+        "  task: Our favorite hikes together\n"
+        "  season: spring_2025\n"
+        "friends[3]: ana,luis,sam\n"
+        "hikes[2]{id,name,distanceKm,sunny}:\n"
+        "  1,Blue Lake Trail,7.5,true\n"
+        "  2,Ridge Overlook,9.2,false\n"
+        "empty[0]:\n";
+
+    toonObject *root = TOONc_parseString(toon);
+    ASSERT_NOT_NULL(root);
+
+    /* Parser output round-trips to the same text. */
+    size_t len = 0;
+    char *out = TOONc_toTOON(root, &len);
+    ASSERT_NOT_NULL(out);
+    ASSERT_STR_EQ(out, toon);
+    ASSERT_EQ(len, strlen(toon));
+    free(out);
+    TOONc_free(root);
+
+    /* Programmatic tree: quoting, doubles and non-uniform arrays. */
+    root = TOONc_newObject(KV_OBJ);
+    toonObject *a = TOONc_newStringObj("a,b", 3);
+    a->key = strdup("needs quote");
+    toonObject *b = TOONc_newStringObj("42", 2);
+    b->key = strdup("numeric");
+    toonObject *c = TOONc_newDoubleObj(3.0);
+    c->key = strdup("whole");
+    toonObject *list = TOONc_newListObj();
+    list->key = strdup("mixed");
+    toonObject *item = TOONc_newObject(KV_OBJ);
+    item->child = TOONc_newIntObj(1);
+    item->child->key = strdup("id");
+    item->child->next = TOONc_newStringObj("", 0);
+    item->child->next->key = strdup("note");
+    TOONc_listPush(list, item);
+    TOONc_listPush(list, TOONc_newBoolObj(1));
+    root->child = a;
+    a->next = b;
+    b->next = c;
+    c->next = list;
+
+    out = TOONc_toTOON(root, NULL);
+    ASSERT_STR_EQ(out,
+        "\"needs quote\": \"a,b\"\n"
+        "numeric: \"42\"\n"
+        "whole: 3.0\n"
+        "mixed[2]:\n"
+        "  - id: 1\n"
+        "    note: \"\"\n"
+        "  - true\n");
+    free(out);
+
+    /* The double stays a double when read back. */
+    toonObject *reparsed = TOONc_parseString("whole: 3.0\n");
+    ASSERT_TYPE(TOONc_get(reparsed, "whole"), TOON_IS_DOUBLE);
+    TOONc_free(reparsed);
+    TOONc_free(root);
+
+    /* Anything the parser would read as a number is quoted, signed or
+     * not; control bytes are escaped, never written raw. */
+    root = TOONc_newObject(KV_OBJ);
+    root->child = TOONc_newStringObj("+5", 2);
+    root->child->key = strdup("plus");
+    root->child->next = TOONc_newStringObj("a\001b\x1f", 4);
+    root->child->next->key = strdup("ctl");
+    out = TOONc_toTOON(root, NULL);
+    ASSERT_STR_EQ(out, "plus: \"+5\"\nctl: \"a\\u0001b\\u001f\"\n");
+    reparsed = TOONc_parseString(out);
+    ASSERT_TYPE(TOONc_get(reparsed, "plus"), TOON_IS_STRING);
+    TOONc_free(reparsed);
+    free(out);
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("TOON encoder");
+    return 0;
+}
+
+/* Read a whole stream back into a NUL-terminated buffer. */
+static char *slurp_stream(FILE *fp, size_t *len) {
+    fflush(fp);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    char *buf = malloc((size_t)size + 1);
+    *len = fread(buf, 1, (size_t)size, fp);
+    buf[*len] = '\0';
+    return buf;
+}
+
+/**
+ * Test 7c: Buffered Writer
+ *
+ * Memory, fd and FILE sinks must produce identical bytes, including for
+ * payloads larger than the staging buffer.
+ */
+static int test_buffered_writer(void) {
+    TEST_BEGIN("Buffered writer sinks");
+    clock_t start = test_timer_start();
+
+    /* A document whose JSON is well over one 64 KiB chunk. */
+    toonObject *root = TOONc_newObject(KV_OBJ);
+    toonObject *list = TOONc_newListObj();
+    list->key = strdup("values");
+    root->child = list;
+    for (int i = 0; i < 20000; i++)
+        TOONc_listPush(list, TOONc_newIntObj(i));
+
+    toonWriter mem;
+    TOONc_writerInitMemory(&mem);
+    TOONc_writeJSON(&mem, root, 0, TOON_JSON_PRETTY);
+    size_t mem_len;
+    char *mem_out = TOONc_writerRelease(&mem, &mem_len);
+    ASSERT_NOT_NULL(mem_out);
+    ASSERT(mem_len > 64 * 1024);
+    ASSERT_EQ(strlen(mem_out), mem_len);
+
+    /* FILE sink via the classic entry point. */
+    FILE *fp = tmpfile();
+    ASSERT_NOT_NULL(fp);
+    TOONc_toJSON(root, fp, 0);
+    size_t file_len;
+    char *file_out = slurp_stream(fp, &file_len);
+    fclose(fp);
+    ASSERT_EQ(file_len, mem_len);
+    ASSERT(memcmp(file_out, mem_out, mem_len) == 0);
+    free(file_out);
+
+    /* fd sink, with a large raw write that bypasses the staging buffer. */
+    fp = tmpfile();
+    ASSERT_NOT_NULL(fp);
+    toonWriter fdw;
+    TOONc_writerInitFd(&fdw, fileno(fp));
+    TOONc_writeJSON(&fdw, root, 0, TOON_JSON_PRETTY);
+    TOONc_writerWrite(&fdw, mem_out, mem_len);
+    ASSERT_EQ(TOONc_writerFree(&fdw), 0);
+    ASSERT_EQ(fdw.written, 2 * mem_len);
+    size_t fd_len;
+    char *fd_out = slurp_stream(fp, &fd_len);
+    fclose(fp);
+    ASSERT_EQ(fd_len, 2 * mem_len);
+    ASSERT(memcmp(fd_out, mem_out, mem_len) == 0);
+    ASSERT(memcmp(fd_out + mem_len, mem_out, mem_len) == 0);
+    free(fd_out);
+
+    /* Errors are sticky and reported on flush. */
+    toonWriter bad;
+    TOONc_writerInitFd(&bad, -1);
+    TOONc_writerWrite(&bad, "x", 1);
+    ASSERT_EQ(TOONc_writerFree(&bad), -1);
+    ASSERT(bad.error != 0);
+
+    free(mem_out);
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Buffered writer");
+    return 0;
+}
+
+/**
+ * Test 7d: JSON String Escaping
+ *
+ * Keys and strings must come out as valid JSON, on both sides of the
+ * 16-byte vector boundary, with UTF-8 passed through.
+ */
+static int test_json_escaping(void) {
+    TEST_BEGIN("JSON string escaping");
+    clock_t start = test_timer_start();
+
+    const char raw[] = "say \"hi\"\\ ok\n\t\x01\x1f caf\xc3\xa9 long tail after sixteen \"";
+    toonObject *root = TOONc_newObject(KV_OBJ);
+    toonObject *str = TOONc_newStringObj((char *)raw, sizeof(raw) - 1);
+    str->key = strdup("k\"ey");
+    root->child = str;
+
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    TOONc_writeJSON(&w, str, 0, TOON_JSON_PRETTY);
+    char *out = TOONc_writerRelease(&w, NULL);
+    ASSERT_STR_EQ(out,
+        "\"k\\\"ey\": \"say \\\"hi\\\"\\\\ ok\\n\\t\\u0001\\u001f "
+        "caf\xc3\xa9 long tail after sixteen \\\"\"");
+    free(out);
+
+    /* Clean strings are copied verbatim. */
+    toonObject *clean = TOONc_newStringObj("0123456789abcdefghijklmnopqrstuvwxyz", 36);
+    TOONc_writerInitMemory(&w);
+    TOONc_writeJSON(&w, clean, 0, TOON_JSON_PRETTY);
+    out = TOONc_writerRelease(&w, NULL);
+    ASSERT_STR_EQ(out, "\"0123456789abcdefghijklmnopqrstuvwxyz\"");
+    free(out);
+    TOONc_free(clean);
+
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("JSON escaping");
+    return 0;
+}
+
+/* Emit a single value as compact text through a memory writer. */
+static char *emit_value_json(toonObject *o) {
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    TOONc_writeJSON(&w, o, 0, TOON_JSON_PRETTY);
+    return TOONc_writerRelease(&w, NULL);
+}
+
+/**
+ * Test 7e: Number Formatting
+ *
+ * Doubles are written as the shortest text that reads back exactly, and
+ * integers cover the full int range.
+ */
+static int test_number_formatting(void) {
+    TEST_BEGIN("Shortest round-trip number formatting");
+    clock_t start = test_timer_start();
+
+    struct { double d; const char *text; } doubles[] = {
+        {1e-7, "1e-7"},
+        {0.000001, "0.000001"},
+        {0.1, "0.1"},
+        {95.5, "95.5"},
+        {-3.14, "-3.14"},
+        {100.0, "100.0"},
+        {1e21, "1e21"},
+        {1.5e10, "15000000000.0"},
+        {5e-324, "5e-324"},
+        {1.7976931348623157e308, "1.7976931348623157e308"},
+        {0.0, "0.0"},
+    };
+    for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+        toonObject *o = TOONc_newDoubleObj(doubles[i].d);
+        char *out = emit_value_json(o);
+        ASSERT_STR_EQ(out, doubles[i].text);
+        ASSERT(strtod(out, NULL) == doubles[i].d);
+        free(out);
+        TOONc_free(o);
+    }
+
+    /* Non-finite values have no JSON spelling. */
+    toonObject *nan_obj = TOONc_newDoubleObj(NAN);
+    char *out = emit_value_json(nan_obj);
+    ASSERT_STR_EQ(out, "null");
+    free(out);
+    TOONc_free(nan_obj);
+
+    int ints[] = {0, 7, -42, 100, 12345, 2147483647, -2147483647 - 1};
+    for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+        char expected[16];
+        snprintf(expected, sizeof(expected), "%d", ints[i]);
+        toonObject *o = TOONc_newIntObj(ints[i]);
+        out = emit_value_json(o);
+        ASSERT_STR_EQ(out, expected);
+        free(out);
+        TOONc_free(o);
+    }
+
+    /* Random doubles survive a TOON round trip bit for bit. */
+    srand(42);
+    for (int i = 0; i < 10000; i++) {
+        double d = ((double)rand() / RAND_MAX - 0.5) * pow(10, rand() % 40 - 20);
+        toonObject *o = TOONc_newDoubleObj(d);
+        out = emit_value_json(o);
+        ASSERT_MSG(strtod(out, NULL) == d, "%.17g printed as %s", d, out);
+        free(out);
+        TOONc_free(o);
+    }
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Number formatting");
+    return 0;
+}
+
+/**
+ * Test 7f: Compact JSON and Caller Buffers
+ *
+ * TOON_JSON_COMPACT drops all whitespace, and TOONc_toJSONBuffer reports
+ * the exact size on overflow so a single retry always succeeds.
+ */
+static int test_json_buffer(void) {
+    TEST_BEGIN("Compact JSON and caller-supplied buffers");
+    clock_t start = test_timer_start();
+
+    const char *toon =
+        "name: Alice\n"
+        "tags[2]: a,b\n"
+        "address:\n"
+        "  city: Springfield\n"
+        "rows[2]{id,ok}:\n"
+        "  1,true\n"
+        "  2,false\n";
+    toonObject *root = TOONc_parseString(toon);
+    ASSERT_NOT_NULL(root);
+
+    const char *expected =
+        "{\"name\":\"Alice\",\"tags\":[\"a\",\"b\"],"
+        "\"address\":{\"city\":\"Springfield\"},"
+        "\"rows\":[{\"id\":1,\"ok\":true},{\"id\":2,\"ok\":false}]}";
+
+    /* Too small: nothing usable, but the exact size comes back. */
+    char small[16];
+    size_t needed = 0;
+    ASSERT_EQ(TOONc_toJSONBuffer(root, small, sizeof(small), &needed, TOON_JSON_COMPACT), -1);
+    ASSERT_EQ(needed, strlen(expected));
+
+    /* Sizing call with no buffer at all. */
+    size_t needed2 = 0;
+    ASSERT_EQ(TOONc_toJSONBuffer(root, NULL, 0, &needed2, TOON_JSON_COMPACT), -1);
+    ASSERT_EQ(needed2, needed);
+
+    /* One allocation, one retry. */
+    char *buf = malloc(needed + 1);
+    ASSERT_EQ(TOONc_toJSONBuffer(root, buf, needed + 1, &needed2, TOON_JSON_COMPACT), 0);
+    ASSERT_EQ(needed2, needed);
+    ASSERT_STR_EQ(buf, expected);
+    free(buf);
+
+    /* Exactly 'needed' bytes leaves no room for the NUL. */
+    buf = malloc(needed);
+    ASSERT_EQ(TOONc_toJSONBuffer(root, buf, needed, &needed2, TOON_JSON_COMPACT), -1);
+    free(buf);
+
+    /* Pretty output is larger and still sized exactly. */
+    ASSERT_EQ(TOONc_toJSONBuffer(root, NULL, 0, &needed2, TOON_JSON_PRETTY), -1);
+    ASSERT(needed2 > needed);
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    TOONc_writeJSON(&w, root, 0, TOON_JSON_PRETTY);
+    size_t pretty_len;
+    char *pretty = TOONc_writerRelease(&w, &pretty_len);
+    ASSERT_EQ(pretty_len, needed2);
+    free(pretty);
+
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("JSON buffers");
+    return 0;
+}
+
+/**
+ * Test 7g: Output Size Precomputation
+ *
+ * TOONc_measureJSON/TOONc_measureTOON must match the emitted size exactly
+ * under every formatting option, so a single allocation always suffices.
+ */
+static int test_measure_output(void) {
+    TEST_BEGIN("Exact serialized-size precomputation");
+    clock_t start = test_timer_start();
+
+    const char *toon =
+        "name: \"quote \\\" and tab\t\"\n"
+        "ratio: 0.000001\n"
+        "big: 1e300\n"
+        "neg: -2147483648\n"
+        "flags[4]: true,false,null,-7\n"
+        "empty[0]:\n"
+        "nested:\n"
+        "  deeper:\n"
+        "    leaf: x\n"
+        "  other: 1.5\n"
+        "rows[3]{id,label}:\n"
+        "  1,one\n"
+        "  2,two\n"
+        "  3,\"\"\n";
+    toonObject *root = TOONc_parseString(toon);
+    ASSERT_NOT_NULL(root);
+
+    /* Add a wide array so the counting sink goes through its slow path. */
+    toonObject *wide = TOONc_newListObj();
+    wide->key = strdup("wide");
+    for (int i = 0; i < 3000; i++)
+        TOONc_listPush(wide, TOONc_newDoubleObj(i / 7.0));
+    toonObject *last = root->child;
+    while (last->next) last = last->next;
+    last->next = wide;
+
+    int modes[] = {TOON_JSON_PRETTY, TOON_JSON_COMPACT};
+    for (int m = 0; m < 2; m++) {
+        size_t predicted = TOONc_measureJSON(root, modes[m]);
+        char *buf = malloc(predicted + 1);
+        size_t needed;
+        ASSERT_EQ(TOONc_toJSONBuffer(root, buf, predicted + 1, &needed, modes[m]), 0);
+        ASSERT_EQ(needed, predicted);
+        ASSERT_EQ(strlen(buf), predicted);
+        free(buf);
+    }
+
+    size_t predicted = TOONc_measureTOON(root);
+    size_t actual_len;
+    char *actual = TOONc_toTOON(root, &actual_len);
+    ASSERT(predicted > 4096);
+    ASSERT_EQ(predicted, actual_len);
+
+    char *buf = malloc(predicted + 1);
+    size_t needed;
+    ASSERT_EQ(TOONc_toTOONBuffer(root, buf, predicted + 1, &needed), 0);
+    ASSERT_EQ(needed, predicted);
+    ASSERT_STR_EQ(buf, actual);
+    free(buf);
+    free(actual);
+
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Output measurement");
+    return 0;
+}
+
+/**
+ * Test 7h: Streaming TOON to JSON
+ *
+ * TOONc_transcodeTOONToJSON never builds a tree but must produce exactly
+ * what parsing and TOONc_writeJSON would, including for input the parser
+ * only recovers from.
+ */
+static int test_stream_transcode(void) {
+    TEST_BEGIN("Streaming TOON to JSON transcoding");
+    clock_t start = test_timer_start();
+
+    const char *docs[] = {
+        "",
+        "# only a comment\n\n",
+        "name: \"quote \\\" and tab\t\"\n"
+        "ratio: 0.000001\n"
+        "neg: -2147483648\n"
+        "flags[4]: true,false,null,-7 # trailing\n"
+        "empty[0]:\n"
+        "nested:\n"
+        "  deeper:\n"
+        "    leaf: x\n"
+        "  # comment inside\n"
+        "\n"
+        "  other: 1.5\n"
+        "lonely:\n"
+        "rows[3]{id,label}:\n"
+        "  1,one\n"
+        "  # counts as a row\n"
+        "  3,\"\"\n"
+        "after: yes",
+        "bad line without colon\n"
+        "a: 1 2\n"
+        "t[2]{x,y:\n"
+        "short[5]{a,b}:\n"
+        "  1,2\n",
+    };
+
+    int modes[] = {TOON_JSON_PRETTY, TOON_JSON_COMPACT};
+    for (size_t d = 0; d < sizeof(docs) / sizeof(docs[0]); d++) {
+        FILE *fp = tmpfile();
+        ASSERT_NOT_NULL(fp);
+        fputs(docs[d], fp);
+
+        for (int m = 0; m < 2; m++) {
+            toonObject *root = TOONc_parseString(docs[d]);
+            ASSERT_NOT_NULL(root);
+            toonWriter expected;
+            TOONc_writerInitMemory(&expected);
+            TOONc_writeJSON(&expected, root, 0, modes[m]);
+            TOONc_free(root);
+
+            rewind(fp);
+            toonWriter actual;
+            TOONc_writerInitMemory(&actual);
+            ASSERT_EQ(TOONc_transcodeTOONToJSON(fp, &actual, modes[m], NULL), 0);
+
+            ASSERT_EQ(actual.len, expected.len);
+            ASSERT(memcmp(actual.buf, expected.buf, expected.len) == 0);
+            TOONc_writerFree(&actual);
+            TOONc_writerFree(&expected);
+        }
+        fclose(fp);
+    }
+
+    /* Diagnostics match the parser's, and strict mode fails the stream. */
+    DiagSink sink = {0, {0, 0, 0}};
+    toonParseOptions opts = {TOON_PARSE_STRICT, collect_diag, &sink, NULL};
+    FILE *fp = tmpfile();
+    fputs("ok: 1\nbroken\n", fp);
+    rewind(fp);
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    ASSERT_EQ(TOONc_transcodeTOONToJSON(fp, &w, TOON_JSON_COMPACT, &opts), -1);
+    ASSERT_EQ(sink.count, 1);
+    ASSERT_EQ(sink.first.code, TOON_ERR_EXPECTED_COLON);
+    ASSERT_EQ(sink.first.line, 2);
+    TOONc_writerFree(&w);
+    fclose(fp);
+
+    /* A document much larger than the reader's chunk, with a long line
+     * straddling chunk boundaries. */
+    fp = tmpfile();
+    fputs("meta:\n  title: big\n", fp);
+    fprintf(fp, "rows[20000]{id,name,score}:\n");
+    for (int i = 0; i < 20000; i++)
+        fprintf(fp, "  %d,item%d,%d.25\n", i, i, i % 100);
+    fputs("wide[3000]: ", fp);
+    for (int i = 0; i < 3000; i++)
+        fprintf(fp, "%s%d", i ? "," : "", i * 31);
+    fputs("\n", fp);
+
+    size_t src_len;
+    char *src = slurp_stream(fp, &src_len);
+    toonObject *root = TOONc_parseString(src);
+    toonWriter expected;
+    TOONc_writerInitMemory(&expected);
+    TOONc_writeJSON(&expected, root, 0, TOON_JSON_COMPACT);
+    TOONc_free(root);
+    free(src);
+
+    rewind(fp);
+    TOONc_writerInitMemory(&w);
+    ASSERT_EQ(TOONc_transcodeTOONToJSON(fp, &w, TOON_JSON_COMPACT, NULL), 0);
+    ASSERT_EQ(w.len, expected.len);
+    ASSERT(memcmp(w.buf, expected.buf, expected.len) == 0);
+    TOONc_writerFree(&w);
+    TOONc_writerFree(&expected);
+    fclose(fp);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Stream transcoding");
+    return 0;
+}
+
+/**
+ * Test 7i: JSON Parsing
+ *
+ * TOONc_parseJSON builds ordinary toonObject trees: JSON emitted from a TOON
+ * tree parses back to an identical tree, escapes decode to UTF-8, and
+ * malformed input fails with a located diagnostic.
+ */
+static int test_json_parsing(void) {
+    TEST_BEGIN("JSON parsing");
+    clock_t start = test_timer_start();
+
+    const char *json =
+        "{ \"name\": \"caf\\u00e9 \\ud83d\\ude00 \\\"q\\\"\\n\",\n"
+        "  \"count\": 42, \"neg\": -2147483648, \"big\": 2147483648,\n"
+        "  \"ratio\": 0.5, \"exp\": 1E3, \"ok\": true, \"none\": null,\n"
+        "  \"tags\": [\"a\", 1, [], {}],\n"
+        "  \"nested\": {\"deeper\": {\"leaf\": \"x\"}} }";
+    toonObject *root = TOONc_parseJSON(json, strlen(json));
+    ASSERT_NOT_NULL(root);
+    ASSERT(TOON_IS_OBJ(root));
+
+    toonObject *name = TOONc_get(root, "name");
+    ASSERT_STR_EQ(TOON_GET_STRING(name), "caf\xc3\xa9 \xf0\x9f\x98\x80 \"q\"\n");
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(root, "count")), 42);
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(root, "neg")), INT_MIN);
+    ASSERT(TOON_IS_DOUBLE(TOONc_get(root, "big")));
+    ASSERT(TOON_GET_DOUBLE(TOONc_get(root, "exp")) == 1000.0);
+    ASSERT(TOON_IS_BOOL(TOONc_get(root, "ok")));
+    ASSERT(TOON_IS_NULL(TOONc_get(root, "none")));
+    ASSERT_EQ(TOONc_getArrayLength(TOONc_get(root, "tags")), 4);
+    ASSERT_STR_EQ(TOON_GET_STRING(TOONc_get(root, "nested.deeper.leaf")), "x");
+    TOONc_free(root);
+
+    /* TOON -> JSON -> tree gives the same JSON again. */
+    const char *toon =
+        "user:\n"
+        "  id: 7\n"
+        "  tags[3]: a,\"b, c\",2.5\n"
+        "rows[2]{id,label}:\n"
+        "  1,\"tab\there\"\n"
+        "  2,two\n";
+    toonObject *from_toon = TOONc_parseString(toon);
+    toonWriter w1, w2;
+    TOONc_writerInitMemory(&w1);
+    TOONc_writeJSON(&w1, from_toon, 0, TOON_JSON_PRETTY);
+    toonObject *from_json = TOONc_parseJSON(w1.buf, w1.len);
+    ASSERT_NOT_NULL(from_json);
+    TOONc_writerInitMemory(&w2);
+    TOONc_writeJSON(&w2, from_json, 0, TOON_JSON_PRETTY);
+    ASSERT_EQ(w1.len, w2.len);
+    ASSERT(memcmp(w1.buf, w2.buf, w1.len) == 0);
+    TOONc_writerFree(&w1);
+    TOONc_writerFree(&w2);
+    TOONc_free(from_toon);
+    TOONc_free(from_json);
+
+    /* The buffer is bounded by 'len', not by a NUL. */
+    root = TOONc_parseJSON("[1,2]garbage", 5);
+    ASSERT_EQ(TOONc_getArrayLength(root), 2);
+    TOONc_free(root);
+
+    /* Errors: located, reported once, and fatal. */
+    struct { const char *text; int code; int line; int col; } bad[] = {
+        {"{\"a\": 1,\n \"b\" 2}", TOON_ERR_EXPECTED_COLON, 2, 6},
+        {"[1, 2", TOON_ERR_UNEXPECTED_END, 1, 6},
+        {"{\"a\": tru}", TOON_ERR_UNEXPECTED_CHAR, 1, 7},
+        {"[01]", TOON_ERR_UNEXPECTED_CHAR, 1, 3},
+        {"\"bad \\x\"", TOON_ERR_BAD_STRING, 1, 6},
+        {"\"raw\tTab\"", TOON_ERR_BAD_STRING, 1, 5},
+        {"{} {}", TOON_ERR_UNEXPECTED_CHAR, 1, 4},
+        {"", TOON_ERR_UNEXPECTED_END, 1, 1},
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        DiagSink sink = {0, {0, 0, 0}};
+        toonParseOptions opts = {0, collect_diag, &sink, NULL};
+        ASSERT_NULL(TOONc_parseJSONWithOptions(bad[i].text, strlen(bad[i].text), &opts));
+        ASSERT_EQ(sink.count, 1);
+        ASSERT_EQ(sink.first.code, bad[i].code);
+        ASSERT_EQ(sink.first.line, bad[i].line);
+        ASSERT_EQ(sink.first.col, bad[i].col);
+    }
+
+    /* Nesting is capped instead of exhausting the C stack. */
+    char deep[200];
+    memset(deep, '[', sizeof(deep));
+    DiagSink sink = {0, {0, 0, 0}};
+    toonParseOptions opts = {0, collect_diag, &sink, NULL};
+    ASSERT_NULL(TOONc_parseJSONWithOptions(deep, sizeof(deep), &opts));
+    ASSERT_EQ(sink.first.code, TOON_ERR_MAX_DEPTH);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("JSON parsing");
+    return 0;
+}
+
+/**
+ * Test 7j: Streaming JSON to TOON
+ *
+ * TOONc_transcodeJSONToTOON must match TOONc_parseJSON + TOONc_writeTOON
+ * whether an array fits the window, is buffered whole, or is streamed in
+ * two passes.
+ */
+static int test_stream_json_to_toon(void) {
+    TEST_BEGIN("Streaming JSON to TOON transcoding");
+    clock_t start = test_timer_start();
+
+    const char *docs[] = {
+        "{}",
+        "{\"name\": \"Ana\", \"age\": 31, \"ok\": true, \"none\": null,\n"
+        " \"nested\": {\"deep\": {\"x\": 1.5}, \"empty\": {}},\n"
+        " \"tags\": [\"a\", \"b, c\", \"-1\", 2, false],\n"
+        " \"rows\": [{\"id\": 1, \"n\": \"x\"}, {\"n\": \"y\", \"id\": 2},\n"
+        "          {\"id\": 3, \"n\": \"z\"}, {\"id\": 4, \"n\": \"w\"},\n"
+        "          {\"id\": 5, \"n\": \"v\"}, {\"id\": 6, \"n\": \"u\"}],\n"
+        " \"mixed\": [1, {\"a\": [1, 2]}, [3], {}, \"s\", {\"b\": 1},\n"
+        "           {\"c\": {\"d\": 1}}],\n"
+        " \"late\": [{\"a\": 1}, {\"a\": 2}, {\"a\": 3}, {\"a\": 4}, {\"b\": 5}],\n"
+        " \"none\": [], \"quoted key\": \"v\\n\"}",
+        "[{\"a\": 1}, {\"a\": 2}, {\"a\": 3}, {\"a\": 4}, {\"a\": 5}]",
+        "\"just a string\"",
+    };
+
+    size_t windows[] = {1, 4, 0};
+    for (size_t d = 0; d < sizeof(docs) / sizeof(docs[0]); d++) {
+        toonObject *tree = TOONc_parseJSON(docs[d], strlen(docs[d]));
+        ASSERT_NOT_NULL(tree);
+        size_t expected_len;
+        char *expected = TOONc_toTOON(tree, &expected_len);
+        TOONc_free(tree);
+
+        FILE *fp = tmpfile();
+        ASSERT_NOT_NULL(fp);
+        fputs(docs[d], fp);
+
+        for (size_t k = 0; k < sizeof(windows) / sizeof(windows[0]); k++) {
+            for (int two_pass = 0; two_pass < 2; two_pass++) {
+                rewind(fp);
+                toonWriter w;
+                TOONc_writerInitMemory(&w);
+                int rc = TOONc_transcodeJSONToTOON(fp, &w, windows[k],
+                        two_pass ? TOON_STREAM_TWO_PASS : 0, NULL);
+                ASSERT_EQ(rc, 0);
+                ASSERT_EQ(w.len, expected_len);
+                ASSERT(memcmp(w.buf, expected, expected_len) == 0);
+                TOONc_writerFree(&w);
+            }
+        }
+        fclose(fp);
+        free(expected);
+    }
+
+    /* A table far larger than the window and the reader's chunk. */
+    FILE *fp = tmpfile();
+    fputs("{\"meta\": {\"v\": 1}, \"rows\": [", fp);
+    for (int i = 0; i < 20000; i++)
+        fprintf(fp, "%s{\"id\": %d, \"name\": \"item %d\", \"score\": %d.5}",
+                i ? ",\n" : "", i, i, i % 100);
+    fputs("], \"tail\": \"end\"}", fp);
+
+    size_t src_len;
+    char *src = slurp_stream(fp, &src_len);
+    toonObject *tree = TOONc_parseJSON(src, src_len);
+    size_t expected_len;
+    char *expected = TOONc_toTOON(tree, &expected_len);
+    ASSERT(strstr(expected, "rows[20000]{id,name,score}:\n") != NULL);
+    TOONc_free(tree);
+    free(src);
+
+    rewind(fp);
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    ASSERT_EQ(TOONc_transcodeJSONToTOON(fp, &w, 64, TOON_STREAM_TWO_PASS, NULL), 0);
+    ASSERT_EQ(w.len, expected_len);
+    ASSERT(memcmp(w.buf, expected, expected_len) == 0);
+    TOONc_writerFree(&w);
+    free(expected);
+    fclose(fp);
+
+    /* Errors are located in the whole input, not in the buffered value. */
+    DiagSink sink = {0, {0, 0, 0}};
+    toonParseOptions opts = {0, collect_diag, &sink, NULL};
+    fp = tmpfile();
+    fputs("{\"a\": 1,\n \"b\": [1, 2,\n   tru]}", fp);
+    rewind(fp);
+    TOONc_writerInitMemory(&w);
+    ASSERT_EQ(TOONc_transcodeJSONToTOON(fp, &w, 0, 0, &opts), -1);
+    ASSERT_EQ(sink.count, 1);
+    ASSERT_EQ(sink.first.code, TOON_ERR_UNEXPECTED_CHAR);
+    ASSERT_EQ(sink.first.line, 3);
+    ASSERT_EQ(sink.first.col, 4);
+    TOONc_writerFree(&w);
+    fclose(fp);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("JSON to TOON streaming");
+    return 0;
+}
+
+/**
+ * Test 7k: Binary Snapshots
+ *
+ * A snapshot must read back the same data without deserialisation (tables
+ * by column), thaw to an identical tree, and refuse damaged images.
+ */
+static int test_snapshots(void) {
+    TEST_BEGIN("Binary snapshots");
+    clock_t start = test_timer_start();
+
+    const char *toon =
+        "name: Catalog\n"
+        "version: 3\n"
+        "ratio: 0.25\n"
+        "live: true\n"
+        "none: null\n"
+        "tags[3]: red,green,red\n"
+        "owner:\n"
+        "  name: Ana\n"
+        "  team:\n"
+        "    id: 7\n"
+        "items[3]{id,name,price}:\n"
+        "  1,Lamp,19.5\n"
+        "  2,Desk,120.0\n"
+        "  3,Lamp,21.0\n";
+    toonObject *root = TOONc_parseString(toon);
+    ASSERT_NOT_NULL(root);
+
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    ASSERT_EQ(TOONc_writeSnapshot(&w, root), 0);
+    size_t image_len;
+    char *image = TOONc_writerRelease(&w, &image_len);
+
+    toonSnapshot *s = TOONc_snapOpenBuffer(image, image_len);
+    ASSERT_NOT_NULL(s);
+    toonSnapRef top = TOONc_snapRoot(s);
+    ASSERT_EQ(TOONc_snapType(s, top), KV_OBJ);
+    ASSERT_EQ(TOONc_snapLength(s, top), 8);
+
+    size_t len;
+    ASSERT_STR_EQ(TOONc_snapString(s, TOONc_snapGet(s, top, "name"), &len), "Catalog");
+    ASSERT_EQ(len, 7);
+    ASSERT_EQ(TOONc_snapInt(s, TOONc_snapGet(s, top, "version")), 3);
+    ASSERT(TOONc_snapDouble(s, TOONc_snapGet(s, top, "ratio")) == 0.25);
+    ASSERT_EQ(TOONc_snapBool(s, TOONc_snapGet(s, top, "live")), 1);
+    ASSERT_EQ(TOONc_snapType(s, TOONc_snapGet(s, top, "none")), KV_NULL);
+    ASSERT_EQ(TOONc_snapInt(s, TOONc_snapGet(s, top, "owner.team.id")), 7);
+    ASSERT_EQ(TOONc_snapGet(s, top, "owner.missing"), TOON_SNAP_NONE);
+
+    toonSnapRef tags = TOONc_snapGet(s, top, "tags");
+    ASSERT_EQ(TOONc_snapType(s, tags), KV_LIST);
+    ASSERT_EQ(TOONc_snapLength(s, tags), 3);
+    ASSERT_STR_EQ(TOONc_snapString(s, TOONc_snapChild(s, tags, 1), NULL), "green");
+    ASSERT_EQ(TOONc_snapChild(s, tags, 3), TOON_SNAP_NONE);
+
+    /* Interned: both "red" values share one pool string. */
+    ASSERT(TOONc_snapString(s, TOONc_snapChild(s, tags, 0), NULL) ==
+           TOONc_snapString(s, TOONc_snapChild(s, tags, 2), NULL));
+
+    toonSnapRef items = TOONc_snapGet(s, top, "items");
+    ASSERT_EQ(TOONc_snapType(s, items), KV_TABLE);
+    ASSERT_EQ(TOONc_snapLength(s, items), 3);
+    ASSERT_EQ(TOONc_snapColumns(s, items), 3);
+    ASSERT_STR_EQ(TOONc_snapColumn(s, items, 2), "price");
+    ASSERT_STR_EQ(TOONc_snapString(s, TOONc_snapCell(s, items, 1, 1), NULL), "Desk");
+    ASSERT(TOONc_snapDouble(s, TOONc_snapCell(s, items, 2, 2)) == 21.0);
+    ASSERT_EQ(TOONc_snapCell(s, items, 3, 0), TOON_SNAP_NONE);
+
+    /* Thawing gives back the same document. */
+    toonObject *thawed = TOONc_snapThaw(s, top);
+    char *expected = TOONc_toTOON(root, NULL);
+    char *actual = TOONc_toTOON(thawed, NULL);
+    ASSERT_STR_EQ(actual, expected);
+    free(expected);
+    free(actual);
+    TOONc_free(thawed);
+    TOONc_snapClose(s);
+    TOONc_free(root);
+
+    /* Damaged images are refused at open. */
+    ASSERT_NULL(TOONc_snapOpenBuffer(image, image_len - 1));
+    image[0] ^= 1;
+    ASSERT_NULL(TOONc_snapOpenBuffer(image, image_len));
+    image[0] ^= 1;
+
+    /* Flipping bits anywhere either gets the image refused or leaves one
+     * that still thaws; spans pointing back at an ancestor must not loop. */
+    static const unsigned char masks[] = {0x01, 0x02, 0x80, 0xff};
+    int refused = 0;
+    for (size_t i = 0; i < image_len; i++) {
+        for (size_t m = 0; m < sizeof(masks); m++) {
+            image[i] ^= masks[m];
+            s = TOONc_snapOpenBuffer(image, image_len);
+            if (s) {
+                TOONc_free(TOONc_snapThaw(s, TOONc_snapRoot(s)));
+                TOONc_snapClose(s);
+            } else {
+                refused++;
+            }
+            image[i] ^= masks[m];
+        }
+    }
+    ASSERT(refused > 0);
+    s = TOONc_snapOpenBuffer(image, image_len);
+    ASSERT_NOT_NULL(s);
+    TOONc_snapClose(s);
+    free(image);
+
+    /* Save to a file and map it back; compare cold load with a parse. */
+    toonObject *big = TOONc_newObject(KV_OBJ);
+    toonObject *rows = TOONc_newListObj();
+    rows->key = strdup("rows");
+    for (int i = 0; i < 20000; i++) {
+        toonObject *row = TOONc_newObject(KV_OBJ);
+        toonObject *id = TOONc_newIntObj(i);
+        id->key = strdup("id");
+        toonObject *label = i % 2 ? TOONc_newStringObj("odd", 3)
+                                   : TOONc_newStringObj("even", 4);
+        label->key = strdup("label");
+        id->next = label;
+        row->child = id;
+        TOONc_listPush(rows, row);
+    }
+    big->child = rows;
+    size_t toon_len;
+    char *big_toon = TOONc_toTOON(big, &toon_len);
+
+    char path[] = "/tmp/toonc_snap_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT(fd != -1);
+    close(fd);
+    ASSERT_EQ(TOONc_snapSave(big, path), 0);
+
+    clock_t t = test_timer_start();
+    toonObject *parsed = TOONc_parseString(big_toon);
+    double parse_time = test_timer_end(t);
+
+    t = test_timer_start();
+    s = TOONc_snapOpen(path);
+    double open_time = test_timer_end(t);
+
+    ASSERT_NOT_NULL(s);
+    items = TOONc_snapGet(s, TOONc_snapRoot(s), "rows");
+    ASSERT_EQ(TOONc_snapLength(s, items), 20000);
+    ASSERT_EQ(TOONc_snapInt(s, TOONc_snapCell(s, items, 12345, 0)), 12345);
+    ASSERT_STR_EQ(TOONc_snapString(s, TOONc_snapCell(s, items, 12345, 1), NULL), "odd");
+    printf("  Parse %zu bytes: %.3f ms, snapshot open: %.3f ms\n",
+           toon_len, parse_time * 1000, open_time * 1000);
+
+    TOONc_snapClose(s);
+    unlink(path);
+    TOONc_free(parsed);
+    TOONc_free(big);
+    free(big_toon);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Binary snapshots");
+    return 0;
+}
+
+/* Encode a single value and compare with the expected CBOR bytes. */
+static int cbor_bytes_equal(toonObject *o, const char *hex) {
+    size_t len;
+    unsigned char *buf = TOONc_toCBOR(o, &len, 0);
+    char out[64] = "";
+    for (size_t i = 0; i < len && i < 31; i++)
+        sprintf(out + 2 * i, "%02x", buf[i]);
+    free(buf);
+    TOONc_free(o);
+    return strcmp(out, hex) == 0;
+}
+
+/* Decode hex-encoded CBOR. */
+static toonObject *cbor_decode_hex(const char *hex) {
+    unsigned char buf[64];
+    size_t len = strlen(hex) / 2;
+    for (size_t i = 0; i < len; i++) {
+        unsigned v;
+        sscanf(hex + 2 * i, "%2x", &v);
+        buf[i] = (unsigned char)v;
+    }
+    return TOONc_parseCBOR(buf, len);
+}
+
+/**
+ * Test 7l: CBOR Encoding
+ *
+ * Values encode to the RFC 8949 shortest forms, trees round-trip through
+ * CBOR with and without table compaction, and malformed input is refused.
+ */
+static int test_cbor(void) {
+    TEST_BEGIN("CBOR encode/decode");
+    clock_t start = test_timer_start();
+
+    /* RFC 8949 Appendix A vectors (floats as float32 when exact). */
+    ASSERT(cbor_bytes_equal(TOONc_newIntObj(0), "00"));
+    ASSERT(cbor_bytes_equal(TOONc_newIntObj(23), "17"));
+    ASSERT(cbor_bytes_equal(TOONc_newIntObj(24), "1818"));
+    ASSERT(cbor_bytes_equal(TOONc_newIntObj(1000), "1903e8"));
+    ASSERT(cbor_bytes_equal(TOONc_newIntObj(1000000), "1a000f4240"));
+    ASSERT(cbor_bytes_equal(TOONc_newIntObj(-1000), "3903e7"));
+    ASSERT(cbor_bytes_equal(TOONc_newDoubleObj(100000.0), "fa47c35000"));
+    ASSERT(cbor_bytes_equal(TOONc_newDoubleObj(1.1), "fb3ff199999999999a"));
+    ASSERT(cbor_bytes_equal(TOONc_newBoolObj(1), "f5"));
+    ASSERT(cbor_bytes_equal(TOONc_newNullObj(), "f6"));
+    ASSERT(cbor_bytes_equal(TOONc_newStringObj("IETF", 4), "6449455446"));
+
+    /* Decoding: half floats, indefinite lengths, big and negative ints. */
+    toonObject *o = cbor_decode_hex("f93e00");
+    ASSERT(TOON_GET_DOUBLE(o) == 1.5);
+    TOONc_free(o);
+    o = cbor_decode_hex("3bffffffffffffffff");
+    ASSERT(TOON_GET_DOUBLE(o) == -18446744073709551616.0);
+    TOONc_free(o);
+    o = cbor_decode_hex("bf61610161629f0203ffff");
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(o, "a")), 1);
+    ASSERT_EQ(TOONc_getArrayLength(TOONc_get(o, "b")), 2);
+    TOONc_free(o);
+    o = cbor_decode_hex("7f657374726561646d696e67ff");
+    ASSERT_STR_EQ(TOON_GET_STRING(o), "streaming");
+    TOONc_free(o);
+
+    /* Malformed: truncated, reserved info, bad break, trailing bytes,
+     * and a count larger than the input. */
+    const char *bad[] = {"1903", "1c", "ff", "0000", "9b00000000ffffffff", "a1"};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+        ASSERT_NULL(cbor_decode_hex(bad[i]));
+
+    /* Round trip, with the table sent as a shared header. */
+    const char *toon =
+        "name: \"caf\xc3\xa9\"\n"
+        "count: -2147483648\n"
+        "ratio: 0.1\n"
+        "flags[3]: true,false,null\n"
+        "nested:\n"
+        "  deeper:\n"
+        "    leaf: x\n"
+        "rows[3]{id,label,score}:\n"
+        "  1,one,1.5\n"
+        "  2,two,2.5\n"
+        "  3,three,3.5\n";
+    toonObject *root = TOONc_parseString(toon);
+    char *expected = TOONc_toTOON(root, NULL);
+
+    size_t table_len, plain_len;
+    unsigned char *with_tables = TOONc_toCBOR(root, &table_len, 0);
+    unsigned char *without = TOONc_toCBOR(root, &plain_len, TOON_CBOR_NO_TABLES);
+    ASSERT(table_len < plain_len);
+
+    toonObject *back = TOONc_parseCBOR(with_tables, table_len);
+    ASSERT_NOT_NULL(back);
+    char *actual = TOONc_toTOON(back, NULL);
+    ASSERT_STR_EQ(actual, expected);
+    free(actual);
+    TOONc_free(back);
+
+    back = TOONc_parseCBOR(without, plain_len);
+    ASSERT_NOT_NULL(back);
+    actual = TOONc_toTOON(back, NULL);
+    ASSERT_STR_EQ(actual, expected);
+    free(actual);
+    TOONc_free(back);
+
+    /* Every truncation of a valid encoding is rejected cleanly. */
+    for (size_t n = 0; n < table_len; n++)
+        ASSERT_NULL(TOONc_parseCBOR(with_tables, n));
+
+    size_t json_len = TOONc_measureJSON(root, TOON_JSON_COMPACT);
+    printf("  Compact JSON: %zu bytes, CBOR: %zu bytes (%zu without tables)\n",
+           json_len, table_len, plain_len);
+
+    free(with_tables);
+    free(without);
+    free(expected);
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("CBOR");
+    return 0;
+}
+
+/**
+ * Test 7m: Document Cache
+ *
+ * Lookups hit until the file changes, documents outlive their eviction
+ * while retained, the budget drops cold entries, and concurrent lookups
+ * share one parse.
+ */
+static void write_text_file(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+typedef struct {
+    toonCache *cache;
+    const char *path;
+    int bad;
+} CacheWorker;
+
+static void *cache_worker(void *arg) {
+    CacheWorker *cw = arg;
+    for (int i = 0; i < 2000; i++) {
+        toonDoc *doc = TOONc_cacheGet(cw->cache, cw->path);
+        if (!doc || TOON_GET_INT(TOONc_get(doc->root, "server.port")) != 8080)
+            cw->bad++;
+        TOONc_docRelease(doc);
+    }
+    return NULL;
+}
+
+static int test_cache(void) {
+    TEST_BEGIN("Document cache");
+    clock_t start = test_timer_start();
+
+    char a[] = "/tmp/toonc_cacheXXXXXX", b[] = "/tmp/toonc_cacheXXXXXX";
+    close(mkstemp(a));
+    close(mkstemp(b));
+    write_text_file(a, "server:\n  host: localhost\n  port: 8080\n");
+    write_text_file(b, "items[3]: 1,2,3\n");
+
+    toonCache *cache = TOONc_cacheNew(0);
+    size_t hits, misses, bytes;
+
+    toonDoc *d1 = TOONc_cacheGet(cache, a);
+    toonDoc *d2 = TOONc_cacheGet(cache, a);
+    ASSERT_NOT_NULL(d1);
+    ASSERT(d1 == d2);
+    TOONc_cacheStats(cache, &hits, &misses, &bytes);
+    ASSERT_EQ((int)hits, 1);
+    ASSERT_EQ((int)misses, 1);
+    ASSERT_EQ((int)bytes, (int)d1->bytes);
+    TOONc_docRelease(d2);
+
+    /* A changed file is parsed again; the old document stays usable. */
+    write_text_file(a, "server:\n  host: example.org\n  port: 8080\n");
+    d2 = TOONc_cacheGet(cache, a);
+    ASSERT(d2 != d1);
+    ASSERT_STR_EQ(TOON_GET_STRING(TOONc_get(d2->root, "server.host")), "example.org");
+    ASSERT_STR_EQ(TOON_GET_STRING(TOONc_get(d1->root, "server.host")), "localhost");
+    TOONc_docRelease(d1);
+    TOONc_docRelease(d2);
+
+    ASSERT_NULL(TOONc_cacheGet(cache, "/nonexistent/toonc.toon"));
+
+    /* Concurrent lookups of an unchanged file. */
+    pthread_t threads[8];
+    CacheWorker workers[8];
+    for (int i = 0; i < 8; i++) {
+        workers[i] = (CacheWorker){cache, a, 0};
+        pthread_create(&threads[i], NULL, cache_worker, &workers[i]);
+    }
+    for (int i = 0; i < 8; i++) {
+        pthread_join(threads[i], NULL);
+        ASSERT_EQ(workers[i].bad, 0);
+    }
+    TOONc_cacheStats(cache, &hits, &misses, &bytes);
+    ASSERT_EQ((int)misses, 2);
+
+    /* An empty file is an empty document, not a failure. */
+    char e[] = "/tmp/toonc_cacheXXXXXX";
+    close(mkstemp(e));
+    toonDoc *de = TOONc_cacheGet(cache, e);
+    ASSERT_NOT_NULL(de);
+    ASSERT_NOT_NULL(de->root);
+    ASSERT_NULL(de->root->child);
+    TOONc_docRelease(de);
+    unlink(e);
+    TOONc_cacheFree(cache);
+
+    /* A budget that fits one document evicts the other. */
+    cache = TOONc_cacheNew(1);
+    d1 = TOONc_cacheGet(cache, a);
+    toonDoc *db = TOONc_cacheGet(cache, b);
+    TOONc_cacheStats(cache, NULL, NULL, &bytes);
+    ASSERT_EQ((int)bytes, (int)db->bytes);
+    d2 = TOONc_cacheGet(cache, a);
+    ASSERT(d2 != d1);
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(d1->root, "server.port")), 8080);
+    TOONc_cacheStats(cache, &hits, &misses, NULL);
+    ASSERT_EQ((int)hits, 0);
+    ASSERT_EQ((int)misses, 3);
+    TOONc_cacheFree(cache);
+    ASSERT_EQ(TOONc_getArrayLength(TOONc_get(db->root, "items")), 3);
+    TOONc_docRelease(d1);
+    TOONc_docRelease(d2);
+    TOONc_docRelease(db);
+
+    unlink(a);
+    unlink(b);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Document cache");
+    return 0;
+}
+
+/**
+ * Test 7n: Concurrent Readers
+ *
+ * Many threads look up, index and emit one shared document at once; each
+ * holds its own reference and the last release frees the tree.
+ */
+typedef struct {
+    toonDoc *doc;
+    const char *json;
+    int bad;
+} ReaderWorker;
+
+static void *reader_worker(void *arg) {
+    ReaderWorker *rw = arg;
+    toonObject *root = rw->doc->root;
+    for (int i = 0; i < 500; i++) {
+        if (TOON_GET_INT(TOONc_get(root, "server.port")) != 8080) rw->bad++;
+        if (TOON_GET_INT(TOONc_get(root, "limits.burst")) != 20) rw->bad++;
+        if (TOONc_get(root, "server.missing")) rw->bad++;
+
+        toonObject *users = TOONc_get(root, "users");
+        size_t n = TOONc_getArrayLength(users);
+        for (size_t r = 0; r < n; r++) {
+            toonObject *id = TOONc_get(TOONc_getArrayItem(users, r), "id");
+            if (TOON_GET_INT(id) != (int)r + 1) rw->bad++;
+        }
+
+        int members = 0;
+        for (toonObject *c = root->child; c; c = c->next) members++;
+        if (members != 3) rw->bad++;
+
+        char buf[512];
+        size_t needed;
+        if (TOONc_toJSONBuffer(root, buf, sizeof(buf), &needed, TOON_JSON_COMPACT) != 0 ||
+            strcmp(buf, rw->json) != 0)
+            rw->bad++;
+    }
+    TOONc_docRelease(rw->doc);
+    return NULL;
+}
+
+static int test_concurrent_readers(void) {
+    TEST_BEGIN("Concurrent readers");
+    clock_t start = test_timer_start();
+
+    toonDoc *doc = TOONc_docParseString(
+        "server:\n  host: localhost\n  port: 8080\n"
+        "limits:\n  rate: 2.5\n  burst: 20\n"
+        "users[3]{id,name}:\n  1,ann\n  2,bob\n  3,cyd\n");
+    ASSERT_NOT_NULL(doc);
+    ASSERT_EQ(doc->refs, 1);
+    ASSERT_NULL(TOONc_docParseString(NULL));
+
+    char json[512];
+    size_t needed;
+    ASSERT_EQ(TOONc_toJSONBuffer(doc->root, json, sizeof(json), &needed, TOON_JSON_COMPACT), 0);
+
+    pthread_t threads[8];
+    ReaderWorker workers[8];
+    for (int i = 0; i < 8; i++) {
+        workers[i] = (ReaderWorker){TOONc_docRetain(doc), json, 0};
+        pthread_create(&threads[i], NULL, reader_worker, &workers[i]);
+    }
+    /* Drop ours while the readers still run. */
+    TOONc_docRelease(doc);
+    for (int i = 0; i < 8; i++) {
+        pthread_join(threads[i], NULL);
+        ASSERT_EQ(workers[i].bad, 0);
+    }
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Concurrent readers");
+    return 0;
+}
+
+/**
+ * Test 7o: Hot-Swapped Documents
+ *
+ * Readers acquire from a handle without locks while a writer publishes new
+ * versions; every reader sees a complete document, versions never go
+ * backwards, and retired documents are freed (checked by the sanitizers).
+ */
+typedef struct {
+    toonHandle *handle;
+    int stop;
+    int bad;
+    long reads;
+} SwapWorker;
+
+static toonDoc *versioned_doc(int version) {
+    char text[128];
+    snprintf(text, sizeof(text), "version: %d\nmirror:\n  version: %d\n", version, version);
+    return TOONc_docParseString(text);
+}
+
+static void *swap_reader(void *arg) {
+    SwapWorker *sw = arg;
+    int last = -1;
+    while (!__atomic_load_n(&sw->stop, __ATOMIC_ACQUIRE)) {
+        toonDoc *doc = TOONc_handleAcquire(sw->handle);
+        int v = TOON_GET_INT(TOONc_get(doc->root, "version"));
+        if (v != TOON_GET_INT(TOONc_get(doc->root, "mirror.version")) || v < last)
+            __atomic_add_fetch(&sw->bad, 1, __ATOMIC_RELAXED);
+        last = v;
+        TOONc_docRelease(doc);
+        __atomic_add_fetch(&sw->reads, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static int test_hot_swap(void) {
+    TEST_BEGIN("Hot-swapped documents");
+    clock_t start = test_timer_start();
+
+    SwapWorker sw = {TOONc_handleNew(versioned_doc(0)), 0, 0, 0};
+
+    /* A reader keeps its version across a publish. */
+    toonDoc *held = TOONc_handleAcquire(sw.handle);
+    TOONc_handlePublish(sw.handle, versioned_doc(1));
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(held->root, "version")), 0);
+    toonDoc *cur = TOONc_handleAcquire(sw.handle);
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(cur->root, "version")), 1);
+    TOONc_docRelease(cur);
+    TOONc_docRelease(held);
+
+    pthread_t threads[8];
+    for (int i = 0; i < 8; i++)
+        pthread_create(&threads[i], NULL, swap_reader, &sw);
+    /* Pace the writer on reader progress so the two overlap. */
+    for (int v = 2; v <= 300; v++) {
+        long seen = __atomic_load_n(&sw.reads, __ATOMIC_RELAXED);
+        while (__atomic_load_n(&sw.reads, __ATOMIC_RELAXED) < seen + 16)
+            sched_yield();
+        TOONc_handlePublish(sw.handle, versioned_doc(v));
+    }
+    __atomic_store_n(&sw.stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < 8; i++)
+        pthread_join(threads[i], NULL);
+    ASSERT_EQ(sw.bad, 0);
+
+    cur = TOONc_handleAcquire(sw.handle);
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(cur->root, "version")), 300);
+    TOONc_docRelease(cur);
+    TOONc_handleFree(sw.handle);
+
+    printf("  %ld reads across 299 publishes\n", sw.reads);
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Hot-swapped documents");
+    return 0;
+}
+
+/**
+ * Test 7p: Incremental Reload
+ *
+ * Reloading edited text matches a full parse and shares the sections
+ * outside the edit; a watcher picks up both in-place writes and files
+ * replaced by rename.
+ */
+typedef struct {
+    int calls;
+    toonDoc *last;
+} WatchSeen;
+
+static void watch_seen(const char *path, toonDoc *doc, void *ctx) {
+    WatchSeen *seen = ctx;
+    (void)path;
+    seen->calls++;
+    TOONc_docRelease(seen->last);
+    seen->last = TOONc_docRetain(doc);
+}
+
+static int reload_matches_parse(toonDoc *doc, const char *text) {
+    toonObject *full = TOONc_parseString(text);
+    char *a = TOONc_toTOON(doc->root, NULL);
+    char *b = TOONc_toTOON(full, NULL);
+    int same = strcmp(a, b) == 0;
+    free(a);
+    free(b);
+    TOONc_free(full);
+    return same;
+}
+
+static int test_incremental_reload(void) {
+    TEST_BEGIN("Incremental reload");
+    clock_t start = test_timer_start();
+
+    const char *v1 =
+        "# service\n"
+        "server:\n  host: localhost\n  port: 8080\n"
+        "users[2]{id,name}:\n  1,ann\n  2,bob\n"
+        "limits:\n  burst: 20\n";
+    const char *v2 =
+        "# service\n"
+        "server:\n  host: localhost\n  port: 8080\n"
+        "users[3]{id,name}:\n  1,ann\n  2,bob\n  3,cyd\n"
+        "limits:\n  burst: 20\n";
+
+    toonDoc *d1 = TOONc_docReload(NULL, v1, strlen(v1));
+    ASSERT(reload_matches_parse(d1, v1));
+    toonDoc *d2 = TOONc_docReload(d1, v2, strlen(v2));
+    ASSERT(reload_matches_parse(d2, v2));
+    ASSERT(TOONc_docReload(d2, v2, strlen(v2)) == d2);
+    TOONc_docRelease(d2);
+
+    /* Unchanged sections are shared, the edited one is new. */
+    ASSERT(TOONc_get(d2->root, "server")->child == TOONc_get(d1->root, "server")->child);
+    ASSERT(TOONc_get(d2->root, "limits")->child == TOONc_get(d1->root, "limits")->child);
+    ASSERT_EQ(TOONc_getArrayLength(TOONc_get(d2->root, "users")), 3);
+    ASSERT_EQ(TOONc_getArrayLength(TOONc_get(d1->root, "users")), 2);
+
+    /* An edit that turns a section head into a continuation line. */
+    const char *v3 =
+        "# service\n"
+        "server:\n  host: localhost\n  port: 8080\n"
+        "users[3]{id,name}:\n  1,ann\n  2,bob\n  3,cyd\n"
+        "  limits:\n  burst: 20\n";
+    toonDoc *d3 = TOONc_docReload(d2, v3, strlen(v3));
+    ASSERT(reload_matches_parse(d3, v3));
+    TOONc_docRelease(d1);
+    TOONc_docRelease(d2);
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(d3->root, "server.port")), 8080);
+    TOONc_docRelease(d3);
+
+    /* Watch a file through an in-place write and a rename over it. */
+    char dir[] = "/tmp/toonc_watchXXXXXX";
+    ASSERT_NOT_NULL(mkdtemp(dir));
+    char path[64], tmp[64];
+    snprintf(path, sizeof(path), "%s/app.toon", dir);
+    snprintf(tmp, sizeof(tmp), "%s/app.toon.new", dir);
+    write_text_file(path, v1);
+
+    toonWatcher *w = TOONc_watchNew();
+    ASSERT_NOT_NULL(w);
+    WatchSeen seen = {0, NULL};
+    ASSERT_EQ(TOONc_watchAdd(w, path, watch_seen, &seen), 0);
+    ASSERT_EQ(TOONc_watchAdd(w, "/nonexistent/app.toon", NULL, NULL), -1);
+    ASSERT(TOONc_watchFd(w) >= 0);
+    ASSERT_EQ(TOONc_watchDispatch(w, 0), 0);
+
+    write_text_file(path, v2);
+    ASSERT_EQ(TOONc_watchDispatch(w, 2000), 1);
+    ASSERT_EQ(seen.calls, 1);
+    ASSERT_EQ(TOONc_getArrayLength(TOONc_get(seen.last->root, "users")), 3);
+
+    write_text_file(tmp, v3);
+    ASSERT_EQ(rename(tmp, path), 0);
+    ASSERT_EQ(TOONc_watchDispatch(w, 2000), 1);
+    ASSERT_EQ(seen.calls, 2);
+    ASSERT(reload_matches_parse(seen.last, v3));
+    toonDoc *cur = TOONc_watchDoc(w, path);
+    ASSERT(cur == seen.last);
+    TOONc_docRelease(cur);
+
+    /* Rewriting the same bytes is an event but not a new version. */
+    write_text_file(path, v3);
+    ASSERT_EQ(TOONc_watchDispatch(w, 2000), 0);
+    ASSERT_EQ(seen.calls, 2);
+
+    TOONc_watchFree(w);
+    TOONc_docRelease(seen.last);
+    unlink(path);
+    rmdir(dir);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Incremental reload");
+    return 0;
+}
+
+/**
+ * Test 7q: Reparse After Edits
+ *
+ * Keystroke-sized edits applied with TOONc_reparse() leave the same tree
+ * as a full parse; edits inside a table replace only the touched rows.
+ */
+static int apply_edit(toonDoc *doc, char *text, size_t offset, size_t removed,
+                      const char *inserted) {
+    size_t ins = strlen(inserted);
+    memmove(text + offset + ins, text + offset + removed, strlen(text + offset + removed) + 1);
+    memcpy(text + offset, inserted, ins);
+    return TOONc_reparse(doc, offset, removed, inserted) == 0 &&
+           reload_matches_parse(doc, text);
+}
+
+static int test_reparse(void) {
+    TEST_BEGIN("Reparse after edits");
+    clock_t start = test_timer_start();
+
+    char text[512] =
+        "name: demo\n"
+        "users[3]{id,name}:\n  1,ann\n  2,bob\n  3,cyd\n"
+        "limits:\n  burst: 20\n";
+    toonDoc *doc = TOONc_docReload(NULL, text, strlen(text));
+
+    /* A cell edit swaps in just that row. */
+    toonObject *users = TOONc_get(doc->root, "users");
+    toonObject *row0 = TOONc_getArrayItem(users, 0);
+    toonObject *limits = TOONc_get(doc->root, "limits")->child;
+    size_t at = strstr(text, "bob") - text;
+    ASSERT(apply_edit(doc, text, at, 3, "bea"));
+    ASSERT(TOONc_getArrayItem(TOONc_get(doc->root, "users"), 0) == row0);
+    ASSERT(TOONc_get(doc->root, "limits")->child == limits);
+    ASSERT_STR_EQ(TOON_GET_STRING(TOONc_get(TOONc_getArrayItem(users, 1), "name")), "bea");
+
+    /* Type a new top-level key one character at a time. */
+    const char *typed = "mode: fast\n";
+    at = strstr(text, "limits:") - text;
+    for (size_t i = 0; typed[i]; i++) {
+        char ch[2] = {typed[i], '\0'};
+        ASSERT(apply_edit(doc, text, at + i, 0, ch));
+    }
+    ASSERT_STR_EQ(TOON_GET_STRING(TOONc_get(doc->root, "mode")), "fast");
+    ASSERT(TOONc_getArrayItem(TOONc_get(doc->root, "users"), 0) == row0);
+
+    /* Edits that change the table's shape fall back to its section. */
+    at = strstr(text, "users[3]") - text + 6;
+    ASSERT(apply_edit(doc, text, at, 1, "2"));
+    ASSERT_EQ(TOONc_getArrayLength(TOONc_get(doc->root, "users")), 2);
+    at = strstr(text, "  3,cyd\n") - text;
+    ASSERT(apply_edit(doc, text, at, 8, ""));
+    at = strstr(text, "  1,ann\n") - text;
+    ASSERT(apply_edit(doc, text, at, 0, "  # comment\n"));
+    ASSERT(apply_edit(doc, text, strlen(text), 0, "extra"));
+    ASSERT(apply_edit(doc, text, 0, strlen(text), ""));
+    ASSERT_NULL(doc->root->child);
+
+    /* Shared documents and bad ranges are refused. */
+    ASSERT_EQ(TOONc_reparse(doc, 1, 0, "x"), -1);
+    TOONc_docRetain(doc);
+    ASSERT_EQ(TOONc_reparse(doc, 0, 0, "x"), -1);
+    TOONc_docRelease(doc);
+    TOONc_docRelease(doc);
+
+    toonDoc *plain = TOONc_docParseString("a: 1\n");
+    ASSERT_EQ(TOONc_reparse(plain, 0, 0, "b: 2\n"), -1);
+    TOONc_docRelease(plain);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Reparse after edits");
+    return 0;
+}
+
 /**
- * Test 7: Object Creation API
- * 
- * Tests programmatic object creation and manipulation.
+ * Test 7r: Source Spans
+ *
+ * With a span map, every key and value maps back to its bytes and line in
+ * the source, and members cover the lines of all their descendants.
  */
-static int test_object_creation(void) {
-    TEST_BEGIN("Object creation API");
+static int span_is(const toonSpanMap *m, size_t off, size_t len, const char *want) {
+    const char *text = TOONc_spanSource(m, NULL);
+    return len == strlen(want) && memcmp(text + off, want, len) == 0;
+}
+
+static int test_source_spans(void) {
+    TEST_BEGIN("Source spans");
     clock_t start = test_timer_start();
-    
-    /* Create root object */
-    toonObject *root = TOONc_newObject(KV_OBJ);
+
+    const char *text =
+        "# settings\n"
+        "name: \"demo app\"  # quoted\n"
+        "server:\n"
+        "  host: localhost\n"
+        "  ports[2]: 80, 443\n"
+        "\n"
+        "hikes[2]{id,name}:\n"
+        "  1,Blue Lake\n"
+        "  2,Ridge\n"
+        "done: true";
+    toonSpanMap *spans = TOONc_spanMapNew();
+    toonParseOptions opts = {0, NULL, NULL, spans};
+    toonObject *root = TOONc_parseStringWithOptions(text, &opts);
     ASSERT_NOT_NULL(root);
-    
-    /* Create various typed properties */
-    toonObject *name = TOONc_newStringObj("Test User", 9);
-    name->key = strdup("name");
-    
-    toonObject *age = TOONc_newIntObj(42);
-    age->key = strdup("age");
-    
-    toonObject *score = TOONc_newDoubleObj(95.5);
-    score->key = strdup("score");
-    
-    toonObject *active = TOONc_newBoolObj(1);
-    active->key = strdup("active");
-    
-    toonObject *null_val = TOONc_newNullObj();
-    null_val->key = strdup("null_field");
-    
-    /* Create array */
-    toonObject *tags = TOONc_newListObj();
-    tags->key = strdup("tags");
-    TOONc_listPush(tags, TOONc_newStringObj("admin", 5));
-    TOONc_listPush(tags, TOONc_newStringObj("user", 4));
-    TOONc_listPush(tags, TOONc_newStringObj("tester", 6));
-    
-    /* Link properties as siblings */
-    root->child = name;
-    name->next = age;
-    age->next = score;
-    score->next = active;
-    active->next = null_val;
-    null_val->next = tags;
-    
-    /* Verify all properties */
-    ASSERT_TYPE(name, TOON_IS_STRING);
-    ASSERT_STR_EQ(TOON_GET_STRING(name), "Test User");
-    
-    ASSERT_TYPE(age, TOON_IS_INT);
-    ASSERT_EQ(TOON_GET_INT(age), 42);
-    
-    ASSERT_TYPE(score, TOON_IS_DOUBLE);
-    ASSERT_FLOAT_EQ(TOON_GET_DOUBLE(score), 95.5, 0.0001);
-    
-    ASSERT_TYPE(active, TOON_IS_BOOL);
-    ASSERT_EQ(TOON_GET_BOOL(active), 1);
-    
-    ASSERT_TYPE(null_val, TOON_IS_NULL);
-    
-    ASSERT_TYPE(tags, TOON_IS_LIST);
-    ASSERT_EQ(TOONc_getArrayLength(tags), 3);
-    
-    /* Test TOONc_get on created structure */
-    toonObject *found = TOONc_get(root, "name");
-    ASSERT_NOT_NULL(found);
-    ASSERT(found == name);
-    
-    /* Print for visual verification */
-    printf("  Programmatically created object:\n");
-    debug_print_object(root->child, 2);
-    
-    /* Test JSON export */
-    printf("  JSON representation:\n");
-    FILE *json_out = tmpfile();
-    ASSERT_NOT_NULL(json_out);
-    TOONc_toJSON(root, json_out, 0);
-    rewind(json_out);
-    
-    char json_buf[1024];
-    size_t read = fread(json_buf, 1, sizeof(json_buf) - 1, json_out);
-    json_buf[read] = '\0';
-    printf("    %s\n", json_buf);
-    fclose(json_out);
-    
+
+    const toonSpan *sp = TOONc_spanOf(spans, TOONc_get(root, "name"));
+    ASSERT_NOT_NULL(sp);
+    ASSERT_EQ(sp->line, 2);
+    ASSERT(span_is(spans, sp->key, sp->key_len, "name"));
+    ASSERT(span_is(spans, sp->value, sp->value_len, "\"demo app\""));
+    ASSERT(span_is(spans, sp->start, sp->end - sp->start, "name: \"demo app\"  # quoted\n"));
+
+    /* A nested object spans its children's lines. */
+    sp = TOONc_spanOf(spans, TOONc_get(root, "server"));
+    ASSERT_EQ(sp->line, 3);
+    ASSERT(span_is(spans, sp->start, sp->end - sp->start,
+                   "server:\n  host: localhost\n  ports[2]: 80, 443\n"));
+    ASSERT(span_is(spans, sp->value, sp->value_len,
+                   "  host: localhost\n  ports[2]: 80, 443"));
+
+    toonObject *ports = TOONc_get(root, "server.ports");
+    sp = TOONc_spanOf(spans, ports);
+    ASSERT(span_is(spans, sp->key, sp->key_len, "ports"));
+    ASSERT(span_is(spans, sp->value, sp->value_len, "80, 443"));
+    sp = TOONc_spanOf(spans, TOONc_getArrayItem(ports, 1));
+    ASSERT_EQ(sp->key_len, 0);
+    ASSERT_EQ(sp->line, 5);
+    ASSERT(span_is(spans, sp->value, sp->value_len, "443"));
+
+    /* Tables: the rows below the header, each row its line, each cell. */
+    toonObject *hikes = TOONc_get(root, "hikes");
+    sp = TOONc_spanOf(spans, hikes);
+    ASSERT_EQ(sp->line, 7);
+    ASSERT(span_is(spans, sp->value, sp->value_len, "  1,Blue Lake\n  2,Ridge"));
+    toonObject *row = TOONc_getArrayItem(hikes, 1);
+    sp = TOONc_spanOf(spans, row);
+    ASSERT_EQ(sp->line, 9);
+    ASSERT(span_is(spans, sp->start, sp->end - sp->start, "  2,Ridge\n"));
+    sp = TOONc_spanOf(spans, TOONc_get(row, "name"));
+    ASSERT(span_is(spans, sp->value, sp->value_len, "Ridge"));
+
+    sp = TOONc_spanOf(spans, TOONc_get(root, "done"));
+    ASSERT_EQ(sp->line, 10);
+    ASSERT(span_is(spans, sp->start, sp->end - sp->start, "done: true"));
+    sp = TOONc_spanOf(spans, root);
+    ASSERT_EQ(sp->end, strlen(text));
+
+    /* Every node has exactly one span; strangers have none. */
+    ASSERT_EQ(TOONc_spanCount(spans), 15);
+    toonObject *other = TOONc_newIntObj(1);
+    ASSERT_NULL(TOONc_spanOf(spans, other));
+    TOONc_free(other);
+
+    /* The next parse replaces the map's contents. */
     TOONc_free(root);
-    
+    root = TOONc_parseStringWithOptions("a: 1\n", &opts);
+    ASSERT_EQ(TOONc_spanCount(spans), 2);
+    sp = TOONc_spanOf(spans, root->child);
+    ASSERT(span_is(spans, sp->value, sp->value_len, "1"));
+
+    TOONc_free(root);
+    TOONc_spanMapFree(spans);
+
     double elapsed = test_timer_end(start);
     printf("  Completed in %.3f ms\n", elapsed * 1000);
-    TEST_END("Object creation");
+    TEST_END("Source spans");
+    return 0;
+}
+
+/**
+ * Test 7s: Verbatim Re-emission
+ *
+ * TOONc_writeTOONSpans() copies the source of unchanged subtrees, comments
+ * and spacing included, and re-encodes only what was changed.
+ */
+static char *write_spans(toonObject *root, const toonSpanMap *spans, int flags) {
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    TOONc_writeTOONSpans(&w, root, spans, flags);
+    return TOONc_writerRelease(&w, NULL);
+}
+
+static int test_verbatim_emission(void) {
+    TEST_BEGIN("Verbatim re-emission");
+    clock_t start = test_timer_start();
+
+    const char *text =
+        "# deployment\n"
+        "server:\n"
+        "  host:   localhost   # dev box\n"
+        "  port: 8080\n"
+        "hikes[3]{id,name}:\n"
+        "  1,Blue Lake  # favourite\n"
+        "  2,Ridge\n"
+        "  3,Summit\n"
+        "tags[2]: a,  b";
+    toonSpanMap *spans = TOONc_spanMapNew();
+    toonParseOptions opts = {0, NULL, NULL, spans};
+    toonObject *root = TOONc_parseStringWithOptions(text, &opts);
+    ASSERT_NOT_NULL(root);
+
+    /* Nothing changed: the source comes back as it was. */
+    char *out = write_spans(root, spans, 0);
+    ASSERT(strncmp(out, text, strlen(text)) == 0);
+    ASSERT_STR_EQ(out + strlen(text), "\n");
+    free(out);
+
+    /* A changed field is encoded, its neighbours are copied. */
+    TOONc_get(root, "server.port")->i = 9090;
+    out = write_spans(root, spans, 0);
+    ASSERT_NOT_NULL(strstr(out, "server:\n  host:   localhost   # dev box\n  port: 9090\n"));
+    ASSERT_NOT_NULL(strstr(out, "  1,Blue Lake  # favourite\n"));
+    ASSERT_NULL(strstr(out, "# deployment"));
+    free(out);
+
+    /* In a table, only the changed row is encoded. Text is compared, so
+     * edits in place are seen too. */
+    toonObject *hikes = TOONc_get(root, "hikes");
+    TOONc_get(TOONc_getArrayItem(hikes, 1), "name")->str.ptr[0] = 'B';
+    out = write_spans(root, spans, 0);
+    ASSERT_NOT_NULL(strstr(out, "hikes[3]{id,name}:\n  1,Blue Lake  # favourite\n"
+                                "  2,Bidge\n  3,Summit\n"));
+    ASSERT_NOT_NULL(strstr(out, "tags[2]: a,  b\n"));
+
+    /* Whatever was copied reads back as the changed tree. */
+    toonObject *back = TOONc_parseString(out);
+    char *a = TOONc_toTOON(root, NULL), *b = TOONc_toTOON(back, NULL);
+    ASSERT_STR_EQ(a, b);
+    free(a);
+    free(b);
+    free(out);
+    TOONc_free(back);
+
+    /* Added nodes have no source and are always encoded. */
+    toonObject *server = TOONc_get(root, "server");
+    toonObject *debug = TOONc_newBoolObj(1);
+    debug->key = strdup("debug");
+    debug->next = server->child;
+    server->child = debug;
+    out = write_spans(root, spans, 0);
+    ASSERT_NOT_NULL(strstr(out, "server:\n  debug: true\n  host:   localhost   # dev box\n"));
+    free(out);
+
+    /* Trusting touches alone skips the comparison, so a change below an
+     * untouched member goes unnoticed. */
+    TOONc_spanTouch(spans, server);
+    toonObject *tags = TOONc_get(root, "tags");
+    TOONc_free(tags->array.items[0]);
+    tags->array.items[0] = TOONc_newStringObj("c", 1);
+    out = write_spans(root, spans, TOON_SPANS_TOUCHED);
+    ASSERT_NOT_NULL(strstr(out, "  debug: true\n"));
+    ASSERT_NOT_NULL(strstr(out, "tags[2]: a,  b\n"));
+    free(out);
+    out = write_spans(root, spans, 0);
+    ASSERT_NOT_NULL(strstr(out, "tags[2]: c,b\n"));
+    free(out);
+
+    TOONc_free(root);
+
+    /* Removing the last child, or the last top-level member, is a change
+     * too: the removed text must not come back. */
+    root = TOONc_parseStringWithOptions("a:\n  x: 1\n  y: 2\nb: 3\n", &opts);
+    ASSERT_NOT_NULL(root);
+    toonObject *x = TOONc_get(root, "a.x");
+    TOONc_free(x->next);
+    x->next = NULL;
+    out = write_spans(root, spans, 0);
+    ASSERT_STR_EQ(out, "a:\n  x: 1\nb: 3\n");
+    free(out);
+    toonObject *member = TOONc_get(root, "a");
+    TOONc_free(member->next);
+    member->next = NULL;
+    out = write_spans(root, spans, 0);
+    ASSERT_STR_EQ(out, "a:\n  x: 1\n");
+    free(out);
+    TOONc_free(root);
+    TOONc_spanMapFree(spans);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Verbatim re-emission");
+    return 0;
+}
+
+/**
+ * Test 7t: Wide Object Lookups
+ *
+ * Lookups in objects wider than the index threshold go through a key
+ * index built on demand; results, duplicate keys and iteration order are
+ * the same as a scan, also with threads racing to build the index.
+ */
+typedef struct {
+    toonObject *root;
+    int bad;
+} WideWorker;
+
+static void *wide_worker(void *arg) {
+    WideWorker *ww = arg;
+    char path[32];
+    for (int i = 0; i < 2000; i++) {
+        int k = (i * 7919) % 500;
+        snprintf(path, sizeof(path), "catalog.k%d", k);
+        if (TOON_GET_INT(TOONc_get(ww->root, path)) != k) ww->bad++;
+    }
+    if (TOONc_get(ww->root, "catalog.nope")) ww->bad++;
+    return NULL;
+}
+
+static int test_wide_objects(void) {
+    TEST_BEGIN("Wide object lookups");
+    clock_t start = test_timer_start();
+
+    size_t cap = 16384, len = 0;
+    char *text = malloc(cap);
+    len += snprintf(text + len, cap - len, "catalog:\n");
+    for (int k = 0; k < 500; k++)
+        len += snprintf(text + len, cap - len, "  k%d: %d\n", k, k);
+    len += snprintf(text + len, cap - len, "  k7: 99\n");
+
+    for (int round = 0; round < 2; round++) {
+        toonObject *root = TOONc_parseString(text);
+        ASSERT_NOT_NULL(root);
+
+        /* Concurrent first lookups race to publish the index. */
+        pthread_t threads[4];
+        WideWorker workers[4];
+        for (int i = 0; i < 4; i++) {
+            workers[i] = (WideWorker){root, 0};
+            pthread_create(&threads[i], NULL, wide_worker, &workers[i]);
+        }
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+            ASSERT_EQ(workers[i].bad, 0);
+        }
+
+        /* The first of duplicate keys wins; order is untouched. */
+        toonObject *catalog = TOONc_get(root, "catalog");
+        ASSERT_EQ(TOON_GET_INT(TOONc_get(root, "catalog.k7")), 7);
+        ASSERT_STR_EQ(catalog->child->key, "k0");
+        int n = 0;
+        for (toonObject *c = catalog->child; c; c = c->next) n++;
+        ASSERT_EQ(n, 501);
+
+        /* After changing children, dropping the index finds new keys. */
+        toonObject *extra = TOONc_newIntObj(1);
+        extra->key = strdup("extra");
+        extra->next = catalog->child;
+        catalog->child = extra;
+        TOONc_dropIndex(catalog);
+        ASSERT_EQ(TOON_GET_INT(TOONc_get(root, "catalog.extra")), 1);
+        ASSERT_EQ(TOON_GET_INT(TOONc_get(root, "catalog.k499")), 499);
+        TOONc_free(root);
+    }
+    free(text);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Wide object lookups");
+    return 0;
+}
+
+/**
+ * Test 7u: Compiled Paths
+ *
+ * A path compiled once resolves against any number of documents, with
+ * array indices, and agrees with TOONc_get().
+ */
+static int test_compiled_paths(void) {
+    TEST_BEGIN("Compiled paths");
+    clock_t start = test_timer_start();
+
+    toonPath *port = TOONc_compilePath("server.port");
+    toonPath *hike = TOONc_compilePath("hikes[1].name");
+    toonPath *cell = TOONc_compilePath("m[1][0]");
+    toonPath *odd = TOONc_compilePath(".server..port.");
+    ASSERT_NOT_NULL(port);
+    ASSERT_NOT_NULL(hike);
+    ASSERT_NOT_NULL(cell);
+    ASSERT_NOT_NULL(odd);
+
+    const char *docs[] = {
+        "server:\n  port: 8080\nhikes[2]{id,name}:\n  1,Blue Lake\n  2,Ridge\n",
+        "server:\n  host: h\n  port: 9090\nhikes[1]{id,name}:\n  1,Summit\n",
+    };
+    for (int d = 0; d < 2; d++) {
+        toonObject *root = TOONc_parseString(docs[d]);
+        ASSERT_NOT_NULL(root);
+        ASSERT(TOONc_getCompiled(root, port) == TOONc_get(root, "server.port"));
+        ASSERT(TOONc_getCompiled(root, odd) == TOONc_get(root, "server.port"));
+        ASSERT_EQ(TOON_GET_INT(TOONc_getCompiled(root, port)), d ? 9090 : 8080);
+        if (d == 0)
+            ASSERT_STR_EQ(TOON_GET_STRING(TOONc_getCompiled(root, hike)), "Ridge");
+        else
+            ASSERT_NULL(TOONc_getCompiled(root, hike));
+        TOONc_free(root);
+    }
+
+    /* Nested arrays, from JSON. */
+    const char *json = "{\"m\": [[1, 2], [3, 4]]}";
+    toonObject *root = TOONc_parseJSON(json, strlen(json));
+    ASSERT_EQ(TOON_GET_INT(TOONc_getCompiled(root, cell)), 3);
+    TOONc_free(root);
+
+    /* Malformed indices are refused. */
+    ASSERT_NULL(TOONc_compilePath("a[x]"));
+    ASSERT_NULL(TOONc_compilePath("a[1"));
+    ASSERT_NULL(TOONc_compilePath("a[]"));
+    ASSERT_NULL(TOONc_getCompiled(NULL, port));
+
+    TOONc_freePath(port);
+    TOONc_freePath(hike);
+    TOONc_freePath(cell);
+    TOONc_freePath(odd);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Compiled paths");
+    return 0;
+}
+
+/**
+ * Test 7v: Batched Lookups
+ *
+ * TOONc_getMany() gives the same answers as resolving each path alone,
+ * whatever the order and however prefixes are shared or missing, and
+ * searches each object on the way once: looking up many names of a wide
+ * object takes one pass over its children, not a scan (and hence a key
+ * index) per name.
+ */
+static int test_get_many(void) {
+    TEST_BEGIN("Batched lookups");
+    clock_t start = test_timer_start();
+
+    const char *src[] = {
+        "request.user.id", "request.user.name", "request.method",
+        "request.user.missing", "nope.a.b", "nope.a.c", "request.user",
+        "hikes[1].name", "hikes[0].name", "hikes[5].name", "request.user.id",
+    };
+    enum { N = sizeof(src) / sizeof(src[0]) };
+    toonPath *paths[N];
+    for (int i = 0; i < N; i++) {
+        paths[i] = TOONc_compilePath(src[i]);
+        ASSERT_NOT_NULL(paths[i]);
+    }
+
+    toonObject *root = TOONc_parseString(
+        "request:\n  method: GET\n  user:\n    id: 7\n    name: ada\n"
+        "hikes[2]{id,name}:\n  1,Blue Lake\n  2,Ridge\n");
+    ASSERT_NOT_NULL(root);
+
+    /* Forward, then reversed so the sharing pattern differs. */
+    for (int pass = 0; pass < 2; pass++) {
+        toonPath *order[N];
+        toonObject *out[N];
+        size_t want = 0;
+        for (int i = 0; i < N; i++) order[i] = paths[pass ? N - 1 - i : i];
+        size_t got = TOONc_getMany(root, order, N, out);
+        for (int i = 0; i < N; i++) {
+            toonObject *one = TOONc_getCompiled(root, order[i]);
+            ASSERT(out[i] == one);
+            if (one) want++;
+        }
+        ASSERT_EQ(got, want);
+    }
+
+    toonObject *out[N];
+    ASSERT_EQ(TOONc_getMany(root, paths, N, out), 7);
+    ASSERT_EQ(TOON_GET_INT(out[0]), 7);
+    ASSERT_STR_EQ(TOON_GET_STRING(out[1]), "ada");
+    ASSERT_STR_EQ(TOON_GET_STRING(out[7]), "Ridge");
+    ASSERT_NULL(out[4]);
+    ASSERT_EQ(TOONc_getMany(NULL, paths, N, out), 0);
+    ASSERT_NULL(out[0]);
+
+    TOONc_free(root);
+    for (int i = 0; i < N; i++) TOONc_freePath(paths[i]);
+
+    /* Unsorted siblings give the same answers as sorted ones. */
+    const char *sib[] = {
+        "a.b.x", "a.c.y", "d", "a.b.z", "a.c.x", "a.b.y", "a", "a.b.x",
+        "a.c.missing",
+    };
+    enum { S = sizeof(sib) / sizeof(sib[0]) };
+    toonPath *spaths[S];
+    toonObject *sout[S];
+    for (int i = 0; i < S; i++) spaths[i] = TOONc_compilePath(sib[i]);
+    root = TOONc_parseString(
+        "a:\n  b:\n    x: 1\n    y: 2\n    z: 3\n"
+        "  c:\n    x: 4\n    y: 5\nd: 6\n");
+    ASSERT_NOT_NULL(root);
+    ASSERT_EQ(TOONc_getMany(root, spaths, S, sout), 8);
+    for (int i = 0; i < S; i++)
+        ASSERT(sout[i] == TOONc_getCompiled(root, spaths[i]));
+    ASSERT_EQ(TOON_GET_INT(sout[1]), 5);
+    ASSERT_EQ(TOON_GET_INT(sout[7]), 1);
+    TOONc_free(root);
+    for (int i = 0; i < S; i++) TOONc_freePath(spaths[i]);
+
+    /* A wide object searched for several names in scattered order is
+     * walked once. Scanning it per name would go past the index threshold
+     * and leave a key index behind; renaming a member without dropping it
+     * would then hide the member from TOONc_get(). */
+    char wide[2048];
+    size_t used = (size_t)snprintf(wide, sizeof(wide), "w:\n");
+    for (int i = 0; i < 64; i++)
+        used += (size_t)snprintf(wide + used, sizeof(wide) - used, "  k%d: %d\n", i, i);
+    root = TOONc_parseString(wide);
+    ASSERT_NOT_NULL(root);
+    const char *far[] = {"w.k63", "w.k2", "w.k50", "w.k40", "w.k7", "w.k63"};
+    enum { F = sizeof(far) / sizeof(far[0]) };
+    toonPath *fpaths[F];
+    toonObject *fout[F];
+    for (int i = 0; i < F; i++) fpaths[i] = TOONc_compilePath(far[i]);
+    ASSERT_EQ(TOONc_getMany(root, fpaths, F, fout), F);
+    static const int want[F] = {63, 2, 50, 40, 7, 63};
+    for (int i = 0; i < F; i++)
+        ASSERT_EQ(TOON_GET_INT(fout[i]), want[i]);
+    free(fout[0]->key);
+    fout[0]->key = strdup("renamed");
+    ASSERT(TOONc_get(root, "w.renamed") == fout[0]);
+    TOONc_free(root);
+    for (int i = 0; i < F; i++) TOONc_freePath(fpaths[i]);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Batched lookups");
+    return 0;
+}
+
+/**
+ * Test 7w: Path Index
+ *
+ * With TOON_PARSE_PATH_INDEX, TOONc_get() answers from the index exactly
+ * as the walk does: first duplicate wins, empty segments are skipped, and
+ * keys holding dots aren't mistaken for nested paths.
+ */
+static int test_path_index(void) {
+    TEST_BEGIN("Path index");
+    clock_t start = test_timer_start();
+
+    const char *src =
+        "server:\n  host: a\n  tls:\n    port: 443\n"
+        "server:\n  host: shadowed\n  extra: 1\n"
+        "\"a.b\": dotted\n"
+        "a:\n  c: nested\n"
+        "hikes[1]{id,name}:\n  1,Ridge\n"
+        "tags[2]: x,y\n";
+    const char *paths[] = {
+        "server", "server.host", "server.tls.port", "..server..tls.port.",
+        "server.extra", "a.b", "a.c", "a", "hikes", "tags", "hikes.name",
+        "missing", "server.tls.port.deeper", "", ".",
+    };
+
+    toonParseOptions opts = {TOON_PARSE_PATH_INDEX, NULL, NULL, NULL};
+    toonObject *plain = TOONc_parseString(src);
+    toonObject *indexed = TOONc_parseStringWithOptions(src, &opts);
+    ASSERT_NOT_NULL(plain);
+    ASSERT_NOT_NULL(indexed);
+
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        toonObject *want = TOONc_get(plain, paths[i]);
+        toonObject *got = TOONc_get(indexed, paths[i]);
+        ASSERT((want == NULL) == (got == NULL));
+        if (want == plain) ASSERT(got == indexed);
+        else if (want) ASSERT_EQ(got->kvtype, want->kvtype);
+    }
+    ASSERT_STR_EQ(TOON_GET_STRING(TOONc_get(indexed, "server.host")), "a");
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(indexed, "server.tls.port")), 443);
+    ASSERT_STR_EQ(TOON_GET_STRING(TOONc_get(indexed, "a.c")), "nested");
+    ASSERT_NULL(TOONc_get(indexed, "server.extra"));
+
+    /* Dropping the index goes back to walking. */
+    toonObject *port = TOONc_get(indexed, "server.tls.port");
+    TOONc_dropIndex(indexed);
+    ASSERT(TOONc_get(indexed, "server.tls.port") == port);
+
+    TOONc_free(plain);
+    TOONc_free(indexed);
+
+    /* A strict parse that fails leaves nothing behind. */
+    toonParseOptions strict = {TOON_PARSE_STRICT | TOON_PARSE_PATH_INDEX, NULL, NULL, NULL};
+    ASSERT_NULL(TOONc_parseStringWithOptions("a:\n  b: 1\nbroken\n", &strict));
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Path index");
+    return 0;
+}
+
+/**
+ * Test 7x: Reentrant Lookups
+ *
+ * TOONc_getn() resolves paths that are slices of a larger buffer, and
+ * threads looking up different paths at once don't disturb each other.
+ */
+typedef struct {
+    toonObject *root;
+    int which;
+    int bad;
+} LookupWorker;
+
+static void *lookup_worker(void *arg) {
+    LookupWorker *lw = arg;
+    const char *path = lw->which & 1 ? "db.primary.port" : "..db.replica..port";
+    int want = lw->which & 1 ? 5432 : 5433;
+    for (int i = 0; i < 20000; i++) {
+        if (TOON_GET_INT(TOONc_get(lw->root, path)) != want) lw->bad++;
+    }
+    return NULL;
+}
+
+static int test_reentrant_get(void) {
+    TEST_BEGIN("Reentrant lookups");
+    clock_t start = test_timer_start();
+
+    toonObject *root = TOONc_parseString(
+        "db:\n  primary:\n    port: 5432\n  replica:\n    port: 5433\n"
+        "name: svc\n");
+    ASSERT_NOT_NULL(root);
+
+    /* Slices of one buffer, none of them NUL-terminated. */
+    const char *buf = "db.primary.portXdb.replica";
+    ASSERT_EQ(TOON_GET_INT(TOONc_getn(root, buf, 15)), 5432);
+    ASSERT(TOONc_getn(root, buf + 16, 10) == TOONc_get(root, "db.replica"));
+    ASSERT_NULL(TOONc_getn(root, buf, 16));
+    ASSERT(TOONc_getn(root, buf, 0) == root);
+    ASSERT(TOONc_getn(root, "name\0.x", 7) == TOONc_get(root, "name"));
+    ASSERT(TOONc_get(root, "...") == root);
+    ASSERT_NULL(TOONc_getn(NULL, buf, 2));
+
+    pthread_t threads[4];
+    LookupWorker workers[4];
+    for (int i = 0; i < 4; i++) {
+        workers[i] = (LookupWorker){root, i, 0};
+        pthread_create(&threads[i], NULL, lookup_worker, &workers[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        ASSERT_EQ(workers[i].bad, 0);
+    }
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Reentrant lookups");
+    return 0;
+}
+
+/**
+ * Test 7y: Table Views
+ *
+ * A table view gives the same cells as looking them up by name in each
+ * row, with missing and reordered cells, and refuses non-tables.
+ */
+static int test_table_view(void) {
+    TEST_BEGIN("Table views");
+    clock_t start = test_timer_start();
+
+    toonObject *root = TOONc_parseString(
+        "hikes[3]{id,name,km}:\n  1,Blue Lake,7.5\n  2,Ridge,9.2\n  3,Summit,4.1\n"
+        "tags[2]: a,b\n");
+    ASSERT_NOT_NULL(root);
+    toonObject *hikes = TOONc_get(root, "hikes");
+
+    toonTable *t = TOONc_tableOpen(hikes);
+    ASSERT_NOT_NULL(t);
+    ASSERT_EQ(TOONc_tableRows(t), 3);
+    ASSERT_EQ(TOONc_tableColumns(t), 3);
+    ASSERT_STR_EQ(TOONc_tableColumn(t, 1), "name");
+    ASSERT_NULL(TOONc_tableColumn(t, 3));
+
+    size_t name = TOONc_tableColumnIndex(t, "name");
+    ASSERT_EQ(name, 1);
+    ASSERT_EQ(TOONc_tableColumnIndex(t, "nope"), TOON_TABLE_NONE);
+    for (size_t r = 0; r < 3; r++) {
+        toonObject *row = TOONc_getArrayItem(hikes, r);
+        for (size_t c = 0; c < 3; c++)
+            ASSERT(TOONc_tableCell(t, r, c) == TOONc_get(row, TOONc_tableColumn(t, c)));
+    }
+    ASSERT_STR_EQ(TOON_GET_STRING(TOONc_tableCell(t, 2, name)), "Summit");
+    ASSERT_NULL(TOONc_tableCell(t, 3, 0));
+    ASSERT_NULL(TOONc_tableCell(t, 0, TOON_TABLE_NONE));
+    TOONc_tableClose(t);
+
+    /* Lists and rows that aren't a clean table. */
+    ASSERT_NULL(TOONc_tableOpen(TOONc_get(root, "tags")));
+    ASSERT_NULL(TOONc_tableOpen(NULL));
+    TOONc_free(root);
+
+    const char *json = "{\"rows\": [{\"a\": 1, \"b\": 2}, {\"b\": 3, \"c\": 4}, 5,"
+                       " {\"b\": 6, \"a\": 7}]}";
+    root = TOONc_parseJSON(json, strlen(json));
+    t = TOONc_tableOpen(TOONc_get(root, "rows"));
+    ASSERT_NOT_NULL(t);
+    ASSERT_EQ(TOONc_tableColumns(t), 2);
+    ASSERT_NULL(TOONc_tableCell(t, 1, 0));
+    ASSERT_EQ(TOON_GET_INT(TOONc_tableCell(t, 1, 1)), 3);
+    ASSERT_NULL(TOONc_tableCell(t, 2, 1));
+    ASSERT_EQ(TOON_GET_INT(TOONc_tableCell(t, 3, 0)), 7);
+    ASSERT_EQ(TOON_GET_INT(TOONc_tableCell(t, 3, 1)), 6);
+    TOONc_tableClose(t);
+    TOONc_free(root);
+
+    double elapsed = test_timer_end(start);
+    printf("  Completed in %.3f ms\n", elapsed * 1000);
+    TEST_END("Table views");
     return 0;
 }
 
@@ -1225,6 +3419,24 @@ static int test_performance(void) {
     ASSERT_NOT_NULL(id_500);
     ASSERT_EQ(TOON_GET_INT(id_500), 500);
     
+    /* Same data as compact JSON through TOONc_parseJSON. */
+    toonWriter jw;
+    TOONc_writerInitMemory(&jw);
+    TOONc_writeJSON(&jw, root, 0, TOON_JSON_COMPACT);
+
+    start = test_timer_start();
+    toonObject *json_root = TOONc_parseJSON(jw.buf, jw.len);
+    double json_time = test_timer_end(start);
+
+    ASSERT_NOT_NULL(json_root);
+    ASSERT_EQ(TOON_GET_INT(TOONc_get(json_root, "large_dataset.record_500.id")), 500);
+
+    printf("  JSON parse time: %.3f ms (%zu bytes)\n", json_time * 1000, jw.len);
+    printf("  JSON throughput: %.2f MB/s\n",
+           jw.len / (1024.0 * 1024.0) / json_time);
+    TOONc_free(json_root);
+    TOONc_writerFree(&jw);
+
     /* Cleanup */
     start = clock();
     TOONc_free(root);
@@ -1267,7 +3479,32 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
         {"Tabular Data", test_tabular_data, 1},
         {"Comments & Whitespace", test_comments_and_whitespace, 1},
         {"Edge Cases", test_edge_cases, 1},
+        {"Error Reporting", test_error_reporting, 1},
         {"Object Creation API", test_object_creation, 1},
+        {"TOON Encoder", test_toon_encoder, 1},
+        {"Buffered Writer", test_buffered_writer, 1},
+        {"JSON Escaping", test_json_escaping, 1},
+        {"Number Formatting", test_number_formatting, 1},
+        {"Compact JSON Buffers", test_json_buffer, 1},
+        {"Output Measurement", test_measure_output, 1},
+        {"Stream Transcoding", test_stream_transcode, 1},
+        {"JSON Parsing", test_json_parsing, 1},
+        {"JSON to TOON Streaming", test_stream_json_to_toon, 1},
+        {"Binary Snapshots", test_snapshots, 1},
+        {"CBOR", test_cbor, 1},
+        {"Document cache", test_cache, 1},
+        {"Concurrent readers", test_concurrent_readers, 1},
+        {"Hot-swapped documents", test_hot_swap, 1},
+        {"Incremental reload", test_incremental_reload, 1},
+        {"Reparse after edits", test_reparse, 1},
+        {"Source spans", test_source_spans, 1},
+        {"Verbatim re-emission", test_verbatim_emission, 1},
+        {"Wide object lookups", test_wide_objects, 1},
+        {"Compiled paths", test_compiled_paths, 1},
+        {"Batched lookups", test_get_many, 1},
+        {"Path index", test_path_index, 1},
+        {"Reentrant lookups", test_reentrant_get, 1},
+        {"Table views", test_table_view, 1},
         {"Memory Management", test_memory_management, 1},
         {"Type Checking", test_type_checking, 1},
         {"Complex Structure", test_complex_structure, 1},
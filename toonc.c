@@ -58,6 +58,22 @@
 #include <ctype.h>
 #include <limits.h>
 #include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /* -----------------------------------------------------------------------------
  * Compiler-specific optimization macros
@@ -87,6 +103,7 @@
  * -------------------------------------------------------------------------- */
 FORCE_INLINE void skipLine(toonParser *parser);
 FORCE_INLINE int isCommentOrEmpty(toonParser *parser);
+static void indexFree(struct toonIndex *idx);
 
 
 /* -----------------------------------------------------------------------------
@@ -280,6 +297,9 @@ void TOONc_free(toonObject *obj) {
                 tfree(obj->array.items);
             }
             break;
+        case KV_OBJ:
+            indexFree(obj->index);
+            break;
         default:
             /* Other types don't allocate additional memory. */
             break;
@@ -288,6 +308,377 @@ void TOONc_free(toonObject *obj) {
     tfree(obj);
 }
 
+/* -----------------------------------------------------------------------------
+ * Source spans
+ *
+ * With toonParseOptions.spans set, the parser also records where each node
+ * came from: the bytes of its key and value, its line, and for members the
+ * whole run of lines down to the last descendant. The spans live in a side
+ * table keyed by node address, so toonObject doesn't grow and a parse
+ * without a map pays one well predicted branch per value. The map keeps a
+ * copy of the text, so the offsets stay usable once the input is gone.
+ *
+ * Nodes are stored in document order (the root first), which is also the
+ * order a depth-first walk of the tree visits them in, each with a
+ * fingerprint of its fields as the parse left them. The encoder can then
+ * tell whether a subtree is still what its source text says by walking it
+ * alongside the table, a few sequential words per node, and copy the text
+ * instead of encoding the nodes again. Callers that report every change
+ * with TOONc_spanTouch() can skip the walk: touching a node flags its
+ * ancestors too, so an unflagged subtree is known to be unchanged.
+ * -------------------------------------------------------------------------- */
+
+#define SPAN_GROWS 1        /* Value is the lines below: follows 'end' */
+#define SPAN_DIRTY 2        /* Touched, or its text can't stand on its own */
+#define SPAN_BELOW 4        /* Some descendant is SPAN_DIRTY */
+
+struct toonSpanMap {
+    char *text;             /* Copy of the source of the last parse */
+    size_t len;
+    toonObject **nodes;     /* Document order, the root first */
+    toonSpan *spans;
+    uint64_t *sums;         /* Fingerprint of each node as parsed */
+    size_t *parents;        /* Index of each node's parent */
+    unsigned char *flags;   /* SPAN_* */
+    size_t count, cap;
+    size_t *slots;          /* Index + 1 by node address, 0 = empty */
+    size_t mask;
+};
+
+toonSpanMap *TOONc_spanMapNew(void) {
+    return tcalloc(1, sizeof(toonSpanMap));
+}
+
+void TOONc_spanMapFree(toonSpanMap *m) {
+    if (!m) return;
+    tfree(m->text);
+    tfree(m->nodes);
+    tfree(m->spans);
+    tfree(m->sums);
+    tfree(m->parents);
+    tfree(m->flags);
+    tfree(m->slots);
+    tfree(m);
+}
+
+static size_t spanAdd(toonSpanMap *m, toonObject *node, const char *source,
+        const char *start, const char *end, int line) {
+    if (m->count == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 64;
+        m->nodes = trealloc(m->nodes, m->cap * sizeof(toonObject *));
+        m->spans = trealloc(m->spans, m->cap * sizeof(toonSpan));
+        m->sums = trealloc(m->sums, m->cap * sizeof(uint64_t));
+        m->parents = trealloc(m->parents, m->cap * sizeof(size_t));
+        m->flags = trealloc(m->flags, m->cap);
+    }
+    size_t i = m->count++;
+    toonSpan *sp = &m->spans[i];
+    m->nodes[i] = node;
+    m->parents[i] = 0;
+    m->flags[i] = 0;
+    sp->start = sp->value = start - source;
+    sp->end = end - source;
+    sp->key = sp->key_len = 0;
+    sp->value_len = end - start;
+    sp->line = line;
+    return i;
+}
+
+/* Forget the previous parse and keep a copy of the new source. */
+static void spanReset(toonSpanMap *m, const char *source) {
+    m->len = strlen(source);
+    tfree(m->text);
+    m->text = tmalloc(m->len + 1);
+    memcpy(m->text, source, m->len + 1);
+    m->count = 0;
+    tfree(m->slots);
+    m->slots = NULL;
+    m->mask = 0;
+    spanAdd(m, NULL, source, source, source, 1);  /* The root's, filled last */
+}
+
+/* Trimmed value text at 'p', bounded like scanValue() bounds it: by the end
+ * of the line, a comment and, if 'comma' is set, a comma. */
+static void spanValueText(char *p, int comma, char **start, char **end) {
+    while (*p == ' ' || *p == '\t') p++;
+    char *e = p;
+    while (*e && *e != '\n' && *e != '#' && !(comma && *e == ','))
+        e++;
+    while (e > p && isspace((unsigned char)e[-1])) e--;
+    *start = p;
+    *end = e;
+}
+
+/* Offset just past the line holding 'p', newline included. */
+static char *spanLineEnd(char *p) {
+    while (*p && *p != '\n') p++;
+    return *p ? p + 1 : p;
+}
+
+/* Where the text of a member or a row ends once it is parsed: past its
+ * newline, or where the parser went on without one. In the latter case
+ * what follows is parsed differently because of it, so the node is marked
+ * to never be copied. */
+static size_t spanStop(toonParser *parser, size_t idx) {
+    char *p = parser->p;
+    if (p[0] == '\n') return p + 1 - parser->source;
+    if (p[0] != '\0') parser->spans->flags[idx] |= SPAN_DIRTY;
+    return p - parser->source;
+}
+
+/* Span of a scalar parsed from 'at': an item, a cell or a member's value
+ * (spanMember() then widens it to the whole member). */
+static void spanValue(toonParser *parser, toonObject *o, char *at) {
+    char *start, *end;
+    spanValueText(at, 1, &start, &end);
+    spanAdd(parser->spans, o, parser->source, start, end, parser->line);
+}
+
+/* A table row spans its line, from 'at'. It goes in before the cells;
+ * spanRowEnd() completes it once they are parsed. */
+static size_t spanRow(toonParser *parser, toonObject *row, char *at) {
+    return spanAdd(parser->spans, row, parser->source, at, at, parser->line);
+}
+
+static void spanRowEnd(toonParser *parser, size_t idx) {
+    toonSpan *sp = &parser->spans->spans[idx];
+    char *start, *end;
+    spanValueText(parser->source + sp->start, 0, &start, &end);
+    if (end > parser->p) end = parser->p;
+    if (start > end) start = end;
+    sp->value = start - parser->source;
+    sp->value_len = end - start;
+    sp->end = spanStop(parser, idx);
+}
+
+/* Span of a member whose key starts the line at 'line'. Arrays parse their
+ * items before the member exists, so 'slot' is an entry reserved ahead of
+ * them to keep document order (SIZE_MAX for other members). A scalar value
+ * has just been recorded by parseValue() and is reused; an inline list's
+ * value is the rest of the line; tables and nested objects own the lines
+ * below, which spanExtend() accounts for as they're parsed. */
+static size_t spanMember(toonParser *parser, toonObject *prop, size_t slot,
+        char *line, int line_no, char *key, size_t keylen, char *value_at,
+        int is_list) {
+    toonSpanMap *m = parser->spans;
+    char *source = parser->source;
+    size_t idx;
+
+    if (slot != SIZE_MAX && is_list) {
+        char *start, *end;
+        spanValueText(value_at, 0, &start, &end);
+        idx = slot;
+        m->spans[idx].value = start - source;
+        m->spans[idx].value_len = end - start;
+    } else if (slot != SIZE_MAX) {
+        idx = slot;
+        m->spans[idx].value = spanLineEnd(value_at) - source;
+        m->flags[idx] |= SPAN_GROWS;
+    } else if (m->count && m->nodes[m->count - 1] == prop) {
+        idx = m->count - 1;
+    } else {
+        char *below = spanLineEnd(value_at);
+        idx = spanAdd(m, prop, source, below, below, line_no);
+        m->flags[idx] |= SPAN_GROWS;
+    }
+
+    toonSpan *sp = &m->spans[idx];
+    m->nodes[idx] = prop;
+    sp->start = sp->end = line - source;
+    sp->key = key - source;
+    sp->key_len = keylen;
+    sp->line = line_no;
+    return idx;
+}
+
+/* A line ending at offset 'end' belongs to the member at 'idx'. */
+static void spanExtend(toonSpanMap *m, size_t idx, size_t end) {
+    toonSpan *sp = &m->spans[idx];
+    if (end > sp->end) sp->end = end;
+    if (m->flags[idx] & SPAN_GROWS) {
+        size_t stop = sp->end;
+        if (stop > sp->value && m->text[stop - 1] == '\n') stop--;
+        sp->value_len = stop > sp->value ? stop - sp->value : 0;
+    }
+}
+
+FORCE_INLINE uint64_t spanMix(uint64_t h, uint64_t v) {
+    h ^= v;
+    h *= 0xFF51AFD7ED558CCDULL;
+    return h ^ (h >> 32);
+}
+
+static uint64_t spanMixBytes(uint64_t h, const char *s, size_t len) {
+    uint64_t v;
+    while (len >= 8) {
+        memcpy(&v, s, 8);
+        h = spanMix(h, v);
+        s += 8;
+        len -= 8;
+    }
+    v = 0;
+    memcpy(&v, s, len);
+    return spanMix(h, v ^ ((uint64_t)len << 56));
+}
+
+/* Fingerprint of a node's own content: its type, key and value, and where
+ * its children are (which are fingerprinted themselves). Text is hashed
+ * rather than its address, so edits in place and freed nodes whose memory
+ * is reused by new ones both show up as a different fingerprint. */
+static uint64_t spanSum(const toonObject *o) {
+    uint64_t h = spanMix(0x9E3779B97F4A7C15ULL, (uint64_t)o->kvtype);
+    if (o->key) h = spanMixBytes(h, o->key, strlen(o->key));
+    switch (o->kvtype) {
+    case KV_STRING:
+        h = spanMixBytes(h, o->str.ptr, o->str.len);
+        break;
+    case KV_LIST:
+        h = spanMix(h, (uint64_t)(uintptr_t)o->array.items);
+        h = spanMix(h, o->array.len);
+        break;
+    case KV_INT:
+        h = spanMix(h, (uint64_t)(unsigned)o->i);
+        break;
+    case KV_DOUBLE: {
+        uint64_t bits;
+        memcpy(&bits, &o->d, sizeof(bits));
+        h = spanMix(h, bits);
+        break;
+    }
+    case KV_BOOL:
+        h = spanMix(h, (uint64_t)o->boolean);
+        break;
+    }
+    return spanMix(h, (uint64_t)(uintptr_t)o->child);
+}
+
+static size_t spanHash(const toonObject *node, size_t mask) {
+    uint64_t h = (uint64_t)(uintptr_t)node * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) & mask;
+}
+
+/* Flag the ancestors of the node at 'i' as having a changed descendant. */
+static void spanFlagAncestors(toonSpanMap *m, size_t i) {
+    while (i != 0) {
+        i = m->parents[i];
+        if (m->flags[i] & SPAN_BELOW) break;
+        m->flags[i] |= SPAN_BELOW;
+    }
+}
+
+/* Record each node's parent by walking the tree in document order, the
+ * order the nodes were stored in. */
+static void spanLink(toonSpanMap *m, const toonObject *o, size_t self, size_t *k) {
+    if (o->kvtype == KV_LIST) {
+        for (size_t i = 0; i < o->array.len; i++) {
+            if (*k >= m->count || m->nodes[*k] != o->array.items[i]) return;
+            m->parents[*k] = self;
+            size_t at = (*k)++;
+            spanLink(m, o->array.items[i], at, k);
+        }
+    }
+    for (const toonObject *c = o->child; c; c = c->next) {
+        if (*k >= m->count || m->nodes[*k] != c) return;
+        m->parents[*k] = self;
+        size_t at = (*k)++;
+        spanLink(m, c, at, k);
+    }
+}
+
+/* Index the nodes by address once the parse is complete, link them to
+ * their parents and fingerprint them now that their fields are final. */
+static void spanIndex(toonSpanMap *m) {
+    size_t size = 16;
+    while (size < m->count * 2) size *= 2;
+    m->slots = tcalloc(size, sizeof(size_t));
+    m->mask = size - 1;
+    size_t k = 1;
+    spanLink(m, m->nodes[0], 0, &k);
+    for (size_t i = 0; i < m->count; i++) {
+        m->sums[i] = spanSum(m->nodes[i]);
+        size_t s = spanHash(m->nodes[i], m->mask);
+        while (m->slots[s]) s = (s + 1) & m->mask;
+        m->slots[s] = i + 1;
+        if (m->flags[i] & SPAN_DIRTY) spanFlagAncestors(m, i);
+    }
+}
+
+/* Index of 'node' in the map, or SIZE_MAX. */
+static size_t spanFind(const toonSpanMap *m, const toonObject *node) {
+    if (!m || !m->slots || !node) return SIZE_MAX;
+    size_t s = spanHash(node, m->mask);
+    while (m->slots[s]) {
+        size_t i = m->slots[s] - 1;
+        if (m->nodes[i] == node) return i;
+        s = (s + 1) & m->mask;
+    }
+    return SIZE_MAX;
+}
+
+const toonSpan *TOONc_spanOf(const toonSpanMap *m, const toonObject *node) {
+    size_t i = spanFind(m, node);
+    return i != SIZE_MAX ? &m->spans[i] : NULL;
+}
+
+const char *TOONc_spanSource(const toonSpanMap *m, size_t *len) {
+    if (len) *len = m && m->text ? m->len : 0;
+    return m ? m->text : NULL;
+}
+
+size_t TOONc_spanCount(const toonSpanMap *m) {
+    return m ? m->count : 0;
+}
+
+void TOONc_spanTouch(toonSpanMap *m, const toonObject *node) {
+    size_t i = spanFind(m, node);
+    if (i == SIZE_MAX) return;
+    m->flags[i] |= SPAN_DIRTY;
+    spanFlagAncestors(m, i);
+}
+
+/* Is the node at 'i' still as parsed? */
+FORCE_INLINE int spanSame(const toonSpanMap *m, size_t i, const toonObject *o) {
+    return i < m->count && m->nodes[i] == o && !(m->flags[i] & SPAN_DIRTY) &&
+           m->sums[i] == spanSum(o);
+}
+
+/* Walk what hangs below 'o' (recorded at 'self') alongside the nodes from
+ * '*k' on, which the parser recorded in the same order. Any difference (a
+ * changed field, a node added, removed or moved, a touched node) means the
+ * source text no longer describes the subtree. Siblings are compared by
+ * position, which also catches a changed 'next', and a recorded child left
+ * over once the children run out was removed. */
+static int spanSameBelow(const toonSpanMap *m, const toonObject *o, size_t self,
+        size_t *k) {
+    if (o->kvtype == KV_LIST) {
+        for (size_t i = 0; i < o->array.len; i++) {
+            toonObject *item = o->array.items[i];
+            if (!spanSame(m, *k, item)) return 0;
+            size_t at = (*k)++;
+            if (!spanSameBelow(m, item, at, k)) return 0;
+        }
+    }
+    for (const toonObject *c = o->child; c; c = c->next) {
+        if (!spanSame(m, *k, c)) return 0;
+        size_t at = (*k)++;
+        if (!spanSameBelow(m, c, at, k)) return 0;
+    }
+    return !(*k < m->count && m->parents[*k] == self);
+}
+
+/* Span of 'o' if neither it nor anything below it changed since the parse.
+ * With TOON_SPANS_TOUCHED the flags left by TOONc_spanTouch() are taken at
+ * their word instead of walking the subtree. */
+static const toonSpan *spanUnchanged(const toonSpanMap *m, const toonObject *o,
+        int flags) {
+    size_t i = spanFind(m, o);
+    if (i == SIZE_MAX || !spanSame(m, i, o)) return NULL;
+    if (flags & TOON_SPANS_TOUCHED)
+        return m->flags[i] & SPAN_BELOW ? NULL : &m->spans[i];
+    size_t k = i + 1;
+    return spanSameBelow(m, o, i, &k) ? &m->spans[i] : NULL;
+}
+
 /* -----------------------------------------------------------------------------
  * Parsing primitives
  *
@@ -321,6 +712,30 @@ FORCE_INLINE int parseIndent(toonParser *parser) {
     return spaces / 2; /* 2 spaces = 1 indent level */
 }
 
+/* Report a diagnostic at position 'at'. Nothing is printed: the error goes
+ * to the user's handler, if any, so malformed input never turns into stderr
+ * traffic. In strict mode the first error also aborts the parse. The column
+ * is only computed on this cold path by scanning back to the line start. */
+NO_INLINE static void parseError(toonParser *parser, int code, const char *at) {
+    parser->errors++;
+
+    const toonParseOptions *opts = parser->opts;
+    if (opts && (opts->flags & TOON_PARSE_STRICT))
+        parser->aborted = 1;
+
+    if (opts && opts->on_error) {
+        const char *bol = at;
+        while (bol > parser->source && bol[-1] != '\n')
+            bol--;
+
+        toonError err;
+        err.code = code;
+        err.line = parser->line;
+        err.col = (int)(at - bol) + 1;
+        opts->on_error(&err, opts->userdata);
+    }
+}
+
 /* Parse a key name. Keys end at ':', '[', '{', or newline.
  * Trailing whitespace is trimmed. */
 char *parseKey(toonParser *parser, size_t *len) {
@@ -370,16 +785,17 @@ char **parseTableColumns(toonParser *parser, int *col_count) {
     if (parser->p[0] != '{') return NULL;
     parser->p++; /* Skip '{' */
     
-    /* First pass: count columns by counting commas. */
+    /* First pass: count columns by counting commas. The header must close
+     * on its own line. */
     char *temp = parser->p;
     int count = 1;
-    while (*temp && *temp != '}') {
+    while (*temp && *temp != '}' && *temp != '\n') {
         if (*temp == ',') count++;
         temp++;
     }
 
     if (*temp != '}') {
-        fprintf(stderr, "Syntax error: missing '}' in table columns\n");
+        parseError(parser, TOON_ERR_UNCLOSED_TABLE, parser->p - 1);
         return NULL;
     }
     
@@ -413,7 +829,8 @@ char **parseTableColumns(toonParser *parser, int *col_count) {
     
     if (parser->p[0] == '}') parser->p++; /* Skip '}' */
     
-    *col_count = count;
+    /* "{}" or a trailing comma yields fewer names than counted. */
+    *col_count = idx;
     return columns;
 }
 
@@ -456,11 +873,17 @@ int isNumber(char *s, size_t len, int *is_float) {
     return i == len; /* Success if we consumed the entire string */
 }
 
-toonObject *parseNumber(char *start, size_t len, int is_float) {
+/* Describe a numeric token in 'out'. Tokens that don't fit a double or an
+ * int stay strings (pointing at 'start', not copied). */
+static void numberValue(char *start, size_t len, int is_float, toonObject *out) {
     char buf[128];
+    out->kvtype = KV_STRING;
+    out->str.ptr = start;
+    out->str.len = len;
+
     if (len >= sizeof(buf)) {
         /* number too long */
-        return newStringObj(start, len);
+        return;
     }
 
     memcpy(buf, start, len);
@@ -473,10 +896,12 @@ toonObject *parseNumber(char *start, size_t len, int is_float) {
 
         if (errno == ERANGE || endptr != buf + len) {
             /* Overflow or incomplete parsing */
-            return newStringObj(start, len);
+            return;
         }
 
-        return newDoubleObj(val);
+        out->kvtype = KV_DOUBLE;
+        out->d = val;
+        return;
     }
 
     errno = 0;
@@ -485,21 +910,24 @@ toonObject *parseNumber(char *start, size_t len, int is_float) {
 
     if (errno == ERANGE || val > INT_MAX || val < INT_MIN || endptr != buf + len) {
         /* Overflow or out of bounds int */
-        return newStringObj(start, len);
+        return;
     } 
 
-    return newIntObj((int)val);
+    out->kvtype = KV_INT;
+    out->i = (int)val;
 }
 
-/* Parse a single value from the input. Values are terminated by newline
- * or comma (for array elements). Returns NULL for empty values, which
- * indicates a nested object follows. */
-toonObject *parseValue(toonParser *parser) {
+/* Scan a single value from the input and describe it in 'out' without
+ * allocating anything: strings point into the source. Values are terminated
+ * by newline or comma (for array elements). Returns 0 for an empty value,
+ * which indicates a nested object follows. */
+static int scanValue(toonParser *parser, toonObject *out) {
+    memset(out, 0, sizeof(*out));
     parseSpaces(parser);
 
     /* Empty value means nested object. */
     if (parser->p[0] == '\n' || parser->p[0] == '\0') {
-        return NULL;
+        return 0;
     }
 
     char *start = parser->p;
@@ -525,42 +953,67 @@ toonObject *parseValue(toonParser *parser) {
     
     size_t len = end - start;
 
-    /* Check for quoted strings. */
-    int quotes = 0;
+    /* Quoted values are always strings. */
     if (len >= 2 && *start == '"' && *(end - 1) == '"') {
-        start++;
-        end--;
-        len -= 2;
-        quotes = 1;
+        out->kvtype = KV_STRING;
+        out->str.ptr = start + 1;
+        out->str.len = len - 2;
+        return 1;
     }
-    
-    /* Quoted values are always strings. */
-    if (quotes) 
-        return newStringObj(start, len);
 
-    if (len == 0) return newNullObj();
+    if (len == 0) {
+        out->kvtype = KV_NULL;
+        return 1;
+    }
 
     /* Check for boolean literals. */
     if (len == 4 && strncmp(start, "true", 4) == 0) {
-        return newBoolObj(1);
+        out->kvtype = KV_BOOL;
+        out->boolean = 1;
+        return 1;
     }
     if (len == 5 && strncmp(start, "false", 5) == 0) {
-        return newBoolObj(0);
+        out->kvtype = KV_BOOL;
+        out->boolean = 0;
+        return 1;
     }
     
     /* Check for null literal. */
     if (len == 4 && strncmp(start, "null", 4) == 0) {
-        return newNullObj();
+        out->kvtype = KV_NULL;
+        return 1;
     }
     
     /* Try to parse as a number. */
     int is_float;
     if (isNumber(start, len, &is_float)) {
-        return parseNumber(start, len, is_float);
+        numberValue(start, len, is_float, out);
+        return 1;
     }
     
     /* Default: treat as unquoted string. */
-    return newStringObj(start, len);
+    out->kvtype = KV_STRING;
+    out->str.ptr = start;
+    out->str.len = len;
+    return 1;
+}
+
+/* Parse a single value into a newly allocated object. Returns NULL for
+ * empty values, which indicates a nested object follows. */
+toonObject *parseValue(toonParser *parser) {
+    char *at = parser->p;
+    toonObject v;
+    if (!scanValue(parser, &v)) return NULL;
+
+    toonObject *o;
+    if (v.kvtype == KV_STRING) {
+        o = newStringObj(v.str.ptr, v.str.len);
+    } else {
+        o = newObject(v.kvtype);
+        *o = v;
+    }
+    if (UNLIKELY(parser->spans != NULL)) spanValue(parser, o, at);
+    return o;
 }
 
 /* Parse a comma-separated list of values on a single line.
@@ -600,12 +1053,15 @@ toonObject *parseTableRows(toonParser *parser, char **columns, int col_count,
     toonObject *table = newListObj();
     
     for (int row = 0; row < expected_rows; row++) {
+        if (parser->p[0] != '\n') parser->ragged++;
         parseNewLine(parser);
+        char *bol = parser->p;
       
         /* Check for EOF */
         //if (parser->p[0] == '\0') break;
         /* Skip blank lines and comments */
         if (isCommentOrEmpty(parser)) {
+            parser->ragged++;
             skipLine(parser);
             continue;
         }
@@ -619,6 +1075,7 @@ toonObject *parseTableRows(toonParser *parser, char **columns, int col_count,
         //if (parser->p[0] == '\n' || parser->p[0] == '\0') break;
 
         if (parser->p[0] == '#') {
+            parser->ragged++;
             skipLine(parser);
             continue;
         }
@@ -626,6 +1083,8 @@ toonObject *parseTableRows(toonParser *parser, char **columns, int col_count,
         /* Create an object for this row. */
         toonObject *rowObj = newObject(KV_OBJ);
         toonObject *lastProp = NULL;
+        size_t span_row = 0;
+        if (UNLIKELY(parser->spans != NULL)) span_row = spanRow(parser, rowObj, bol);
         
         /* Parse each column value. */
         for (int col = 0; col < col_count; col++) {
@@ -650,9 +1109,11 @@ toonObject *parseTableRows(toonParser *parser, char **columns, int col_count,
                 parser->p++;
             }
         }
+        if (UNLIKELY(parser->spans != NULL)) spanRowEnd(parser, span_row);
         
         listPush(table, rowObj);
     }
+    if (parser->p[0] != '\n' && parser->p[0] != '\0') parser->ragged++;
     
     return table;
 }
@@ -676,6 +1137,145 @@ FORCE_INLINE void skipLine(toonParser *parser) {
     parseNewLine(parser);
 }
 
+/* -----------------------------------------------------------------------------
+ * Whole-document path index
+ *
+ * With TOON_PARSE_PATH_INDEX the parser records every member it attaches,
+ * along with the hash of its full dotted path, chained on from the parent's
+ * hash it finds on its stack. When parsing is done the entries are put in
+ * an open addressing table hung off the root's key index, and TOONc_get()
+ * on the root becomes one hash of the path and one probe. A hit is checked
+ * by walking the entry's parents back up against the path's segments, so
+ * hash collisions and keys containing dots can't give a wrong answer.
+ * -------------------------------------------------------------------------- */
+
+#define PATH_NONE UINT32_MAX
+#define PATH_SEED 0x9E3779B97F4A7C15ULL
+
+typedef struct pathEntry {
+    uint64_t hash;          /* Of the segments from the root down */
+    toonObject *node;       /* NULL if shadowed by an earlier duplicate */
+    uint32_t parent;        /* Entry of the parent, PATH_NONE under the root */
+    uint32_t key_len;
+} pathEntry;
+
+typedef struct toonPathIndex {
+    pathEntry *entries;
+    size_t count, cap;
+    uint32_t *slots;        /* Entry + 1, 0 when empty */
+    size_t mask;
+} toonPathIndex;
+
+/* Key index of one object (see objectChild()). The root of a parse with
+ * TOON_PARSE_PATH_INDEX gets one straight away, holding the path index. */
+typedef struct toonIndex {
+    size_t mask;
+    toonPathIndex *paths;
+    toonObject *slots[];
+} toonIndex;
+
+static toonIndex *indexBuild(toonObject *obj);
+
+static uint32_t pathAdd(toonPathIndex *px, toonObject *node, uint32_t parent,
+        const char *key, size_t len) {
+    if (px->count == px->cap) {
+        px->cap = px->cap ? px->cap * 2 : 64;
+        px->entries = trealloc(px->entries, px->cap * sizeof(pathEntry));
+    }
+    pathEntry *e = &px->entries[px->count];
+    uint64_t h = parent == PATH_NONE ? PATH_SEED : px->entries[parent].hash;
+    e->hash = spanMixBytes(h, key, len);
+    e->node = node;
+    e->parent = parent;
+    e->key_len = (uint32_t)len;
+    return (uint32_t)px->count++;
+}
+
+/* Put the entries in the table, in document order. A path a lookup walk
+ * would never reach (a repeated key, or anything below one) is left out:
+ * the first member with a given path wins, as in a scan. */
+static void pathFinish(toonPathIndex *px) {
+    size_t size = 16;
+    while (size < px->count * 2) size *= 2;
+    px->slots = tcalloc(size, sizeof(uint32_t));
+    px->mask = size - 1;
+
+    for (size_t i = 0; i < px->count; i++) {
+        pathEntry *e = &px->entries[i];
+        if (e->parent != PATH_NONE && px->entries[e->parent].node == NULL) {
+            e->node = NULL;
+            continue;
+        }
+        size_t s = e->hash & px->mask;
+        for (; px->slots[s]; s = (s + 1) & px->mask) {
+            const pathEntry *o = &px->entries[px->slots[s] - 1];
+            if (o->hash == e->hash && o->parent == e->parent &&
+                o->key_len == e->key_len &&
+                memcmp(o->node->key, e->node->key, e->key_len) == 0)
+                break;
+        }
+        if (px->slots[s]) e->node = NULL;
+        else px->slots[s] = (uint32_t)i + 1;
+    }
+}
+
+static void pathIndexFree(toonPathIndex *px) {
+    if (!px) return;
+    tfree(px->entries);
+    tfree(px->slots);
+    tfree(px);
+}
+
+/* Segments of a path as [start, end) pairs, for checking a hit. The parser
+ * stack caps the depth, so no indexed path has more of them. */
+typedef struct pathSegs {
+    const char *at[64][2];
+    int count;
+} pathSegs;
+
+/* Does entry 'e' sit at the path split into 'segs'? */
+static int pathMatches(const toonPathIndex *px, uint32_t e, const pathSegs *segs) {
+    for (int i = segs->count - 1; i >= 0; i--) {
+        if (e == PATH_NONE) return 0;
+        const pathEntry *pe = &px->entries[e];
+        size_t len = (size_t)(segs->at[i][1] - segs->at[i][0]);
+        if (pe->key_len != len || memcmp(pe->node->key, segs->at[i][0], len) != 0)
+            return 0;
+        e = pe->parent;
+    }
+    return e == PATH_NONE;
+}
+
+/* Empty segments are skipped, as TOONc_get() skips them. */
+static toonObject *pathLookup(const toonPathIndex *px, toonObject *root,
+        const char *path, size_t len) {
+    uint64_t h = PATH_SEED;
+    const char *p = path, *end = path + len;
+    pathSegs segs;
+    segs.count = 0;
+    while (p < end) {
+        if (*p == '.') {
+            p++;
+            continue;
+        }
+        if (segs.count == 64) return NULL;
+        const char *dot = memchr(p, '.', (size_t)(end - p));
+        if (!dot) dot = end;
+        h = spanMixBytes(h, p, (size_t)(dot - p));
+        segs.at[segs.count][0] = p;
+        segs.at[segs.count++][1] = dot;
+        p = dot;
+    }
+    if (!segs.count) return root;
+
+    for (size_t s = h & px->mask; px->slots[s]; s = (s + 1) & px->mask) {
+        uint32_t e = px->slots[s] - 1;
+        if (px->entries[e].hash == h && pathMatches(px, e, &segs))
+            return px->entries[e].node;
+    }
+    return NULL;
+}
+
 /* -----------------------------------------------------------------------------
  * Main parsing logic
  *
@@ -684,11 +1284,58 @@ FORCE_INLINE void skipLine(toonParser *parser) {
  * it becomes a parent for subsequent indented properties.
  * -------------------------------------------------------------------------- */
 
-toonObject *parse(char *source) {
+/* Top-level sections, for incremental reloads. A section starts at a line
+ * holding a top-level member: that member pops the whole stack, so what is
+ * parsed from there on doesn't depend on anything before it. parseFrom()
+ * records each section head and can stop at the first line whose offset
+ * is in 'stops' (sorted), where the rest of the text is known to parse as
+ * it did before. */
+typedef struct sectionMarks {
+    size_t *offsets;        /* Line offset of each section head */
+    toonObject **heads;     /* Top-level member parsed there */
+    unsigned char *line_rows; /* Head is a table with one row per line */
+    size_t count, cap;
+    const size_t *stops;
+    size_t nstops;
+    size_t end;             /* Offset where parsing ended */
+} sectionMarks;
+
+static int sectionStop(const sectionMarks *m, size_t off) {
+    size_t lo = 0, hi = m->nstops;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (m->stops[mid] == off) return 1;
+        if (m->stops[mid] < off) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+static void sectionMark(sectionMarks *m, size_t off, toonObject *head, int line_rows) {
+    if (m->count == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 16;
+        m->offsets = trealloc(m->offsets, m->cap * sizeof(size_t));
+        m->heads = trealloc(m->heads, m->cap * sizeof(toonObject *));
+        m->line_rows = trealloc(m->line_rows, m->cap);
+    }
+    m->offsets[m->count] = off;
+    m->line_rows[m->count] = (unsigned char)line_rows;
+    m->heads[m->count++] = head;
+}
+
+/* Parse from 'start' inside 'source', optionally recording sections. */
+static toonObject *parseFrom(char *source, char *start,
+        const toonParseOptions *opts, sectionMarks *marks) {
     toonParser parser;
     parser.source = source;
-    parser.p = source;
+    parser.p = start;
     parser.line = 1;
+    parser.opts = opts;
+    parser.errors = 0;
+    parser.aborted = 0;
+    parser.ragged = 0;
+    parser.spans = opts ? opts->spans : NULL;
+    if (UNLIKELY(parser.spans != NULL)) spanReset(parser.spans, source);
 
 #if 0
     static int iteration = 0;
@@ -711,14 +1358,30 @@ toonObject *parse(char *source) {
     toonObject **stack = tmalloc(sizeof(toonObject *) * 64);
     int stack_size = 1;
     stack[0] = root;
+    size_t *span_stack = parser.spans ? tmalloc(sizeof(size_t) * 64) : NULL;
+    toonPathIndex *paths = NULL;
+    uint32_t *path_stack = NULL;
+    if (opts && (opts->flags & TOON_PARSE_PATH_INDEX)) {
+        paths = tcalloc(1, sizeof(*paths));
+        path_stack = tmalloc(sizeof(uint32_t) * 64);
+        path_stack[0] = PATH_NONE;
+    }
 
-    while (parser.p[0]) {
+    while (parser.p[0] && !parser.aborted) {
         /* Skip blank lines and comments. */
         if (UNLIKELY(isCommentOrEmpty(&parser))) {
             skipLine(&parser);
             continue;
         }
 
+        char *line = parser.p;
+        int at_bol = line == source || line[-1] == '\n';
+        if (UNLIKELY(marks != NULL) && at_bol && marks->nstops &&
+            sectionStop(marks, line - source))
+            break;
+
+        int line_no = parser.line;
+
         /* Parse indentation to determine nesting level. */
         int indent = parseIndent(&parser);
         
@@ -742,7 +1405,7 @@ toonObject *parse(char *source) {
 
         /* Expect colon after key (and optional array/table notation). */
         if (parser.p[0] != ':') {
-            fprintf(stderr, "Syntax error at line %d: expected ':'\n", parser.line);
+            parseError(&parser, TOON_ERR_EXPECTED_COLON, parser.p);
             /* Clean up column names if we allocated them. */
             if (columns) {
                 for (int i = 0; i < col_count; i++) {
@@ -754,10 +1417,15 @@ toonObject *parse(char *source) {
             continue;
         }
         parser.p++; /* Skip ':' */
+        char *value_at = parser.p;
+        size_t span_slot = SIZE_MAX;
+        if (UNLIKELY(parser.spans != NULL) && (columns || array_size >= 0))
+            span_slot = spanAdd(parser.spans, NULL, source, value_at, value_at, line_no);
        
         /* Parse the value (or values for tables/arrays). */
         toonObject *prop;
         int has_value = 0;
+        int is_table = columns != NULL, ragged = parser.ragged;
         
         if (columns) {
             /* Tabular data: parse multiple rows. */
@@ -794,13 +1462,6 @@ toonObject *parse(char *source) {
         while (stack_size > 1 && stack[stack_size - 1]->indent >= indent)
             stack_size--;
 
-        /* Check for stack bounds */
-        if (stack_size <= 0) {
-            fprintf(stderr, "Internal error: stack underflow at line %d\n",
-                    parser.line);
-            stack_size = 1;
-        }
-
         toonObject *parent = stack[stack_size - 1];
         
         /* Add this property to the parent's child list. */
@@ -814,74 +1475,437 @@ toonObject *parse(char *source) {
             }
             sibling->next = prop;
         }
+        if (UNLIKELY(marks != NULL) && indent == 0 && at_bol)
+            sectionMark(marks, line - source, prop, is_table && parser.ragged == ragged);
+        size_t span_idx = 0;
+        if (UNLIKELY(parser.spans != NULL))
+            span_idx = spanMember(&parser, prop, span_slot, line, line_no,
+                                  key, keylen, value_at, !is_table);
+        uint32_t path_idx = PATH_NONE;
+        if (UNLIKELY(paths != NULL))
+            path_idx = pathAdd(paths, prop, path_stack[stack_size - 1], key, keylen);
 
         /* If this property has no value (is an object), push it onto the
          * stack so subsequent indented properties become its children. */
         if (!has_value && prop->kvtype == KV_OBJ) {
             if (stack_size < 64) {
+                if (span_stack) span_stack[stack_size] = span_idx;
+                if (path_stack) path_stack[stack_size] = path_idx;
                 stack[stack_size++] = prop;
             } else {
-                fprintf(stderr, "Warning: max nesting depth exceeded at line %d\n",
-                        parser.line);
+                parseError(&parser, TOON_ERR_MAX_DEPTH, key);
             }
         }
 
+        /* The line ends this member and every open ancestor so far. */
+        if (UNLIKELY(parser.spans != NULL)) {
+            size_t end = spanStop(&parser, span_idx);
+            spanExtend(parser.spans, span_idx, end);
+            for (int i = 1; i < stack_size; i++)
+                spanExtend(parser.spans, span_stack[i], end);
+        }
+
         if (parser.p[0] == '\n') {
             parseNewLine(&parser);
         } else if (parser.p[0] == '\0') {
             break;
         } else {
-            fprintf(stderr, "Warning: unexpected character '%c' at line %d, skipping\n",
-                    parser.p[0], parser.line);
+            parseError(&parser, TOON_ERR_UNEXPECTED_CHAR, parser.p);
             parser.p++;
         }
     }
 
     tfree(stack);
+    tfree(span_stack);
+    tfree(path_stack);
+    if (marks) marks->end = parser.p - source;
+
+    /* Strict mode: a partial tree is worse than none. */
+    if (UNLIKELY(parser.aborted)) {
+        if (parser.spans) parser.spans->count = 0;
+        pathIndexFree(paths);
+        TOONc_free(root);
+        return NULL;
+    }
+    if (UNLIKELY(paths != NULL)) {
+        pathFinish(paths);
+        root->index = indexBuild(root);
+        root->index->paths = paths;
+    }
+    if (UNLIKELY(parser.spans != NULL)) {
+        toonSpan *rs = &parser.spans->spans[0];
+        parser.spans->nodes[0] = root;
+        rs->start = rs->value = start - source;
+        rs->end = parser.p - source;
+        rs->value_len = rs->end - rs->start;
+        spanIndex(parser.spans);
+    }
     return root;
 }
 
+toonObject *parse(char *source, const toonParseOptions *opts) {
+    return parseFrom(source, source, opts, NULL);
+}
+
+/* Human-readable text for a diagnostic code. */
+const char *TOONc_strerror(int code) {
+    switch (code) {
+    case TOON_OK:                  return "no error";
+    case TOON_ERR_EXPECTED_COLON:  return "expected ':' after key";
+    case TOON_ERR_UNCLOSED_TABLE:  return "missing '}' in table columns";
+    case TOON_ERR_MAX_DEPTH:       return "maximum nesting depth exceeded";
+    case TOON_ERR_UNEXPECTED_CHAR: return "unexpected character";
+    case TOON_ERR_UNEXPECTED_END:  return "unexpected end of input";
+    case TOON_ERR_BAD_STRING:      return "invalid string or escape";
+    default:                       return "unknown error";
+    }
+}
+
 /* -----------------------------------------------------------------------------
  * Query and access functions
+ *
+ * A lookup that has to go past TOON_INDEX_MIN children of an object builds
+ * a hash index of its keys, so the next lookups in wide objects are a probe
+ * instead of a scan. The index is built aside and published with a
+ * compare-and-swap: readers sharing a tree either see no index yet (and
+ * scan) or a complete one, and the loser of a race frees its copy. The
+ * child chain is not touched, so iteration keeps insertion order.
  * -------------------------------------------------------------------------- */
 
+#define TOON_INDEX_MIN 32
+
+static uint32_t snapHash(const char *s, size_t len);
+
+/* Does the NUL-terminated 'key' equal the 'len' bytes at 'name'? */
+FORCE_INLINE int keyIs(const char *key, const char *name, size_t len) {
+    return strncmp(key, name, len) == 0 && key[len] == '\0';
+}
+
+static toonIndex *indexBuild(toonObject *obj) {
+    size_t n = 0, size = 16;
+    for (toonObject *c = obj->child; c; c = c->next) n++;
+    while (size < n * 2) size *= 2;
+
+    toonIndex *idx = tcalloc(1, sizeof(toonIndex) + size * sizeof(toonObject *));
+    idx->mask = size - 1;
+    idx->paths = NULL;
+    for (toonObject *c = obj->child; c; c = c->next) {
+        if (!c->key) continue;
+        size_t s = snapHash(c->key, strlen(c->key)) & idx->mask;
+        /* Duplicate keys: the first one wins, as in a scan. */
+        while (idx->slots[s] && strcmp(idx->slots[s]->key, c->key) != 0)
+            s = (s + 1) & idx->mask;
+        if (!idx->slots[s]) idx->slots[s] = c;
+    }
+    return idx;
+}
+
+static toonObject *indexProbe(const toonIndex *idx, const char *name, size_t len,
+        uint32_t hash) {
+    size_t s = hash & idx->mask;
+    while (idx->slots[s]) {
+        if (keyIs(idx->slots[s]->key, name, len)) return idx->slots[s];
+        s = (s + 1) & idx->mask;
+    }
+    return NULL;
+}
+
+static toonIndex *indexPublish(toonObject *obj) {
+    toonIndex *idx = indexBuild(obj), *seen = NULL;
+    if (!__atomic_compare_exchange_n(&obj->index, &seen, idx, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        tfree(idx);
+        idx = seen;
+    }
+    return idx;
+}
+
+/* The child of 'obj' named by the 'len' bytes at 'name'. 'hash' is the
+ * name's snapHash() if the caller has it, else NULL: it is only needed
+ * when the object is indexed. */
+static toonObject *objectChild(toonObject *obj, const char *name, size_t len,
+        const uint32_t *hash) {
+    if (obj->kvtype == KV_OBJ) {
+        toonIndex *idx = __atomic_load_n(&obj->index, __ATOMIC_ACQUIRE);
+        if (idx) return indexProbe(idx, name, len, hash ? *hash : snapHash(name, len));
+    }
+
+    size_t seen = 0;
+    for (toonObject *c = obj->child; c; c = c->next) {
+        if (c->key && keyIs(c->key, name, len)) return c;
+        if (++seen == TOON_INDEX_MIN && obj->kvtype == KV_OBJ)
+            return indexProbe(indexPublish(obj), name, len,
+                              hash ? *hash : snapHash(name, len));
+    }
+    return NULL;
+}
+
+static void indexFree(toonIndex *idx) {
+    if (!idx) return;
+    pathIndexFree(idx->paths);
+    tfree(idx);
+}
+
+void TOONc_dropIndex(toonObject *obj) {
+    if (!TOON_IS_OBJ(obj)) return;
+    indexFree(obj->index);
+    obj->index = NULL;
+}
+
 /* Get an object by path using dot notation. Example: "context.task"
- * Returns NULL if the path doesn't exist. */
-toonObject *TOONc_get(toonObject *root, const char *path) {
+ * Returns NULL if the path doesn't exist.
+ *
+ * The path is walked in place, segment by segment with memchr(), so a
+ * lookup allocates nothing and keeps no state outside its own frame:
+ * any number of threads may run it on a shared tree. The one allocation
+ * it can cause is the key index of a wide object, built once and
+ * published atomically (see above). Empty segments are skipped, and a
+ * NUL ends the path. */
+toonObject *TOONc_getn(toonObject *root, const char *path, size_t len) {
     if (!root || !path) return NULL;
-    
-    /* We need to modify the string for strtok, so make a copy. */
-    char *path_copy = strdup(path);
-    if (!path_copy) return NULL;
-    
-    char *token = strtok(path_copy, ".");
+
+    const char *nul = memchr(path, '\0', len);
+    if (nul) len = (size_t)(nul - path);
+
+    if (root->kvtype == KV_OBJ) {
+        toonIndex *idx = __atomic_load_n(&root->index, __ATOMIC_ACQUIRE);
+        if (idx && idx->paths) return pathLookup(idx->paths, root, path, len);
+    }
+
+    const char *p = path, *end = path + len;
     toonObject *current = root;
+    while (p < end) {
+        if (*p == '.') {
+            p++;
+            continue;
+        }
+        const char *dot = memchr(p, '.', (size_t)(end - p));
+        if (!dot) dot = end;
+        current = objectChild(current, p, (size_t)(dot - p), NULL);
+        if (!current) return NULL;  /* Path doesn't exist */
+        p = dot;
+    }
+    return current;
+}
 
-    /* Navigate through each component of the path. */
-    while (token) {
-        toonObject *found = NULL;
-        toonObject *child = current->child;
+toonObject *TOONc_get(toonObject *root, const char *path) {
+    if (!root || !path) return NULL;
+    return TOONc_getn(root, path, strlen(path));
+}
 
-        /* Search for a child with this key. */
-        while (child) {
-            if (child->key && strcmp(child->key, token) == 0) {
-                found = child;
-                break;
+/* A compiled path: the segments of "a.b[2].c" split once, with their
+ * lengths and hashes, so resolving it needs no parsing or allocation. An
+ * index is a segment of its own, so "m[1][0]" works as expected. */
+typedef struct pathSeg {
+    const char *name;       /* NULL for an array index */
+    size_t len;             /* Name length, or the index */
+    uint32_t hash;
+} pathSeg;
+
+struct toonPath {
+    size_t count;
+    pathSeg *segs;
+    char *text;             /* Names point in here */
+};
+
+/* Compile a dotted path with optional [N] array indices. Empty segments
+ * are skipped, as TOONc_get() skips them. Returns NULL on a malformed
+ * index. */
+toonPath *TOONc_compilePath(const char *path) {
+    if (!path) return NULL;
+
+    size_t len = strlen(path), max = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (path[i] == '.' || path[i] == '[') max++;
+    }
+    toonPath *q = tmalloc(sizeof(*q));
+    q->segs = tmalloc(max * sizeof(pathSeg));
+    q->text = tmalloc(len + 1);
+    memcpy(q->text, path, len + 1);
+    q->count = 0;
+
+    const char *p = q->text;
+    while (*p) {
+        if (*p == '.') {
+            p++;
+        } else if (*p == '[') {
+            const char *d = ++p;
+            size_t index = 0;
+            while (isdigit((unsigned char)*p) && index <= (SIZE_MAX - 9) / 10)
+                index = index * 10 + (size_t)(*p++ - '0');
+            if (p == d || *p != ']') {
+                TOONc_freePath(q);
+                return NULL;
             }
-            child = child->next;
+            p++;
+            q->segs[q->count++] = (pathSeg){NULL, index, 0};
+        } else {
+            const char *name = p;
+            while (*p && *p != '.' && *p != '[') p++;
+            size_t n = (size_t)(p - name);
+            q->segs[q->count++] = (pathSeg){name, n, snapHash(name, n)};
         }
+    }
+    return q;
+}
+
+void TOONc_freePath(toonPath *q) {
+    if (!q) return;
+    tfree(q->segs);
+    tfree(q->text);
+    tfree(q);
+}
+
+/* Follow one segment down from 'o'. */
+FORCE_INLINE toonObject *pathStep(toonObject *o, const pathSeg *seg) {
+    if (seg->name) return objectChild(o, seg->name, seg->len, &seg->hash);
+    return TOONc_getArrayItem(o, seg->len);
+}
+
+/* Resolve a compiled path. Allocation free and safe to call from many
+ * threads on a shared tree. */
+toonObject *TOONc_getCompiled(toonObject *root, const toonPath *q) {
+    if (!root || !q) return NULL;
+    toonObject *o = root;
+    for (size_t i = 0; i < q->count && o; i++)
+        o = pathStep(o, &q->segs[i]);
+    return o;
+}
+
+static int segSame(const pathSeg *a, const pathSeg *b) {
+    if (a->name == NULL || b->name == NULL)
+        return a->name == b->name && a->len == b->len;
+    return a->hash == b->hash && a->len == b->len &&
+           memcmp(a->name, b->name, a->len) == 0;
+}
+
+/* Order segments so equal ones sit together: array indices first, then
+ * names by hash, which is all TOONc_getMany() needs. */
+static int segCmp(const pathSeg *a, const pathSeg *b) {
+    if (a->name == NULL || b->name == NULL) {
+        if (a->name != b->name) return a->name ? 1 : -1;
+        return (a->len > b->len) - (a->len < b->len);
+    }
+    if (a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+    if (a->len != b->len) return a->len < b->len ? -1 : 1;
+    return memcmp(a->name, b->name, a->len);
+}
+
+/* One path of a batch, sorted into trie order. */
+typedef struct manyItem {
+    const toonPath *q;
+    size_t slot;            /* Index into 'out' */
+    toonObject *hit;        /* Child found for the group this item leads */
+} manyItem;
+
+typedef struct manyWalk {
+    manyItem *items;
+    toonObject **out;
+    size_t found;
+} manyWalk;
+
+static int manyCmp(const void *pa, const void *pb) {
+    const toonPath *a = ((const manyItem *)pa)->q, *b = ((const manyItem *)pb)->q;
+    size_t n = a->count < b->count ? a->count : b->count;
+    for (size_t i = 0; i < n; i++) {
+        int c = segCmp(&a->segs[i], &b->segs[i]);
+        if (c) return c;
+    }
+    if (a->count != b->count) return a->count < b->count ? -1 : 1;
+    return ((const manyItem *)pa)->slot < ((const manyItem *)pb)->slot ? -1 : 1;
+}
+
+/* The end of the group of items from 'lo' sharing segment 'd'. */
+static size_t manyGroupEnd(const manyItem *it, size_t lo, size_t hi, size_t d) {
+    size_t e = lo + 1;
+    while (e < hi && segSame(&it[e].q->segs[d], &it[lo].q->segs[d])) e++;
+    return e;
+}
+
+/* Items [lo, hi) share their first 'd' segments, which lead to 'o'. The
+ * ones that end here resolve to 'o'; the rest are grouped by their next
+ * segment, and 'o' is searched once for all of the groups. */
+static void manyResolve(manyWalk *w, toonObject *o, size_t lo, size_t hi, size_t d) {
+    manyItem *it = w->items;
+    for (; lo < hi && it[lo].q->count == d; lo++) {
+        w->out[it[lo].slot] = o;
+        w->found++;
+    }
+
+    /* Array indices sort first and are direct lookups. */
+    while (lo < hi && it[lo].q->segs[d].name == NULL) {
+        size_t e = manyGroupEnd(it, lo, hi, d);
+        toonObject *item = TOONc_getArrayItem(o, it[lo].q->segs[d].len);
+        if (item) manyResolve(w, item, lo, e, d + 1);
+        lo = e;
+    }
+    if (lo == hi) return;
+
+    size_t groups = 0;
+    for (size_t g = lo; g < hi; g = manyGroupEnd(it, g, hi, d)) {
+        it[g].hit = NULL;
+        groups++;
+    }
 
-        if (!found) {
-            free(path_copy);
-            return NULL; /* Path doesn't exist */
+    toonIndex *idx = o->kvtype == KV_OBJ ?
+        __atomic_load_n(&o->index, __ATOMIC_ACQUIRE) : NULL;
+    if (idx || groups == 1) {
+        /* An indexed object answers each name directly; a single name
+         * is one scan anyway. */
+        for (size_t g = lo; g < hi; g = manyGroupEnd(it, g, hi, d)) {
+            const pathSeg *seg = &it[g].q->segs[d];
+            it[g].hit = objectChild(o, seg->name, seg->len, &seg->hash);
+        }
+    } else {
+        /* One pass over the children: each key is looked up among the
+         * pending names, and the first member with a name wins. */
+        size_t pending = groups;
+        for (toonObject *c = o->child; c && pending; c = c->next) {
+            if (!c->key) continue;
+            size_t len = strlen(c->key);
+            pathSeg key = {c->key, len, snapHash(c->key, len)};
+            size_t a = lo, b = hi;
+            while (a < b) {
+                size_t mid = a + (b - a) / 2;
+                if (segCmp(&it[mid].q->segs[d], &key) < 0) a = mid + 1;
+                else b = mid;
+            }
+            if (a < hi && !it[a].hit && segSame(&it[a].q->segs[d], &key)) {
+                it[a].hit = c;
+                pending--;
+            }
         }
-        
-        current = found;
-        token = strtok(NULL, ".");
     }
-    
-    free(path_copy);
-    return current;
+
+    for (size_t g = lo; g < hi;) {
+        size_t e = manyGroupEnd(it, g, hi, d);
+        if (it[g].hit) manyResolve(w, it[g].hit, g, e, d + 1);
+        g = e;
+    }
+}
+
+/* Resolve many compiled paths in one descent. The paths are sorted into
+ * a trie, whatever order they come in, so every object on the way is
+ * searched once for all the paths going through it. Returns how many
+ * were found. */
+size_t TOONc_getMany(toonObject *root, toonPath *const paths[], size_t n,
+        toonObject *out[]) {
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = NULL;
+        if (root && paths[i]) m++;
+    }
+    if (m == 0) return 0;
+
+    manyWalk w = {tmalloc(m * sizeof(manyItem)), out, 0};
+    m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (paths[i]) w.items[m++] = (manyItem){paths[i], i, NULL};
+    }
+    qsort(w.items, m, sizeof(manyItem), manyCmp);
+    manyResolve(&w, root, 0, m, 0);
+    tfree(w.items);
+    return w.found;
 }
 
 /* -----------------------------------------------------------------------------
@@ -890,6 +1914,11 @@ toonObject *TOONc_get(toonObject *root, const char *path) {
 
 /* Parse a TOON file. The file pointer is closed after reading. */
 toonObject *TOONc_parseFile(FILE *fp) {
+    return TOONc_parseFileWithOptions(fp, NULL);
+}
+
+/* Parse a TOON file reporting diagnostics through 'opts'. */
+toonObject *TOONc_parseFileWithOptions(FILE *fp, const toonParseOptions *opts) {
     if (!fp) return NULL;
     
     /* Read entire file into memory. */
@@ -907,13 +1936,18 @@ toonObject *TOONc_parseFile(FILE *fp) {
     fclose(fp);
 
     /* Parse and free the source buffer. */
-    toonObject *root = parse(source);
+    toonObject *root = parse(source, opts);
     tfree(source);
     return root;
 }
 
 /* Parse a TOON string. */
 toonObject *TOONc_parseString(const char *str) {
+    return TOONc_parseStringWithOptions(str, NULL);
+}
+
+/* Parse a TOON string reporting diagnostics through 'opts'. */
+toonObject *TOONc_parseStringWithOptions(const char *str, const toonParseOptions *opts) {
     if (!str) return NULL;
     
     /* Make a mutable copy since the parser modifies the string. */
@@ -921,7 +1955,7 @@ toonObject *TOONc_parseString(const char *str) {
     char *copy = tmalloc(len + 1);
     memcpy(copy, str, len + 1);
     
-    toonObject *root = parse(copy);
+    toonObject *root = parse(copy, opts);
     tfree(copy);
     return root;
 }
@@ -950,85 +1984,775 @@ size_t TOONc_getArrayLength(toonObject *arr) {
 }
 
 /* -----------------------------------------------------------------------------
- * Output and debugging functions
+ * Table views
+ *
+ * A parsed table is a list of row objects, each a chain of cells, so
+ * reading one cell by name means a scan of the row. A view lays the cells
+ * out row by row in one array, with the columns taken from the first row
+ * as the encoder takes them: once a column name is resolved to its
+ * position, any cell is a plain index. Rows missing a column get NULL
+ * there, and keys the first row doesn't have are left out.
+ *
+ * The view points into the tree and is read-only, so threads can share
+ * it; it has to be closed before the tree is freed or changed.
  * -------------------------------------------------------------------------- */
 
-/* Recursively print a TOON object tree for debugging. */
-void printObject(toonObject *o, int depth) {
-    if (o == NULL) return;
-
-    /* Indent to show nesting level. */
-    for (int i = 0; i < depth; i++) printf("  ");
+struct toonTable {
+    size_t rows, cols;
+    const char **names;     /* Column names, borrowed from the first row */
+    toonObject **cells;     /* rows * cols, row-major */
+};
 
-    if (o->key) printf("%s: ", o->key);
+toonTable *TOONc_tableOpen(toonObject *list) {
+    if (!TOON_IS_LIST(list) || list->array.len == 0) return NULL;
+    toonObject *first = list->array.items[0];
+    if (first->kvtype != KV_OBJ) return NULL;
+
+    size_t cols = 0, rows = list->array.len;
+    for (toonObject *c = first->child; c; c = c->next) {
+        if (c->key) cols++;
+    }
+    if (cols == 0) return NULL;
+
+    toonTable *t = tmalloc(sizeof(*t));
+    t->rows = rows;
+    t->cols = cols;
+    t->names = tmalloc(cols * sizeof(char *));
+    t->cells = tcalloc(rows * cols, sizeof(toonObject *));
+    size_t n = 0;
+    for (toonObject *c = first->child; c; c = c->next) {
+        if (c->key) t->names[n++] = c->key;
+    }
+
+    for (size_t r = 0; r < rows; r++) {
+        toonObject *row = list->array.items[r];
+        if (row->kvtype != KV_OBJ) continue;
+        toonObject **cells = t->cells + r * cols;
+        /* Rows usually list the columns in order: try the next cell first. */
+        toonObject *hint = row->child;
+        for (size_t col = 0; col < cols; col++) {
+            toonObject *cell = NULL;
+            if (hint && hint->key && strcmp(hint->key, t->names[col]) == 0) {
+                cell = hint;
+            } else {
+                for (toonObject *c = row->child; c; c = c->next) {
+                    if (c->key && strcmp(c->key, t->names[col]) == 0) {
+                        cell = c;
+                        break;
+                    }
+                }
+            }
+            cells[col] = cell;
+            hint = cell ? cell->next : hint;
+        }
+    }
+    return t;
+}
+
+void TOONc_tableClose(toonTable *t) {
+    if (!t) return;
+    tfree(t->names);
+    tfree(t->cells);
+    tfree(t);
+}
+
+size_t TOONc_tableRows(const toonTable *t) {
+    return t ? t->rows : 0;
+}
+
+size_t TOONc_tableColumns(const toonTable *t) {
+    return t ? t->cols : 0;
+}
+
+const char *TOONc_tableColumn(const toonTable *t, size_t col) {
+    return t && col < t->cols ? t->names[col] : NULL;
+}
+
+size_t TOONc_tableColumnIndex(const toonTable *t, const char *name) {
+    if (!t || !name) return TOON_TABLE_NONE;
+    for (size_t col = 0; col < t->cols; col++) {
+        if (strcmp(t->names[col], name) == 0) return col;
+    }
+    return TOON_TABLE_NONE;
+}
+
+toonObject *TOONc_tableCell(const toonTable *t, size_t row, size_t col) {
+    if (UNLIKELY(!t || row >= t->rows || col >= t->cols)) return NULL;
+    return t->cells[row * t->cols + col];
+}
+
+/* -----------------------------------------------------------------------------
+ * Buffered writer
+ *
+ * Every emitter writes through a toonWriter instead of calling fprintf per
+ * token. Small writes are memcpy'd into a staging buffer that is handed to
+ * the sink in large chunks: one fwrite() per chunk for FILE sinks, one
+ * write()/writev() per chunk for fd sinks. Memory sinks simply grow the
+ * buffer, which then becomes the output. Write errors are sticky: after the
+ * first failure further output is dropped and 'error' holds the errno.
+ * -------------------------------------------------------------------------- */
+
+#define TOON_WRITER_CHUNK (64 * 1024)
+
+static void writerInit(toonWriter *w, int sink, size_t cap) {
+    memset(w, 0, sizeof(*w));
+    w->sink = sink;
+    w->fd = -1;
+    w->buf = tmalloc(cap);
+    w->cap = cap;
+}
+
+void TOONc_writerInitMemory(toonWriter *w) {
+    writerInit(w, TOON_SINK_MEMORY, 256);
+}
+
+void TOONc_writerInitFd(toonWriter *w, int fd) {
+    writerInit(w, TOON_SINK_FD, TOON_WRITER_CHUNK);
+    w->fd = fd;
+}
+
+void TOONc_writerInitFile(toonWriter *w, FILE *fp) {
+    writerInit(w, TOON_SINK_FILE, TOON_WRITER_CHUNK);
+    w->fp = fp;
+}
+
+/* Write into a fixed caller-owned buffer. Nothing is allocated; output that
+ * does not fit is counted in 'written' and flagged with ENOSPC, and one
+ * byte is always kept free for a terminating NUL. */
+void TOONc_writerInitBuffer(toonWriter *w, char *buf, size_t cap) {
+    memset(w, 0, sizeof(*w));
+    w->sink = TOON_SINK_BUFFER;
+    w->fd = -1;
+    w->buf = buf;
+    w->cap = buf ? cap : 0;
+    if (w->cap == 0) {
+        /* No room even for the NUL: everything overflows. */
+        w->error = ENOSPC;
+    }
+}
+
+/* Write all of iov to the fd sink, retrying on short writes and EINTR. */
+static int writerWritev(toonWriter *w, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(w->fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            w->error = errno;
+            return -1;
+        }
+        w->written += (size_t)n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+/* Hand 'len' bytes at 'data' to the sink, bypassing the staging buffer. */
+static int writerSink(toonWriter *w, const char *data, size_t len) {
+    if (len == 0 || w->error) return w->error ? -1 : 0;
+
+    if (w->sink == TOON_SINK_FD) {
+        struct iovec iov = {(void *)data, len};
+        return writerWritev(w, &iov, 1);
+    }
+
+    if (fwrite(data, 1, len, w->fp) != len) {
+        w->error = errno ? errno : EIO;
+        return -1;
+    }
+    w->written += len;
+    return 0;
+}
+
+int TOONc_writerFlush(toonWriter *w) {
+    if (w->sink == TOON_SINK_MEMORY || w->sink == TOON_SINK_COUNT) return 0;
+    if (w->sink == TOON_SINK_BUFFER) return w->error ? -1 : 0;
+    int rc = writerSink(w, w->buf, w->len);
+    w->len = 0;
+    return rc;
+}
+
+/* Cold path of writerPut(): grow the memory buffer, or drain the staging
+ * buffer. Payloads larger than the buffer go straight to the sink; for fd
+ * sinks the pending bytes and the payload leave in a single writev(). */
+NO_INLINE static void writerPutSlow(toonWriter *w, const char *s, size_t len) {
+    if (w->sink == TOON_SINK_MEMORY) {
+        size_t new_cap = w->cap * 2;
+        while (new_cap - w->len <= len) new_cap *= 2;
+        w->buf = trealloc(w->buf, new_cap);
+        w->cap = new_cap;
+        memcpy(w->buf + w->len, s, len);
+        w->len += len;
+        return;
+    }
+
+    if (w->sink == TOON_SINK_COUNT) {
+        /* Measuring only: drop the scratch contents, keep the count. */
+        w->written += w->len + len;
+        w->len = 0;
+        return;
+    }
+
+    if (w->sink == TOON_SINK_BUFFER) {
+        /* Out of room: keep counting so the caller learns the exact size,
+         * and shrink 'cap' so every later write lands here too. */
+        w->written += len;
+        w->error = ENOSPC;
+        if (w->cap) w->cap = w->len + 1;
+        return;
+    }
+
+    if (w->error) {
+        w->len = 0;
+        return;
+    }
+
+    if (len < w->cap / 2) {
+        TOONc_writerFlush(w);
+        memcpy(w->buf, s, len);
+        w->len = len;
+        return;
+    }
+
+    if (w->sink == TOON_SINK_FD) {
+        struct iovec iov[2] = {{w->buf, w->len}, {(void *)s, len}};
+        writerWritev(w, iov, 2);
+    } else {
+        TOONc_writerFlush(w);
+        writerSink(w, s, len);
+    }
+    w->len = 0;
+}
+
+/* Append bytes. The fast path is a bounds check and a memcpy. Memory sinks
+ * always keep one spare byte for the terminating NUL. */
+FORCE_INLINE void writerPut(toonWriter *w, const char *s, size_t len) {
+    if (LIKELY(w->cap - w->len > len)) {
+        memcpy(w->buf + w->len, s, len);
+        w->len += len;
+        return;
+    }
+    writerPutSlow(w, s, len);
+}
+
+FORCE_INLINE void writerPutc(toonWriter *w, char c) {
+    if (LIKELY(w->cap - w->len > 1)) {
+        w->buf[w->len++] = c;
+        return;
+    }
+    writerPutSlow(w, &c, 1);
+}
+
+static void writerIndent(toonWriter *w, int depth) {
+    static const char spaces[] = "                                ";
+    size_t n = (size_t)depth * 2;
+    while (n > 0) {
+        size_t chunk = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        writerPut(w, spaces, chunk);
+        n -= chunk;
+    }
+}
+
+void TOONc_writerWrite(toonWriter *w, const void *data, size_t len) {
+    writerPut(w, data, len);
+}
+
+/* Take ownership of a memory writer's output as a NUL-terminated string.
+ * For other sinks this flushes and returns NULL. The writer is reset
+ * either way. */
+char *TOONc_writerRelease(toonWriter *w, size_t *len) {
+    char *out = NULL;
+    if (w->sink == TOON_SINK_MEMORY) {
+        w->buf[w->len] = '\0';
+        out = w->buf;
+        if (len) *len = w->len;
+    } else if (w->sink == TOON_SINK_BUFFER) {
+        /* The buffer belongs to the caller. */
+        if (len) *len = w->len;
+    } else {
+        TOONc_writerFlush(w);
+        tfree(w->buf);
+        if (len) *len = 0;
+    }
+    w->buf = NULL;
+    w->len = w->cap = 0;
+    return out;
+}
+
+/* Flush any pending output and release the writer's buffer. */
+int TOONc_writerFree(toonWriter *w) {
+    int rc = TOONc_writerFlush(w);
+    if (w->sink != TOON_SINK_BUFFER) tfree(w->buf);
+    w->buf = NULL;
+    w->len = w->cap = 0;
+    return rc;
+}
+
+/* -----------------------------------------------------------------------------
+ * Number formatting
+ *
+ * Emitters format numbers here rather than through printf. Integers use a
+ * two-digits-per-step lookup table. Doubles use Grisu2 (Florian Loitsch,
+ * "Printing Floating-Point Numbers Quickly and Accurately with Integers",
+ * PLDI 2010): the output always reads back as the exact same double and is
+ * the shortest such string in all but a tiny fraction of cases, at a small
+ * fraction of the cost of "%.17g". The digits are then laid out like
+ * JavaScript's Number#toString: plain decimals for magnitudes in
+ * [1e-6, 1e21), exponent form outside that range.
+ * -------------------------------------------------------------------------- */
+
+static const char digitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Format an unsigned integer. 'buf' needs room for 20 bytes. */
+static size_t formatUint(char *buf, uint64_t v) {
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+
+    while (v >= 100) {
+        unsigned idx = (unsigned)(v % 100) * 2;
+        v /= 100;
+        p -= 2;
+        p[0] = digitPairs[idx];
+        p[1] = digitPairs[idx + 1];
+    }
+    if (v >= 10) {
+        p -= 2;
+        p[0] = digitPairs[v * 2];
+        p[1] = digitPairs[v * 2 + 1];
+    } else {
+        *--p = (char)('0' + v);
+    }
+
+    size_t len = (size_t)(tmp + sizeof(tmp) - p);
+    memcpy(buf, p, len);
+    return len;
+}
+
+/* Format a signed int. 'buf' needs room for 11 bytes. */
+static size_t formatInt(char *buf, int v) {
+    if (v < 0) {
+        buf[0] = '-';
+        return 1 + formatUint(buf + 1, (uint64_t)(-(int64_t)v));
+    }
+    return formatUint(buf, (uint64_t)v);
+}
+
+/* A floating point number f * 2^e with a 64-bit significand. */
+typedef struct diyFp {
+    uint64_t f;
+    int e;
+} diyFp;
+
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DP_EXPONENT_MASK    0x7FF0000000000000ULL
+#define DP_HIDDEN_BIT       0x0010000000000000ULL
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS    (0x3FF + DP_SIGNIFICAND_SIZE)
+
+/* Normalized powers of ten 10^-348, 10^-340, ..., 10^340. */
+static const uint64_t cachedPowersF[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const int16_t cachedPowersE[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint64_t pow10u64[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static diyFp diyFromDouble(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+
+    int biased_e = (int)((u & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+    uint64_t significand = u & DP_SIGNIFICAND_MASK;
+    diyFp r;
+    if (biased_e != 0) {
+        r.f = significand + DP_HIDDEN_BIT;
+        r.e = biased_e - DP_EXPONENT_BIAS;
+    } else {
+        r.f = significand;
+        r.e = 1 - DP_EXPONENT_BIAS;
+    }
+    return r;
+}
+
+/* Upper 64 bits of the 128-bit product, rounded. */
+static diyFp diyMultiply(diyFp x, diyFp y) {
+    diyFp r;
+#if defined(__SIZEOF_INT128__)
+    __uint128_t p = (__uint128_t)x.f * y.f;
+    uint64_t h = (uint64_t)(p >> 64);
+    uint64_t l = (uint64_t)p;
+    if (l & (1ULL << 63)) h++;
+    r.f = h;
+#else
+    const uint64_t M32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & M32;
+    uint64_t c = y.f >> 32, d = y.f & M32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += 1ULL << 31; /* Round */
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+#endif
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static diyFp diyNormalize(diyFp x) {
+    while (!(x.f & (1ULL << 63))) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/* Boundaries m- and m+ of the rounding interval of 'v', normalized to the
+ * same exponent. */
+static void diyBoundaries(diyFp v, diyFp *minus, diyFp *plus) {
+    diyFp pl = {(v.f << 1) + 1, v.e - 1};
+    while (!(pl.f & (DP_HIDDEN_BIT << 1))) {
+        pl.f <<= 1;
+        pl.e--;
+    }
+    pl.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+    pl.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+
+    diyFp mi;
+    if (v.f == DP_HIDDEN_BIT) {
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    } else {
+        mi.f = (v.f << 1) - 1;
+        mi.e = v.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+
+    *minus = mi;
+    *plus = pl;
+}
+
+/* Pick c = 10^-K such that the product with a number of binary exponent
+ * 'e' lands in the exponent window DigitGen expects. */
+static diyFp cachedPower(int e, int *K) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if (dk - k > 0.0) k++;
+
+    unsigned index = (unsigned)((k >> 3) + 1);
+    *K = -(-348 + (int)(index * 8));
+
+    diyFp r = {cachedPowersF[index], cachedPowersE[index]};
+    return r;
+}
+
+static void grisuRound(char *buf, int len, uint64_t delta, uint64_t rest,
+                       uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w ||
+            wp_w - rest > rest + ten_kappa - wp_w)) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int countDigits32(uint32_t n) {
+    int d = 1;
+    while (d < 10 && n >= (uint32_t)pow10u64[d]) d++;
+    return d;
+}
+
+/* Generate the shortest digits of W within the interval (Mp - delta, Mp]. */
+static void digitGen(diyFp W, diyFp Mp, uint64_t delta, char *buf, int *len, int *K) {
+    diyFp one = {1ULL << -Mp.e, Mp.e};
+    uint64_t wp_w = Mp.f - W.f;
+    uint32_t p1 = (uint32_t)(Mp.f >> -one.e);
+    uint64_t p2 = Mp.f & (one.f - 1);
+    int kappa = countDigits32(p1);
+    *len = 0;
+
+    while (kappa > 0) {
+        uint32_t div = (uint32_t)pow10u64[kappa - 1];
+        uint32_t d = p1 / div;
+        p1 %= div;
+        if (d || *len) buf[(*len)++] = (char)('0' + d);
+        kappa--;
+
+        uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+        if (tmp <= delta) {
+            *K += kappa;
+            grisuRound(buf, *len, delta, tmp, pow10u64[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || *len) buf[(*len)++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *K += kappa;
+            int index = -kappa;
+            grisuRound(buf, *len, delta, p2, one.f,
+                       wp_w * (index < 20 ? pow10u64[index] : 0));
+            return;
+        }
+    }
+}
+
+/* Shortest digits of a positive finite double: value = digits * 10^K. */
+static void grisu2(double value, char *buf, int *len, int *K) {
+    diyFp v = diyFromDouble(value);
+    diyFp w_m, w_p;
+    diyBoundaries(v, &w_m, &w_p);
+
+    diyFp c_mk = cachedPower(w_p.e, K);
+    diyFp W = diyMultiply(diyNormalize(v), c_mk);
+    diyFp Wp = diyMultiply(w_p, c_mk);
+    diyFp Wm = diyMultiply(w_m, c_mk);
+    Wm.f++;
+    Wp.f--;
+    digitGen(W, Wp, Wp.f - Wm.f, buf, len, K);
+}
+
+/* Lay out 'len' digits (already in buf) with decimal exponent 'k' and
+ * return the total length. Integral values keep a ".0" so they read back
+ * as doubles. */
+static size_t prettifyDouble(char *buf, int len, int k) {
+    int kk = len + k; /* 10^(kk-1) <= v < 10^kk */
+
+    if (k >= 0 && kk <= 21) {
+        /* 1234e7 -> 12340000000.0 */
+        memset(buf + len, '0', (size_t)k);
+        buf[kk] = '.';
+        buf[kk + 1] = '0';
+        return (size_t)kk + 2;
+    }
+    if (kk > 0 && kk <= 21) {
+        /* 1234e-2 -> 12.34 */
+        memmove(buf + kk + 1, buf + kk, (size_t)(len - kk));
+        buf[kk] = '.';
+        return (size_t)len + 1;
+    }
+    if (kk > -6 && kk <= 0) {
+        /* 1234e-6 -> 0.001234 */
+        int offset = 2 - kk;
+        memmove(buf + offset, buf, (size_t)len);
+        buf[0] = '0';
+        buf[1] = '.';
+        memset(buf + 2, '0', (size_t)(offset - 2));
+        return (size_t)(len + offset);
+    }
+
+    /* Exponent form: 1e30, 1.234e-7 */
+    size_t n;
+    if (len == 1) {
+        n = 1;
+    } else {
+        memmove(buf + 2, buf + 1, (size_t)(len - 1));
+        buf[1] = '.';
+        n = (size_t)len + 1;
+    }
+    buf[n++] = 'e';
+    int e = kk - 1;
+    if (e < 0) {
+        buf[n++] = '-';
+        e = -e;
+    }
+    return n + formatUint(buf + n, (uint64_t)e);
+}
+
+/* Format a double as the shortest text that reads back as the same value.
+ * Non-finite values have no JSON or TOON spelling and become null. 'buf'
+ * needs room for 32 bytes. */
+static size_t formatDouble(char *buf, double d) {
+    if (d != d || d - d != 0) {
+        memcpy(buf, "null", 4);
+        return 4;
+    }
+    if (d == 0) {
+        memcpy(buf, "0.0", 3);
+        return 3;
+    }
+
+    size_t n = 0;
+    if (d < 0) {
+        buf[n++] = '-';
+        d = -d;
+    }
+
+    int len, K;
+    grisu2(d, buf + n, &len, &K);
+    return n + prettifyDouble(buf + n, len, K);
+}
+
+FORCE_INLINE void writerInt(toonWriter *w, int v) {
+    char num[16];
+    writerPut(w, num, formatInt(num, v));
+}
+
+FORCE_INLINE void writerDouble(toonWriter *w, double d) {
+    char num[32];
+    writerPut(w, num, formatDouble(num, d));
+}
+
+/* -----------------------------------------------------------------------------
+ * Output and debugging functions
+ * -------------------------------------------------------------------------- */
+
+FORCE_INLINE void writerPuts(toonWriter *w, const char *s) {
+    writerPut(w, s, strlen(s));
+}
+
+/* Recursively write a TOON object tree in the debug format. */
+void TOONc_writeObject(toonWriter *w, toonObject *o, int depth) {
+    if (o == NULL) return;
+
+    /* Indent to show nesting level. */
+    writerIndent(w, depth);
+
+    if (o->key) {
+        writerPuts(w, o->key);
+        writerPut(w, ": ", 2);
+    }
 
     /* Print value based on type. */
     switch (o->kvtype) {
     case KV_STRING:
-        printf("\"%s\" (string)", o->str.ptr);
+        writerPutc(w, '"');
+        writerPut(w, o->str.ptr, o->str.len);
+        writerPuts(w, "\" (string)");
         break;
     case KV_INT:
-        printf("%d (integer)", o->i);
+        writerInt(w, o->i);
+        writerPuts(w, " (integer)");
         break;
     case KV_DOUBLE:
-        printf("%f (double)", o->d);
+        writerDouble(w, o->d);
+        writerPuts(w, " (double)");
         break;
     case KV_BOOL:
-        printf("%s (boolean)", o->boolean ? "true" : "false");
+        writerPuts(w, o->boolean ? "true (boolean)" : "false (boolean)");
         break;
     case KV_NULL:
-        printf("null (null)");
+        writerPuts(w, "null (null)");
         break;
     case KV_LIST:
-        printf("[");
+        writerPutc(w, '[');
         for (size_t i = 0; i < o->array.len; i++) {
             toonObject *item = o->array.items[i];
 
             switch (item->kvtype) {
                 case KV_STRING:
-                    printf("\"%s\"", item->str.ptr);
+                    writerPutc(w, '"');
+                    writerPut(w, item->str.ptr, item->str.len);
+                    writerPutc(w, '"');
                     break;
                 case KV_INT:
-                    printf("%d", item->i);
+                    writerInt(w, item->i);
                     break;
                 case KV_DOUBLE:
-                    printf("%f", item->d);
+                    writerDouble(w, item->d);
                     break;
                 case KV_BOOL:
-                    printf("%s", item->boolean ? "true" : "false");
+                    writerPuts(w, item->boolean ? "true" : "false");
                     break;
                 case KV_OBJ:
-                    printf("{...}");
+                    writerPuts(w, "{...}");
                     break;
                 default:
-                    printf("?");
+                    writerPutc(w, '?');
             }
-            if (i < o->array.len - 1) printf(", ");
+            if (i < o->array.len - 1) writerPut(w, ", ", 2);
         }
-        printf("] (array)");
+        writerPuts(w, "] (array)");
         break;
     case KV_OBJ:
-        printf("{ (object)");
+        writerPuts(w, "{ (object)");
         break;
     }
-    printf("\n");
+    writerPutc(w, '\n');
 
     /* Recursively print children (properties of this object). */
     if (o->child) 
-        printObject(o->child, depth + 1);
+        TOONc_writeObject(w, o->child, depth + 1);
 
     /* Close brace for objects. */
     if (o->kvtype == KV_OBJ && depth > 0) {
-        for (int i = 0; i < depth; i++) printf("  ");
-        printf("}\n");
+        writerIndent(w, depth);
+        writerPut(w, "}\n", 2);
     }
     
     /* Print siblings at the same level. */
     if (o->next) {
-        printObject(o->next, depth);
+        TOONc_writeObject(w, o->next, depth);
     }
 }
 
+/* Recursively print a TOON object tree for debugging. */
+void printObject(toonObject *o, int depth) {
+    toonWriter w;
+    TOONc_writerInitFile(&w, stdout);
+    TOONc_writeObject(&w, o, depth);
+    TOONc_writerFree(&w);
+}
+
 /* Print from the root (skip the root object itself). */
 void printRoot(toonObject *root) {
     if (root && root->child) {
@@ -1036,64 +2760,3747 @@ void printRoot(toonObject *root) {
     }
 }
 
-/* Convert a TOON object to JSON format. */
-void TOONc_toJSON(toonObject *obj, FILE *fp, int depth) {
-    if (!obj || !fp) return;
+/* JSON escapes per byte: 0 copies the byte as is, 'u' means \u00XX, any
+ * other value is the letter of a two-character escape. Bytes >= 0x80 are
+ * UTF-8 and pass through untouched. */
+static const char jsonEscape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"',
+    ['\\'] = '\\',
+};
+
+/* Return the index of the first byte of 's' that needs escaping, or 'len'
+ * if there is none. With SSE2 this checks 16 bytes per step, which is the
+ * whole story for the usual escape-free string. */
+FORCE_INLINE size_t jsonScanClean(const char *s, size_t len) {
+    size_t i = 0;
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        /* max(v, 0x1F) == 0x1F  <=>  v <= 0x1F (unsigned) */
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (jsonEscape[(unsigned char)s[i]]) return i;
+    }
+    return len;
+}
+
+/* Write 's' as a quoted JSON string. Clean runs are bulk-copied; only the
+ * bytes that need it are escaped. */
+static void jsonWriteString(toonWriter *w, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+
+    writerPutc(w, '"');
+    while (len > 0) {
+        size_t n = jsonScanClean(s, len);
+        writerPut(w, s, n);
+        if (n == len) break;
+
+        unsigned char c = (unsigned char)s[n];
+        char esc = jsonEscape[c];
+        if (esc == 'u') {
+            char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            writerPut(w, u, 6);
+        } else {
+            char e[2] = {'\\', esc};
+            writerPut(w, e, 2);
+        }
+        s += n + 1;
+        len -= n + 1;
+    }
+    writerPutc(w, '"');
+}
+
+/* Write a TOON object as JSON. Pretty output puts every member on its own
+ * line with two-space indentation; TOON_JSON_COMPACT drops all whitespace. */
+void TOONc_writeJSON(toonWriter *w, toonObject *obj, int depth, int flags) {
+    if (!obj) return;
+
+    int pretty = !(flags & TOON_JSON_COMPACT);
     
     /* Indent for readability. */
-    for (int i = 0; i < depth; i++) fprintf(fp, "  ");
+    if (pretty) writerIndent(w, depth);
     
     /* Print key if this is a property. */
     if (obj->key) {
-        fprintf(fp, "\"%s\": ", obj->key);
+        jsonWriteString(w, obj->key, strlen(obj->key));
+        if (pretty) writerPut(w, ": ", 2);
+        else writerPutc(w, ':');
     }
     
     /* Print value based on type. */
     switch (obj->kvtype) {
         case KV_STRING:
-            fprintf(fp, "\"%s\"", obj->str.ptr);
+            jsonWriteString(w, obj->str.ptr, obj->str.len);
             break;
         case KV_INT:
-            fprintf(fp, "%d", obj->i);
+            writerInt(w, obj->i);
             break;
         case KV_DOUBLE:
-            fprintf(fp, "%f", obj->d);
+            writerDouble(w, obj->d);
             break;
         case KV_BOOL:
-            fprintf(fp, "%s", obj->boolean ? "true" : "false");
+            writerPuts(w, obj->boolean ? "true" : "false");
             break;
         case KV_NULL:
-            fprintf(fp, "null");
+            writerPut(w, "null", 4);
             break;
         case KV_LIST:
             /* Arrays are enclosed in brackets. */
-            fprintf(fp, "[\n");
+            writerPutc(w, '[');
+            if (pretty) writerPutc(w, '\n');
             for (size_t i = 0; i < obj->array.len; i++) {
-                TOONc_toJSON(obj->array.items[i], fp, depth + 1);
-                if (i < obj->array.len - 1) fprintf(fp, ",");
-                fprintf(fp, "\n");
+                TOONc_writeJSON(w, obj->array.items[i], depth + 1, flags);
+                if (i < obj->array.len - 1) writerPutc(w, ',');
+                if (pretty) writerPutc(w, '\n');
             }
-            for (int i = 0; i < depth; i++) fprintf(fp, "  ");
-            fprintf(fp, "]");
+            if (pretty) writerIndent(w, depth);
+            writerPutc(w, ']');
             break;
         case KV_OBJ:
             /* Objects are enclosed in braces. */
-            fprintf(fp, "{\n");
-            if (obj->child) {
-                toonObject *child = obj->child;
-                while (child) {
-                    TOONc_toJSON(child, fp, depth + 1);
-                    if (child->next) fprintf(fp, ",");
-                    fprintf(fp, "\n");
-                    child = child->next;
-                }
+            writerPutc(w, '{');
+            if (pretty) writerPutc(w, '\n');
+            for (toonObject *child = obj->child; child; child = child->next) {
+                TOONc_writeJSON(w, child, depth + 1, flags);
+                if (child->next) writerPutc(w, ',');
+                if (pretty) writerPutc(w, '\n');
             }
-            for (int i = 0; i < depth; i++) fprintf(fp, "  ");
-            fprintf(fp, "}");
+            if (pretty) writerIndent(w, depth);
+            writerPutc(w, '}');
             break;
     }
 }
 
+/* Convert a TOON object to JSON format. */
+void TOONc_toJSON(toonObject *obj, FILE *fp, int depth) {
+    if (!obj || !fp) return;
+
+    toonWriter w;
+    TOONc_writerInitFile(&w, fp);
+    TOONc_writeJSON(&w, obj, depth, TOON_JSON_PRETTY);
+    TOONc_writerFree(&w);
+}
+
+/* Write JSON straight into a caller-supplied buffer. '*needed' always
+ * receives the exact output length (excluding the NUL), so on overflow the
+ * caller can allocate needed + 1 bytes and call again. Returns 0 when the
+ * output fit (and was NUL-terminated), -1 otherwise. */
+int TOONc_toJSONBuffer(toonObject *obj, char *buf, size_t cap, size_t *needed, int flags) {
+    toonWriter w;
+    TOONc_writerInitBuffer(&w, buf, cap);
+    TOONc_writeJSON(&w, obj, 0, flags);
+
+    size_t total = w.len + w.written;
+    if (needed) *needed = total;
+    if (w.error) return -1;
+
+    buf[w.len] = '\0';
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * Output size precomputation
+ *
+ * These return the exact number of bytes an emitter would produce, so
+ * callers can allocate once and fill the buffer in a single pass (see
+ * TOONc_toJSONBuffer / TOONc_toTOONBuffer). JSON is measured by walking
+ * the tree and adding up lengths; only doubles need to be formatted, on
+ * the stack. TOON's layout decisions (tables, quoting, list items) live in
+ * the encoder, so it is measured by running the encoder against a counting
+ * sink that discards everything it is given.
+ * -------------------------------------------------------------------------- */
+
+static size_t uintLength(uint64_t v) {
+    size_t n = 1;
+    while (v >= 100) {
+        v /= 100;
+        n += 2;
+    }
+    return v >= 10 ? n + 1 : n;
+}
+
+static size_t intLength(int v) {
+    if (v < 0) return 1 + uintLength((uint64_t)(-(int64_t)v));
+    return uintLength((uint64_t)v);
+}
+
+/* Length of 's' once quoted and escaped by jsonWriteString(). */
+static size_t jsonStringLength(const char *s, size_t len) {
+    size_t n = len + 2;
+    while (len > 0) {
+        size_t i = jsonScanClean(s, len);
+        if (i == len) break;
+        n += jsonEscape[(unsigned char)s[i]] == 'u' ? 5 : 1;
+        s += i + 1;
+        len -= i + 1;
+    }
+    return n;
+}
+
+/* Mirror of TOONc_writeJSON() that only counts. */
+static size_t jsonMeasure(toonObject *obj, int depth, int pretty) {
+    size_t n = pretty ? (size_t)depth * 2 : 0;
+    char num[32];
+
+    if (obj->key)
+        n += jsonStringLength(obj->key, strlen(obj->key)) + (pretty ? 2 : 1);
+
+    switch (obj->kvtype) {
+    case KV_STRING:
+        n += jsonStringLength(obj->str.ptr, obj->str.len);
+        break;
+    case KV_INT:
+        n += intLength(obj->i);
+        break;
+    case KV_DOUBLE:
+        n += formatDouble(num, obj->d);
+        break;
+    case KV_BOOL:
+        n += obj->boolean ? 4 : 5;
+        break;
+    case KV_NULL:
+        n += 4;
+        break;
+    case KV_LIST:
+        /* "[" "]", per item: value, ',' unless last, '\n' when pretty */
+        n += 2;
+        if (pretty) n += 1 + (size_t)depth * 2 + obj->array.len;
+        for (size_t i = 0; i < obj->array.len; i++)
+            n += jsonMeasure(obj->array.items[i], depth + 1, pretty);
+        if (obj->array.len > 0) n += obj->array.len - 1;
+        break;
+    case KV_OBJ:
+        n += 2;
+        if (pretty) n += 1 + (size_t)depth * 2;
+        for (toonObject *child = obj->child; child; child = child->next) {
+            n += jsonMeasure(child, depth + 1, pretty);
+            if (child->next) n++;
+            if (pretty) n++;
+        }
+        break;
+    }
+    return n;
+}
+
+/* Exact size of TOONc_writeJSON(w, obj, 0, flags) output. */
+size_t TOONc_measureJSON(toonObject *obj, int flags) {
+    if (!obj) return 0;
+    return jsonMeasure(obj, 0, !(flags & TOON_JSON_COMPACT));
+}
+
+/* Exact size of TOONc_writeTOON(w, obj) output. */
+size_t TOONc_measureTOON(toonObject *obj) {
+    char scratch[4096];
+    toonWriter w;
+    memset(&w, 0, sizeof(w));
+    w.sink = TOON_SINK_COUNT;
+    w.fd = -1;
+    w.buf = scratch;
+    w.cap = sizeof(scratch);
+
+    TOONc_writeTOON(&w, obj);
+    return w.written + w.len;
+}
+
+/* -----------------------------------------------------------------------------
+ * TOON encoder
+ *
+ * Writes a tree back out as TOON. Output goes through a toonWriter, so
+ * encoding a prompt payload costs memcpy appends and no per-token stdio
+ * calls. Arrays are emitted in the most compact form that fits:
+ *
+ *   key[N]: a,b,c              arrays of primitives
+ *   key[N]{col1,col2}:         uniform arrays of flat objects (tables)
+ *     1,Blue Lake
+ *   key[N]:                    everything else, one "- " item per line
+ *     - name: x
+ *
+ * Strings and keys are quoted only when reading them back unquoted would
+ * change their meaning.
+ * -------------------------------------------------------------------------- */
+
+FORCE_INLINE int isPrimitive(const toonObject *o) {
+    return o->kvtype != KV_OBJ && o->kvtype != KV_LIST;
+}
+
+/* Keys matching [A-Za-z_][A-Za-z0-9_.]* can be written bare. */
+static int isBareKey(const char *s, size_t len) {
+    if (len == 0) return 0;
+    if (!(isalpha((unsigned char)s[0]) || s[0] == '_')) return 0;
+    for (size_t i = 1; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (!(isalnum(c) || c == '_' || c == '.')) return 0;
+    }
+    return 1;
+}
+
+/* A string value needs quotes if unquoted it would read back as something
+ * else: empty, padded, a literal or number, or containing structural
+ * characters (including the ',' delimiter and '#' comments). */
+static int needsQuotes(const char *s, size_t len) {
+    if (len == 0) return 1;
+    if (isspace((unsigned char)s[0]) || isspace((unsigned char)s[len - 1]))
+        return 1;
+    if (s[0] == '-') return 1;
+    if ((len == 4 && (memcmp(s, "true", 4) == 0 || memcmp(s, "null", 4) == 0)) ||
+        (len == 5 && memcmp(s, "false", 5) == 0))
+        return 1;
+
+    int is_float;
+    if (isNumber((char *)s, len, &is_float)) return 1;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 0x20 || c == ',' || c == ':' || c == '"' || c == '\\' ||
+            c == '[' || c == ']' || c == '{' || c == '}' || c == '#')
+            return 1;
+    }
+    return 0;
+}
+
+/* Write a quoted string with the TOON escapes (\\ \" \n \r \t). TOON has
+ * no escape for the other control bytes, so they take JSON's \u00XX form
+ * rather than going out raw. Clean runs between escapes are copied in one
+ * go. */
+static void toonWriteQuoted(toonWriter *w, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    writerPutc(w, '"');
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        char esc;
+        switch (c) {
+        case '"':  esc = '"'; break;
+        case '\\': esc = '\\'; break;
+        case '\n': esc = 'n'; break;
+        case '\r': esc = 'r'; break;
+        case '\t': esc = 't'; break;
+        default:
+            if (c >= 0x20) continue;
+            esc = 'u';
+            break;
+        }
+        writerPut(w, s + run, i - run);
+        if (esc == 'u') {
+            char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            writerPut(w, u, 6);
+        } else {
+            char e[2] = {'\\', esc};
+            writerPut(w, e, 2);
+        }
+        run = i + 1;
+    }
+    writerPut(w, s + run, len - run);
+    writerPutc(w, '"');
+}
+
+static void toonWriteKey(toonWriter *w, const char *key) {
+    size_t len = strlen(key);
+    if (isBareKey(key, len))
+        writerPut(w, key, len);
+    else
+        toonWriteQuoted(w, key, len);
+}
+
+static void toonWriteScalar(toonWriter *w, toonObject *o) {
+    switch (o->kvtype) {
+    case KV_STRING:
+        if (needsQuotes(o->str.ptr, o->str.len))
+            toonWriteQuoted(w, o->str.ptr, o->str.len);
+        else
+            writerPut(w, o->str.ptr, o->str.len);
+        break;
+    case KV_INT:
+        writerInt(w, o->i);
+        break;
+    case KV_DOUBLE:
+        writerDouble(w, o->d);
+        break;
+    case KV_BOOL:
+        if (o->boolean) writerPut(w, "true", 4);
+        else writerPut(w, "false", 5);
+        break;
+    default:
+        writerPut(w, "null", 4);
+        break;
+    }
+}
+
+/* Find the property of 'row' named 'key'. Rows of a table usually list
+ * their keys in the same order as the header, so 'hint' (the property at
+ * the same position) is checked before falling back to a scan. */
+static toonObject *rowLookup(toonObject *row, toonObject *hint, const char *key) {
+    if (hint && hint->key && strcmp(hint->key, key) == 0) return hint;
+    for (toonObject *c = row->child; c; c = c->next) {
+        if (c->key && strcmp(c->key, key) == 0) return c;
+    }
+    return NULL;
+}
+
+/* A table's first row fixes the columns: it must be a non-empty object
+ * whose values are all primitives. */
+static int isTableHead(toonObject *first) {
+    if (first->kvtype != KV_OBJ || first->child == NULL) return 0;
+    for (toonObject *c = first->child; c; c = c->next) {
+        if (!c->key || !isPrimitive(c)) return 0;
+    }
+    return 1;
+}
+
+/* Later rows need the same set of keys as 'first' and primitive values. */
+static int isTableRow(toonObject *first, toonObject *row) {
+    if (row->kvtype != KV_OBJ) return 0;
+
+    size_t ncols = 0, count = 0;
+    for (toonObject *c = first->child; c; c = c->next) ncols++;
+    for (toonObject *c = row->child; c; c = c->next) {
+        if (!c->key || !isPrimitive(c)) return 0;
+        count++;
+    }
+    if (count != ncols) return 0;
+
+    toonObject *hint = row->child;
+    for (toonObject *c = first->child; c; c = c->next) {
+        if (!rowLookup(row, hint, c->key)) return 0;
+        if (hint) hint = hint->next;
+    }
+    return 1;
+}
+
+/* An array can be written as a table if every item is an object with the
+ * same set of keys as the first, and every value is a primitive. */
+static int isTabular(toonObject *list) {
+    if (list->array.len == 0) return 0;
+
+    toonObject *first = list->array.items[0];
+    if (!isTableHead(first)) return 0;
+
+    for (size_t i = 1; i < list->array.len; i++) {
+        if (!isTableRow(first, list->array.items[i])) return 0;
+    }
+    return 1;
+}
+
+static int isPrimitiveArray(toonObject *list) {
+    for (size_t i = 0; i < list->array.len; i++) {
+        if (!isPrimitive(list->array.items[i])) return 0;
+    }
+    return 1;
+}
+
+/* What TOONc_writeTOONSpans() copies from: the span map and its flags.
+ * The TOON encoders take NULL when there is nothing to copy. */
+typedef struct toonSpanCopy {
+    const toonSpanMap *map;
+    int flags;
+} toonSpanCopy;
+
+/* Copy the source lines of 'o' (a member or a table row) in place of
+ * encoding it, if nothing in it changed since the parse and its first line
+ * is indented exactly as the encoder would indent it at 'depth', so the
+ * copy nests the same way in the new text. 'indented' tells whether the
+ * indentation is already written. */
+static int toonCopySpan(toonWriter *w, const toonSpanCopy *sc, const toonObject *o,
+        int depth, int indented) {
+    const toonSpanMap *m = sc->map;
+    const toonSpan *sp = spanUnchanged(m, o, sc->flags);
+    if (!sp) return 0;
+
+    const char *text = m->text;
+    size_t start = sp->start, end = sp->end;
+    size_t ind = (size_t)depth * 2;
+    if (start > 0 && text[start - 1] != '\n') return 0;
+    if (end - start <= ind) return 0;
+    for (size_t i = 0; i < ind; i++) {
+        if (text[start + i] != ' ') return 0;
+    }
+    if (text[start + ind] == ' ' || text[start + ind] == '\t') return 0;
+
+    if (indented) start += ind;
+    writerPut(w, text + start, end - start);
+    if (text[end - 1] != '\n') writerPutc(w, '\n');
+    return 1;
+}
+
+static void toonWriteFields(toonWriter *w, const toonSpanCopy *sc, toonObject *first,
+        int depth);
+static void toonWriteArray(toonWriter *w, const toonSpanCopy *sc, toonObject *list,
+        int depth);
+static void toonWriteArrayBody(toonWriter *w, const toonSpanCopy *sc, toonObject *list,
+        int depth);
+
+static void toonWriteCount(toonWriter *w, size_t len) {
+    char num[24];
+    num[0] = '[';
+    size_t n = 1 + formatUint(num + 1, len);
+    num[n++] = ']';
+    writerPut(w, num, n);
+}
+
+/* Write the "{col1,col2}:" table header taken from the first row. */
+static void toonWriteTableHead(toonWriter *w, toonObject *first) {
+    writerPutc(w, '{');
+    for (toonObject *c = first->child; c; c = c->next) {
+        toonWriteKey(w, c->key);
+        if (c->next) writerPutc(w, ',');
+    }
+    writerPut(w, "}:\n", 3);
+}
+
+/* Write one table row, cells in the header's column order. */
+static void toonWriteRow(toonWriter *w, toonObject *first, toonObject *row, int depth) {
+    toonObject *hint = row->child;
+    writerIndent(w, depth + 1);
+    for (toonObject *c = first->child; c; c = c->next) {
+        toonObject *cell = rowLookup(row, hint, c->key);
+        toonWriteScalar(w, cell);
+        if (c->next) writerPutc(w, ',');
+        if (hint) hint = hint->next;
+    }
+    writerPutc(w, '\n');
+}
+
+/* Write one "- " item of an expanded list. */
+static void toonWriteListItem(toonWriter *w, const toonSpanCopy *sc, toonObject *item,
+        int depth) {
+    writerIndent(w, depth + 1);
+
+    if (isPrimitive(item)) {
+        writerPut(w, "- ", 2);
+        toonWriteScalar(w, item);
+        writerPutc(w, '\n');
+    } else if (item->kvtype == KV_LIST) {
+        writerPut(w, "- ", 2);
+        toonWriteArrayBody(w, sc, item, depth + 1);
+    } else if (item->child == NULL) {
+        writerPut(w, "-\n", 2);
+    } else {
+        /* The first field shares the hyphen line; the rest line up
+         * underneath it. */
+        writerPut(w, "- ", 2);
+        toonWriteFields(w, sc, item->child, depth + 2);
+    }
+}
+
+/* Write "[N]" plus the table header if any, then the array body. The key
+ * (if any) has already been written. */
+static void toonWriteArrayBody(toonWriter *w, const toonSpanCopy *sc, toonObject *list,
+        int depth) {
+    size_t len = list->array.len;
+    toonWriteCount(w, len);
+
+    if (len == 0) {
+        writerPut(w, ":\n", 2);
+        return;
+    }
+
+    if (isPrimitiveArray(list)) {
+        writerPut(w, ": ", 2);
+        for (size_t i = 0; i < len; i++) {
+            if (i) writerPutc(w, ',');
+            toonWriteScalar(w, list->array.items[i]);
+        }
+        writerPutc(w, '\n');
+        return;
+    }
+
+    if (isTabular(list)) {
+        toonObject *first = list->array.items[0];
+        /* Source rows list their cells in the header's order, which is
+         * the first row's as long as that row is unchanged. */
+        int copy_rows = sc && spanUnchanged(sc->map, first, sc->flags);
+        toonWriteTableHead(w, first);
+        for (size_t i = 0; i < len; i++) {
+            toonObject *row = list->array.items[i];
+            if (copy_rows && toonCopySpan(w, sc, row, depth + 1, 0)) continue;
+            toonWriteRow(w, first, row, depth);
+        }
+        return;
+    }
+
+    /* Expanded list: one "- " item per line. */
+    writerPut(w, ":\n", 2);
+    for (size_t i = 0; i < len; i++)
+        toonWriteListItem(w, sc, list->array.items[i], depth);
+}
+
+/* Write one "key: value" property (and its nested content). The
+ * indentation for the first line has already been written. */
+static void toonWriteField(toonWriter *w, const toonSpanCopy *sc, toonObject *o,
+        int depth) {
+    if (UNLIKELY(sc != NULL) && o->key && toonCopySpan(w, sc, o, depth, 1))
+        return;
+    if (o->key) toonWriteKey(w, o->key);
+
+    switch (o->kvtype) {
+    case KV_OBJ:
+        writerPut(w, ":\n", 2);
+        if (o->child) {
+            writerIndent(w, depth + 1);
+            toonWriteFields(w, sc, o->child, depth + 1);
+        }
+        break;
+    case KV_LIST:
+        toonWriteArrayBody(w, sc, o, depth);
+        break;
+    default:
+        writerPut(w, ": ", 2);
+        toonWriteScalar(w, o);
+        writerPutc(w, '\n');
+        break;
+    }
+}
+
+/* Write a sibling chain of properties. The first line's indentation is
+ * already in place, which lets list items put their first field right
+ * after the "- " marker. */
+static void toonWriteFields(toonWriter *w, const toonSpanCopy *sc, toonObject *first,
+        int depth) {
+    for (toonObject *o = first; o; o = o->next) {
+        if (o != first) writerIndent(w, depth);
+        toonWriteField(w, sc, o, depth);
+    }
+}
+
+static void toonWriteArray(toonWriter *w, const toonSpanCopy *sc, toonObject *list,
+        int depth) {
+    writerIndent(w, depth);
+    if (list->key) toonWriteKey(w, list->key);
+    toonWriteArrayBody(w, sc, list, depth);
+}
+
+/* Encode 'obj', copying unchanged subtrees from the source if 'sc' is set. */
+static void toonWriteTree(toonWriter *w, const toonSpanCopy *sc, toonObject *obj) {
+    if (obj->key) {
+        toonWriteField(w, sc, obj, 0);
+    } else if (obj->kvtype == KV_OBJ) {
+        if (obj->child) toonWriteFields(w, sc, obj->child, 0);
+    } else if (obj->kvtype == KV_LIST) {
+        toonWriteArray(w, sc, obj, 0);
+    } else {
+        toonWriteScalar(w, obj);
+        writerPutc(w, '\n');
+    }
+}
+
+/* Encode a tree as TOON. A keyless object (such as the parser's root) is
+ * written as a document of its properties; a keyless array becomes a root
+ * array ("[N]: ..."); anything with a key is written as a single field. */
+void TOONc_writeTOON(toonWriter *w, toonObject *obj) {
+    if (!obj) return;
+    toonWriteTree(w, NULL, obj);
+}
+
+/* Like TOONc_writeTOON(), but subtrees unchanged since the parse that
+ * filled 'spans' are copied from its text, comments and formatting
+ * included, and only what changed is encoded. A tree that wasn't changed
+ * at all comes out as the text it was parsed from. */
+void TOONc_writeTOONSpans(toonWriter *w, toonObject *obj, const toonSpanMap *spans,
+        int flags) {
+    if (!obj) return;
+
+    if (spans && !obj->key && obj->kvtype == KV_OBJ &&
+        spanUnchanged(spans, obj, flags) && spans->len) {
+        writerPut(w, spans->text, spans->len);
+        if (spans->text[spans->len - 1] != '\n') writerPutc(w, '\n');
+        return;
+    }
+
+    toonSpanCopy sc = {spans, flags};
+    toonWriteTree(w, spans ? &sc : NULL, obj);
+}
+
+/* TOON counterpart of TOONc_toJSONBuffer(). */
+int TOONc_toTOONBuffer(toonObject *obj, char *buf, size_t cap, size_t *needed) {
+    toonWriter w;
+    TOONc_writerInitBuffer(&w, buf, cap);
+    TOONc_writeTOON(&w, obj);
+
+    size_t total = w.len + w.written;
+    if (needed) *needed = total;
+    if (w.error) return -1;
+
+    buf[w.len] = '\0';
+    return 0;
+}
+
+/* Encode an object tree as a NUL-terminated TOON string. The caller owns
+ * the result and releases it with free(). */
+char *TOONc_toTOON(toonObject *obj, size_t *len) {
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    TOONc_writeTOON(&w, obj);
+    return TOONc_writerRelease(&w, len);
+}
+
+/* -----------------------------------------------------------------------------
+ * Streaming TOON to JSON
+ *
+ * Transcodes TOON read from a FILE straight into JSON without building a
+ * tree. Only the current line, the indentation stack (one int pair per open
+ * object) and the column names of the table being read are held in memory,
+ * so documents far larger than RAM stream through at roughly the speed of
+ * the reader and the writer.
+ *
+ * The same primitives as parse() are applied to one line at a time, and
+ * values are classified in place by scanValue(), so the output is byte for
+ * byte what TOONc_writeJSON() produces for TOONc_parseFile() on the same
+ * input, diagnostics included. Because nothing is buffered, JSON for the
+ * document head is already written when an error is found later on.
+ * -------------------------------------------------------------------------- */
+
+#define TOON_STREAM_CHUNK (64 * 1024)
+#define TOON_STREAM_MAX_DEPTH 64
+
+typedef struct toonStream {
+    FILE *in;
+    char *chunk;            /* Raw input read with fread(). */
+    size_t pos, avail;
+    char *line;             /* Current line, with its '\n' and a NUL. */
+    size_t cap;
+    int eof;
+    toonParser parser;      /* Points into 'line'. */
+    toonWriter *w;
+    int pretty;
+    struct {
+        int indent;
+        int has_children;
+    } stack[TOON_STREAM_MAX_DEPTH];
+    int depth;              /* Open objects, the root included. */
+} toonStream;
+
+/* Load the next line into s->line. Returns 0 at end of input. */
+static int streamReadLine(toonStream *s) {
+    size_t len = 0;
+
+    for (;;) {
+        if (s->pos == s->avail) {
+            if (s->eof) break;
+            s->avail = fread(s->chunk, 1, TOON_STREAM_CHUNK, s->in);
+            s->pos = 0;
+            if (s->avail < TOON_STREAM_CHUNK) s->eof = 1;
+            if (s->avail == 0) break;
+        }
+
+        char *from = s->chunk + s->pos;
+        size_t n = s->avail - s->pos;
+        char *nl = memchr(from, '\n', n);
+        if (nl) n = nl - from + 1;
+
+        if (len + n + 1 > s->cap) {
+            while (len + n + 1 > s->cap) s->cap *= 2;
+            s->line = trealloc(s->line, s->cap);
+        }
+        memcpy(s->line + len, from, n);
+        len += n;
+        s->pos += n;
+        if (nl) break;
+    }
+
+    s->line[len] = '\0';
+    s->parser.source = s->parser.p = s->line;
+    return len != 0;
+}
+
+/* Stream counterpart of parseNewLine(): consuming the '\n' moves the parser
+ * on to the next line, or to an empty one at end of input. */
+static void streamNewLine(toonStream *s) {
+    if (s->parser.p[0] != '\n') return;
+    s->parser.line++;
+    if (!streamReadLine(s)) s->parser.p = s->line;
+}
+
+static void streamSkipLine(toonStream *s) {
+    while (s->parser.p[0] && s->parser.p[0] != '\n')
+        s->parser.p++;
+    streamNewLine(s);
+}
+
+static void streamScalar(toonWriter *w, const toonObject *v) {
+    switch (v->kvtype) {
+    case KV_STRING: jsonWriteString(w, v->str.ptr, v->str.len); break;
+    case KV_INT:    writerInt(w, v->i); break;
+    case KV_DOUBLE: writerDouble(w, v->d); break;
+    case KV_BOOL:   writerPuts(w, v->boolean ? "true" : "false"); break;
+    default:        writerPut(w, "null", 4); break;
+    }
+}
+
+/* Start a member or element inside a container: separate it from the
+ * previous one and indent it. */
+static void streamItem(toonStream *s, int *has_items, int depth) {
+    if (*has_items) writerPutc(s->w, ',');
+    if (s->pretty) {
+        writerPutc(s->w, '\n');
+        writerIndent(s->w, depth);
+    }
+    *has_items = 1;
+}
+
+/* Close a container opened at 'depth' with '{' or '['. */
+static void streamClose(toonStream *s, int depth, char c) {
+    if (s->pretty) {
+        writerPutc(s->w, '\n');
+        writerIndent(s->w, depth);
+    }
+    writerPutc(s->w, c);
+}
+
+static void streamKey(toonStream *s, const char *key, size_t len) {
+    jsonWriteString(s->w, key, len);
+    if (s->pretty) writerPut(s->w, ": ", 2);
+    else writerPutc(s->w, ':');
+}
+
+/* Inline list: key[N]: a,b,c (see parseListValues). */
+static void streamList(toonStream *s, int depth) {
+    toonParser *parser = &s->parser;
+    int has_items = 0;
+    toonObject v;
+
+    writerPutc(s->w, '[');
+    while (parser->p[0] && parser->p[0] != '\n') {
+        if (scanValue(parser, &v)) {
+            streamItem(s, &has_items, depth + 1);
+            streamScalar(s->w, &v);
+        }
+        if (LIKELY(parser->p[0] == ',')) parser->p++;
+        else break;
+    }
+    if (parser->p[0] == '#') {
+        while (parser->p[0] && parser->p[0] != '\n')
+            parser->p++;
+    }
+    streamClose(s, depth, ']');
+}
+
+/* Table rows following key[N]{cols}: (see parseTableRows). Each row is
+ * written as soon as its line has been read. */
+static void streamTable(toonStream *s, char **columns, int col_count,
+        int expected_rows, int depth) {
+    toonParser *parser = &s->parser;
+    int has_rows = 0;
+    toonObject v;
+
+    writerPutc(s->w, '[');
+    for (int row = 0; row < expected_rows; row++) {
+        streamNewLine(s);
+
+        if (isCommentOrEmpty(parser)) {
+            streamSkipLine(s);
+            continue;
+        }
+        if (parser->p[0] == '\0')
+            break;
+        parseSpaces(parser);
+
+        streamItem(s, &has_rows, depth + 1);
+        writerPutc(s->w, '{');
+
+        int has_cells = 0;
+        for (int col = 0; col < col_count; col++) {
+            if (scanValue(parser, &v)) {
+                streamItem(s, &has_cells, depth + 2);
+                streamKey(s, columns[col], strlen(columns[col]));
+                streamScalar(s->w, &v);
+            }
+            if (col < col_count - 1 && parser->p[0] == ',')
+                parser->p++;
+        }
+        streamClose(s, depth + 1, '}');
+    }
+    streamClose(s, depth, ']');
+}
+
+/* Transcode TOON from 'in' to JSON on 'out'. Returns 0 on success, or -1 if
+ * reading or writing failed or a strict parse was aborted. The writer is
+ * flushed but not freed. */
+int TOONc_transcodeTOONToJSON(FILE *in, toonWriter *out, int flags,
+        const toonParseOptions *opts) {
+    if (!in || !out) return -1;
+
+    toonStream s;
+    s.in = in;
+    s.chunk = tmalloc(TOON_STREAM_CHUNK);
+    s.pos = s.avail = 0;
+    s.cap = 256;
+    s.line = tmalloc(s.cap);
+    s.eof = 0;
+    s.w = out;
+    s.pretty = !(flags & TOON_JSON_COMPACT);
+    s.stack[0].indent = 0;
+    s.stack[0].has_children = 0;
+    s.depth = 1;
+
+    toonParser *parser = &s.parser;
+    parser->line = 1;
+    parser->opts = opts;
+    parser->errors = 0;
+    parser->aborted = 0;
+    parser->ragged = 0;
+    parser->spans = NULL;   /* Lines aren't kept, so there's nothing to point at */
+
+    writerPutc(out, '{');
+    if (!streamReadLine(&s)) parser->p = s.line;
+
+    while (parser->p[0] && !parser->aborted) {
+        if (UNLIKELY(isCommentOrEmpty(parser))) {
+            streamSkipLine(&s);
+            continue;
+        }
+
+        int indent = parseIndent(parser);
+
+        size_t keylen;
+        char *key = parseKey(parser, &keylen);
+        if (keylen == 0) {
+            streamSkipLine(&s);
+            continue;
+        }
+
+        int array_size = parseArraySize(parser);
+
+        int col_count = 0;
+        char **columns = NULL;
+        if (parser->p[0] == '{')
+            columns = parseTableColumns(parser, &col_count);
+
+        if (parser->p[0] != ':') {
+            parseError(parser, TOON_ERR_EXPECTED_COLON, parser->p);
+            if (columns) {
+                for (int i = 0; i < col_count; i++) tfree(columns[i]);
+                tfree(columns);
+            }
+            streamSkipLine(&s);
+            continue;
+        }
+        parser->p++; /* Skip ':' */
+
+        /* Close the objects this line is no longer nested in. Members come
+         * out in document order, which is also the tree's depth-first order,
+         * so the parent is always the innermost object still open. */
+        while (s.depth > 1 && s.stack[s.depth - 1].indent >= indent) {
+            s.depth--;
+            streamClose(&s, s.depth, '}');
+        }
+
+        int depth = s.depth;
+        streamItem(&s, &s.stack[depth - 1].has_children, depth);
+        streamKey(&s, key, keylen);
+
+        toonObject v;
+        if (columns) {
+            streamTable(&s, columns, col_count, array_size, depth);
+            for (int i = 0; i < col_count; i++) tfree(columns[i]);
+            tfree(columns);
+        } else if (array_size >= 0) {
+            streamList(&s, depth);
+        } else if (scanValue(parser, &v)) {
+            streamScalar(out, &v);
+        } else {
+            /* Nested object: left open until a shallower line closes it. */
+            writerPutc(out, '{');
+            if (depth < TOON_STREAM_MAX_DEPTH) {
+                s.stack[depth].indent = indent;
+                s.stack[depth].has_children = 0;
+                s.depth++;
+            } else {
+                parseError(parser, TOON_ERR_MAX_DEPTH, key);
+                streamClose(&s, depth, '}');
+            }
+        }
+
+        if (parser->p[0] == '\n') {
+            streamNewLine(&s);
+        } else if (parser->p[0] == '\0') {
+            break;
+        } else {
+            parseError(parser, TOON_ERR_UNEXPECTED_CHAR, parser->p);
+            parser->p++;
+        }
+    }
+
+    while (s.depth > 0) {
+        s.depth--;
+        streamClose(&s, s.depth, '}');
+    }
+
+    int failed = ferror(in) || parser->aborted;
+    tfree(s.chunk);
+    tfree(s.line);
+
+    if (TOONc_writerFlush(out) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * JSON parsing
+ *
+ * A recursive descent parser for RFC 8259 JSON that builds the same trees
+ * as the TOON parser: objects become KV_OBJ nodes with keyed children,
+ * arrays become KV_LIST, integers that fit an int become KV_INT and every
+ * other number a KV_DOUBLE. The input does not need to be NUL-terminated.
+ *
+ * The hot paths avoid per-byte work where they can: strings without
+ * escapes are found with the same scan the JSON emitter uses (16 bytes per
+ * step on SSE2) and copied with a single memcpy,
+ * integers are accumulated inline, and only numbers with a fraction or an
+ * exponent go through strtod(). Unlike TOON, JSON errors are not
+ * recoverable: the first one is reported and the parse returns NULL.
+ * -------------------------------------------------------------------------- */
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct jsonParser {
+    const char *start;
+    const char *p;
+    const char *end;
+    const toonParseOptions *opts;
+    int failed;
+} jsonParser;
+
+/* Report the first error at 'at'. Line and column are only computed here,
+ * so well-formed input never pays for tracking them. */
+NO_INLINE static void jsonError(jsonParser *jp, int code, const char *at) {
+    if (jp->failed) return;
+    jp->failed = 1;
+
+    const toonParseOptions *opts = jp->opts;
+    if (!opts || !opts->on_error) return;
+
+    toonError err;
+    err.code = code;
+    err.line = 1;
+    const char *bol = jp->start;
+    for (const char *s = jp->start; s < at; s++) {
+        if (*s == '\n') {
+            err.line++;
+            bol = s + 1;
+        }
+    }
+    err.col = (int)(at - bol) + 1;
+    opts->on_error(&err, opts->userdata);
+}
+
+FORCE_INLINE void jsonSkipSpace(jsonParser *jp) {
+    while (jp->p < jp->end &&
+            (*jp->p == ' ' || *jp->p == '\n' || *jp->p == '\r' || *jp->p == '\t'))
+        jp->p++;
+}
+
+static int jsonHex4(const char *s, unsigned *out) {
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++) {
+        unsigned char c = s[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return 0;
+    }
+    *out = v;
+    return 1;
+}
+
+static size_t jsonPutUtf8(char *dst, unsigned cp) {
+    if (cp < 0x80) {
+        dst[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        dst[0] = 0xC0 | (cp >> 6);
+        dst[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    } else if (cp < 0x10000) {
+        dst[0] = 0xE0 | (cp >> 12);
+        dst[1] = 0x80 | ((cp >> 6) & 0x3F);
+        dst[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    dst[0] = 0xF0 | (cp >> 18);
+    dst[1] = 0x80 | ((cp >> 12) & 0x3F);
+    dst[2] = 0x80 | ((cp >> 6) & 0x3F);
+    dst[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+/* Parse a string starting at the opening quote into a newly allocated,
+ * NUL-terminated buffer. Returns NULL on error. */
+static char *jsonParseString(jsonParser *jp, size_t *len) {
+    const char *s = ++jp->p; /* Skip '"' */
+
+    /* Fast scan: most strings have no escapes, so the first byte that
+     * would need escaping on output is usually the closing quote. */
+    s += jsonScanClean(s, jp->end - s);
+
+    if (LIKELY(s < jp->end && *s == '"')) {
+        size_t n = s - jp->p;
+        char *out = tmalloc(n + 1);
+        memcpy(out, jp->p, n);
+        out[n] = '\0';
+        *len = n;
+        jp->p = s + 1;
+        return out;
+    }
+
+    /* Escapes present. Decoded text is never longer than its source, so
+     * the rest of the input bounds the buffer. */
+    size_t cap = (s - jp->p) + 1;
+    const char *q = s;
+    while (q < jp->end && *q != '"') {
+        if (*q == '\\' && q + 1 < jp->end) q++;
+        q++;
+    }
+    cap += q - s;
+
+    char *out = tmalloc(cap);
+    size_t n = s - jp->p;
+    memcpy(out, jp->p, n);
+
+    while (s < jp->end) {
+        unsigned char c = *s;
+        if (c == '"') {
+            out[n] = '\0';
+            *len = n;
+            jp->p = s + 1;
+            return out;
+        }
+        if (c < 0x20) {
+            jsonError(jp, TOON_ERR_BAD_STRING, s);
+            tfree(out);
+            return NULL;
+        }
+        if (c != '\\') {
+            out[n++] = c;
+            s++;
+            continue;
+        }
+
+        if (s + 1 >= jp->end) break;
+        const char *esc = s;
+        s += 2;
+        switch (esc[1]) {
+        case '"':  out[n++] = '"'; break;
+        case '\\': out[n++] = '\\'; break;
+        case '/':  out[n++] = '/'; break;
+        case 'b':  out[n++] = '\b'; break;
+        case 'f':  out[n++] = '\f'; break;
+        case 'n':  out[n++] = '\n'; break;
+        case 'r':  out[n++] = '\r'; break;
+        case 't':  out[n++] = '\t'; break;
+        case 'u': {
+            unsigned cp, lo;
+            if (jp->end - s < 4 || !jsonHex4(s, &cp)) {
+                jsonError(jp, TOON_ERR_BAD_STRING, esc);
+                tfree(out);
+                return NULL;
+            }
+            s += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                /* High surrogate: combine with a following low one. */
+                if (jp->end - s >= 6 && s[0] == '\\' && s[1] == 'u' &&
+                        jsonHex4(s + 2, &lo) && lo >= 0xDC00 && lo <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    s += 6;
+                } else {
+                    cp = 0xFFFD;
+                }
+            } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                cp = 0xFFFD;
+            }
+            /* A \uXXXX escape is 6 bytes and decodes to at most 4, or
+             * 12 bytes to 4 for a surrogate pair, so 'cap' still holds. */
+            n += jsonPutUtf8(out + n, cp);
+            break;
+        }
+        default:
+            jsonError(jp, TOON_ERR_BAD_STRING, esc);
+            tfree(out);
+            return NULL;
+        }
+    }
+
+    jsonError(jp, TOON_ERR_UNEXPECTED_END, jp->end);
+    tfree(out);
+    return NULL;
+}
+
+/* Parse a number. Integers that fit an int are accumulated inline; other
+ * numbers are validated against the JSON grammar and passed to strtod(). */
+static toonObject *jsonParseNumber(jsonParser *jp) {
+    const char *s = jp->p;
+    const char *e = jp->end;
+    int neg = 0;
+
+    if (s < e && *s == '-') {
+        neg = 1;
+        s++;
+    }
+    if (s >= e || !isdigit((unsigned char)*s)) {
+        jsonError(jp, TOON_ERR_UNEXPECTED_CHAR, s < e ? s : e);
+        return NULL;
+    }
+
+    /* Integer part: no leading zeros. Accumulate in 64 bits; 18 digits
+     * can't overflow. */
+    uint64_t u = 0;
+    int digits = 0;
+    if (*s == '0') {
+        s++;
+        digits = 1;
+    } else {
+        while (s < e && isdigit((unsigned char)*s)) {
+            if (digits < 18) u = u * 10 + (*s - '0');
+            digits++;
+            s++;
+        }
+    }
+
+    int is_float = 0;
+    if (s < e && *s == '.') {
+        s++;
+        if (s >= e || !isdigit((unsigned char)*s)) {
+            jsonError(jp, TOON_ERR_UNEXPECTED_CHAR, s < e ? s : e);
+            return NULL;
+        }
+        while (s < e && isdigit((unsigned char)*s)) s++;
+        is_float = 1;
+    }
+    if (s < e && (*s == 'e' || *s == 'E')) {
+        s++;
+        if (s < e && (*s == '+' || *s == '-')) s++;
+        if (s >= e || !isdigit((unsigned char)*s)) {
+            jsonError(jp, TOON_ERR_UNEXPECTED_CHAR, s < e ? s : e);
+            return NULL;
+        }
+        while (s < e && isdigit((unsigned char)*s)) s++;
+        is_float = 1;
+    }
+
+    const char *start = jp->p;
+    jp->p = s;
+
+    if (!is_float && digits <= 10) {
+        if (!neg && u <= INT_MAX) return newIntObj((int)u);
+        if (neg && u <= (uint64_t)INT_MAX + 1) return newIntObj((int)(-(int64_t)u));
+    }
+
+    /* strtod() needs a terminated copy; the input may not have one. */
+    char buf[64];
+    size_t n = s - start;
+    char *tmp = n < sizeof(buf) ? buf : tmalloc(n + 1);
+    memcpy(tmp, start, n);
+    tmp[n] = '\0';
+    double d = strtod(tmp, NULL);
+    if (tmp != buf) tfree(tmp);
+    return newDoubleObj(d);
+}
+
+static int jsonLiteral(jsonParser *jp, const char *word, size_t len) {
+    if ((size_t)(jp->end - jp->p) < len || memcmp(jp->p, word, len) != 0) {
+        jsonError(jp, TOON_ERR_UNEXPECTED_CHAR, jp->p);
+        return 0;
+    }
+    jp->p += len;
+    return 1;
+}
+
+static toonObject *jsonParseValue(jsonParser *jp, int depth);
+
+/* Parse an object starting at '{'. Members keep their document order and
+ * get the nesting depth as their indent, like TOON properties. */
+static toonObject *jsonParseObject(jsonParser *jp, int depth) {
+    toonObject *obj = newObject(KV_OBJ);
+    toonObject *last = NULL;
+
+    jp->p++; /* Skip '{' */
+    jsonSkipSpace(jp);
+    if (jp->p < jp->end && *jp->p == '}') {
+        jp->p++;
+        return obj;
+    }
+
+    for (;;) {
+        if (jp->p >= jp->end || *jp->p != '"') {
+            jsonError(jp, jp->p < jp->end ? TOON_ERR_UNEXPECTED_CHAR :
+                    TOON_ERR_UNEXPECTED_END, jp->p);
+            break;
+        }
+        size_t keylen;
+        char *key = jsonParseString(jp, &keylen);
+        if (!key) break;
+
+        jsonSkipSpace(jp);
+        if (jp->p >= jp->end || *jp->p != ':') {
+            jsonError(jp, jp->p < jp->end ? TOON_ERR_EXPECTED_COLON :
+                    TOON_ERR_UNEXPECTED_END, jp->p);
+            tfree(key);
+            break;
+        }
+        jp->p++;
+
+        toonObject *value = jsonParseValue(jp, depth + 1);
+        if (!value) {
+            tfree(key);
+            break;
+        }
+        value->key = key;
+        value->indent = depth;
+
+        if (last == NULL) obj->child = value;
+        else last->next = value;
+        last = value;
+
+        jsonSkipSpace(jp);
+        if (jp->p < jp->end && *jp->p == ',') {
+            jp->p++;
+            jsonSkipSpace(jp);
+            continue;
+        }
+        if (jp->p < jp->end && *jp->p == '}') {
+            jp->p++;
+            return obj;
+        }
+        jsonError(jp, jp->p < jp->end ? TOON_ERR_UNEXPECTED_CHAR :
+                TOON_ERR_UNEXPECTED_END, jp->p);
+        break;
+    }
+
+    TOONc_free(obj);
+    return NULL;
+}
+
+/* Parse an array starting at '['. */
+static toonObject *jsonParseArray(jsonParser *jp, int depth) {
+    toonObject *list = newListObj();
+
+    jp->p++; /* Skip '[' */
+    jsonSkipSpace(jp);
+    if (jp->p < jp->end && *jp->p == ']') {
+        jp->p++;
+        return list;
+    }
+
+    for (;;) {
+        toonObject *item = jsonParseValue(jp, depth + 1);
+        if (!item) break;
+        listPush(list, item);
+
+        jsonSkipSpace(jp);
+        if (jp->p < jp->end && *jp->p == ',') {
+            jp->p++;
+            continue;
+        }
+        if (jp->p < jp->end && *jp->p == ']') {
+            jp->p++;
+            return list;
+        }
+        jsonError(jp, jp->p < jp->end ? TOON_ERR_UNEXPECTED_CHAR :
+                TOON_ERR_UNEXPECTED_END, jp->p);
+        break;
+    }
+
+    TOONc_free(list);
+    return NULL;
+}
+
+static toonObject *jsonParseValue(jsonParser *jp, int depth) {
+    jsonSkipSpace(jp);
+    if (UNLIKELY(jp->p >= jp->end)) {
+        jsonError(jp, TOON_ERR_UNEXPECTED_END, jp->end);
+        return NULL;
+    }
+
+    switch (*jp->p) {
+    case '{':
+    case '[':
+        if (UNLIKELY(depth >= JSON_MAX_DEPTH)) {
+            jsonError(jp, TOON_ERR_MAX_DEPTH, jp->p);
+            return NULL;
+        }
+        return *jp->p == '{' ? jsonParseObject(jp, depth) : jsonParseArray(jp, depth);
+    case '"': {
+        size_t len;
+        char *s = jsonParseString(jp, &len);
+        if (!s) return NULL;
+        toonObject *o = newObject(KV_STRING);
+        o->str.ptr = s;
+        o->str.len = len;
+        return o;
+    }
+    case 't':
+        return jsonLiteral(jp, "true", 4) ? newBoolObj(1) : NULL;
+    case 'f':
+        return jsonLiteral(jp, "false", 5) ? newBoolObj(0) : NULL;
+    case 'n':
+        return jsonLiteral(jp, "null", 4) ? newNullObj() : NULL;
+    default:
+        return jsonParseNumber(jp);
+    }
+}
+
+/* Parse a JSON document. */
+toonObject *TOONc_parseJSON(const char *buf, size_t len) {
+    return TOONc_parseJSONWithOptions(buf, len, NULL);
+}
+
+/* Parse a JSON document reporting the first error through 'opts'. */
+toonObject *TOONc_parseJSONWithOptions(const char *buf, size_t len,
+        const toonParseOptions *opts) {
+    if (!buf) return NULL;
+
+    jsonParser jp;
+    jp.start = jp.p = buf;
+    jp.end = buf + len;
+    jp.opts = opts;
+    jp.failed = 0;
+
+    toonObject *root = jsonParseValue(&jp, 0);
+    if (!root) return NULL;
+
+    jsonSkipSpace(&jp);
+    if (jp.p != jp.end) {
+        jsonError(&jp, TOON_ERR_UNEXPECTED_CHAR, jp.p);
+        TOONc_free(root);
+        return NULL;
+    }
+    return root;
+}
+
+/* -----------------------------------------------------------------------------
+ * Streaming JSON to TOON
+ *
+ * Transcodes JSON read from a FILE to TOON without building the whole
+ * tree. Objects are walked member by member and written as they are met.
+ * The only values that are buffered are scalars and arrays, because the
+ * TOON layout of an array ("key[N]: a,b", a "{cols}:" table or a "- "
+ * list) and its "[N]" count depend on all of its elements.
+ *
+ * An array is read into a window of up to 'window' elements. If it closes
+ * inside the window it is parsed and written by the regular encoder. A
+ * longer array is handled according to the mode:
+ *
+ *   one pass    the rest of the array is buffered too (memory grows with
+ *               the array, but any input stream works)
+ *   two pass    the rest is prescanned one element at a time to count the
+ *               elements and check that the shape stays uniform, then the
+ *               input is rewound to the '[' and the elements are decoded
+ *               and written one by one (needs seekable input)
+ *
+ * Either way the output is exactly what TOONc_writeTOON() produces for
+ * TOONc_parseJSON() on the same text.
+ * -------------------------------------------------------------------------- */
+
+#define TOON_STREAM_WINDOW 1024
+
+typedef struct jsonStream {
+    FILE *in;
+    char *buf;              /* Input chunk; buf[0] is at file offset 'base'. */
+    size_t pos, avail;
+    off_t base;
+    int line;               /* Position of buf[pos], for diagnostics. */
+    off_t bol;
+    char *rec;              /* Bytes of the value being captured. */
+    size_t rec_len, rec_cap;
+    int recording;
+    int rec_line, rec_col;  /* Where the capture started. */
+    toonWriter *w;
+    size_t window;
+    int flags;
+    const toonParseOptions *opts;
+    int failed;
+} jsonStream;
+
+/* Diagnostics for a captured value come back relative to the capture;
+ * this shifts them to their place in the whole input. */
+typedef struct jsonOrigin {
+    const toonParseOptions *user;
+    int line, col;
+} jsonOrigin;
+
+static void jsRelocate(const toonError *err, void *userdata) {
+    jsonOrigin *o = userdata;
+    toonError e = *err;
+    if (e.line == 1) e.col += o->col - 1;
+    e.line += o->line - 1;
+    o->user->on_error(&e, o->user->userdata);
+}
+
+static void jsFail(jsonStream *js, int code) {
+    if (js->failed) return;
+    js->failed = 1;
+    if (js->opts && js->opts->on_error) {
+        toonError err;
+        err.code = code;
+        err.line = js->line;
+        err.col = (int)(js->base + (off_t)js->pos - js->bol) + 1;
+        js->opts->on_error(&err, js->opts->userdata);
+    }
+}
+
+/* Next byte without consuming it, or -1 at end of input. */
+FORCE_INLINE int jsPeekRaw(jsonStream *js) {
+    if (UNLIKELY(js->pos == js->avail)) {
+        js->base += js->avail;
+        js->pos = 0;
+        js->avail = fread(js->buf, 1, TOON_STREAM_CHUNK, js->in);
+        if (js->avail == 0) return -1;
+    }
+    return (unsigned char)js->buf[js->pos];
+}
+
+/* Consume the byte jsPeekRaw() returned, recording it if capturing. */
+FORCE_INLINE void jsAdvance(jsonStream *js) {
+    char c = js->buf[js->pos++];
+    if (c == '\n') {
+        js->line++;
+        js->bol = js->base + (off_t)js->pos;
+    }
+    if (js->recording) {
+        if (UNLIKELY(js->rec_len == js->rec_cap)) {
+            js->rec_cap *= 2;
+            js->rec = trealloc(js->rec, js->rec_cap);
+        }
+        js->rec[js->rec_len++] = c;
+    }
+}
+
+/* Skip whitespace and return the next byte, or -1 at end of input. */
+static int jsPeek(jsonStream *js) {
+    int c;
+    while ((c = jsPeekRaw(js)) == ' ' || c == '\n' || c == '\r' || c == '\t')
+        jsAdvance(js);
+    return c;
+}
+
+static void jsBeginCapture(jsonStream *js) {
+    jsPeek(js);
+    js->rec_len = 0;
+    js->recording = 1;
+    js->rec_line = js->line;
+    js->rec_col = (int)(js->base + (off_t)js->pos - js->bol) + 1;
+}
+
+/* Consume one value without interpreting it beyond matching brackets and
+ * strings; the JSON parser validates it once it has been captured. */
+static int jsSkipValue(jsonStream *js) {
+    int c = jsPeek(js);
+    int nest = 0, in_string = 0;
+
+    if (c == -1) {
+        jsFail(js, TOON_ERR_UNEXPECTED_END);
+        return 0;
+    }
+
+    /* Scalars run up to the next delimiter. */
+    if (c != '"' && c != '{' && c != '[') {
+        while ((c = jsPeekRaw(js)) != -1 && c != ',' && c != ']' && c != '}' &&
+                c != ' ' && c != '\n' && c != '\r' && c != '\t')
+            jsAdvance(js);
+        return 1;
+    }
+
+    while ((c = jsPeekRaw(js)) != -1) {
+        jsAdvance(js);
+        if (in_string) {
+            if (c == '\\') {
+                if (jsPeekRaw(js) == -1) break;
+                jsAdvance(js);
+            } else if (c == '"') {
+                in_string = 0;
+                if (nest == 0) return 1;
+            }
+        } else if (c == '"') {
+            in_string = 1;
+        } else if (c == '{' || c == '[') {
+            nest++;
+        } else if (c == '}' || c == ']') {
+            if (--nest == 0) return 1;
+        }
+    }
+
+    jsFail(js, TOON_ERR_UNEXPECTED_END);
+    return 0;
+}
+
+/* Parse the captured bytes. */
+static toonObject *jsDecode(jsonStream *js) {
+    js->recording = 0;
+
+    toonObject *o;
+    if (js->opts && js->opts->on_error) {
+        jsonOrigin origin = {js->opts, js->rec_line, js->rec_col};
+        toonParseOptions opts = {0, jsRelocate, &origin, NULL};
+        o = TOONc_parseJSONWithOptions(js->rec, js->rec_len, &opts);
+    } else {
+        o = TOONc_parseJSON(js->rec, js->rec_len);
+    }
+    if (!o) js->failed = 1;
+    return o;
+}
+
+/* Capture and parse the next value. */
+static toonObject *jsReadValue(jsonStream *js) {
+    jsBeginCapture(js);
+    if (!jsSkipValue(js)) {
+        js->recording = 0;
+        return NULL;
+    }
+    return jsDecode(js);
+}
+
+/* After an element or member: consume ',' (returns 1) or 'close'
+ * (returns 0). Anything else fails the stream (returns -1). */
+static int jsNextItem(jsonStream *js, int close) {
+    int c = jsPeek(js);
+    if (c == ',' || c == close) {
+        jsAdvance(js);
+        return c == ',';
+    }
+    jsFail(js, c == -1 ? TOON_ERR_UNEXPECTED_END : TOON_ERR_UNEXPECTED_CHAR);
+    return -1;
+}
+
+/* Rewind to the '[' of a long array at 'offset'. */
+static int jsSeek(jsonStream *js, off_t offset, int line, off_t bol) {
+    if (fseeko(js->in, offset, SEEK_SET) != 0) {
+        js->failed = 1;
+        return -1;
+    }
+    js->base = offset;
+    js->pos = js->avail = 0;
+    js->line = line;
+    js->bol = bol;
+
+    /* The input must not have changed under us. */
+    if (jsPeekRaw(js) != '[') {
+        js->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Two-pass form of a long array: the input is at its '[' (offset 'start').
+ * Pass one counts the elements and settles the layout, pass two writes
+ * them. Only the current element and the first one (which fixes a table's
+ * columns) are held in memory. */
+static void jsStreamLongArray(jsonStream *js, off_t start, int line, off_t bol,
+        int depth) {
+    toonObject *first = NULL;
+    size_t count = 0;
+    int primitive = 1, table = 1;
+
+    for (int pass = 0; pass < 2 && !js->failed; pass++) {
+        if (jsSeek(js, start, line, bol) != 0) break;
+        jsAdvance(js); /* Skip '[' */
+
+        if (pass == 1) {
+            toonWriteCount(js->w, count);
+            if (primitive) writerPut(js->w, ": ", 2);
+            else if (table) toonWriteTableHead(js->w, first);
+            else writerPut(js->w, ":\n", 2);
+        }
+
+        for (size_t i = 0; ; i++) {
+            toonObject *item = jsReadValue(js);
+            if (!item) break;
+
+            if (pass == 0) {
+                if (!isPrimitive(item)) primitive = 0;
+                if (i == 0) table = isTableHead(item);
+                else if (table) table = isTableRow(first, item);
+                count++;
+            } else if (primitive) {
+                if (i) writerPutc(js->w, ',');
+                toonWriteScalar(js->w, item);
+            } else if (table) {
+                toonWriteRow(js->w, first, item, depth);
+            } else {
+                toonWriteListItem(js->w, NULL, item, depth);
+            }
+
+            if (pass == 0 && i == 0) first = item;
+            else TOONc_free(item);
+
+            int more = jsNextItem(js, ']');
+            if (more <= 0) break;
+        }
+    }
+
+    if (!js->failed && primitive) writerPutc(js->w, '\n');
+    TOONc_free(first);
+}
+
+/* Write the array starting at the next '[' as a field named 'key' (or as
+ * a root array when 'key' is NULL). */
+static void jsStreamArray(jsonStream *js, char *key, int depth) {
+    off_t start = js->base + (off_t)js->pos;
+    int line = js->line;
+    off_t bol = js->bol;
+
+    jsBeginCapture(js);
+    jsAdvance(js); /* Skip '[' */
+
+    size_t count = 0;
+    int overflow = 0;
+    if (jsPeek(js) == ']') {
+        jsAdvance(js);
+    } else {
+        for (;;) {
+            if (count == js->window && (js->flags & TOON_STREAM_TWO_PASS)) {
+                overflow = 1;
+                break;
+            }
+            if (!jsSkipValue(js)) break;
+            count++;
+            if (jsNextItem(js, ']') <= 0) break;
+        }
+    }
+    if (js->failed) {
+        js->recording = 0;
+        return;
+    }
+
+    writerIndent(js->w, depth);
+    if (overflow) {
+        js->recording = 0;
+        if (key) toonWriteKey(js->w, key);
+        jsStreamLongArray(js, start, line, bol, depth);
+        return;
+    }
+
+    toonObject *list = jsDecode(js);
+    if (!list) return;
+    list->key = key;
+    toonWriteField(js->w, NULL, list, depth);
+    list->key = NULL;
+    TOONc_free(list);
+}
+
+/* Write the members of the object whose '{' was just consumed. */
+static void jsStreamObject(jsonStream *js, int depth) {
+    if (depth >= JSON_MAX_DEPTH) {
+        jsFail(js, TOON_ERR_MAX_DEPTH);
+        return;
+    }
+    if (jsPeek(js) == '}') {
+        jsAdvance(js);
+        return;
+    }
+
+    for (;;) {
+        if (jsPeek(js) != '"') {
+            jsFail(js, jsPeek(js) == -1 ? TOON_ERR_UNEXPECTED_END :
+                    TOON_ERR_UNEXPECTED_CHAR);
+            return;
+        }
+        toonObject *name = jsReadValue(js);
+        if (!name) return;
+        char *key = name->str.ptr;
+
+        int c = jsPeek(js);
+        if (c != ':') {
+            jsFail(js, c == -1 ? TOON_ERR_UNEXPECTED_END : TOON_ERR_EXPECTED_COLON);
+            TOONc_free(name);
+            return;
+        }
+        jsAdvance(js);
+
+        c = jsPeek(js);
+        if (c == '{') {
+            jsAdvance(js);
+            writerIndent(js->w, depth);
+            toonWriteKey(js->w, key);
+            writerPut(js->w, ":\n", 2);
+            jsStreamObject(js, depth + 1);
+        } else if (c == '[') {
+            jsStreamArray(js, key, depth);
+        } else {
+            toonObject *value = jsReadValue(js);
+            if (value) {
+                value->key = key;
+                writerIndent(js->w, depth);
+                toonWriteField(js->w, NULL, value, depth);
+                value->key = NULL;
+                TOONc_free(value);
+            }
+        }
+        TOONc_free(name);
+
+        if (js->failed || jsNextItem(js, '}') <= 0) return;
+    }
+}
+
+/* Transcode JSON from 'in' to TOON on 'out'. Arrays of up to 'window'
+ * elements (0 for the default) are decided in memory; with
+ * TOON_STREAM_TWO_PASS longer ones are streamed in two passes over the
+ * input, which must then be seekable. Returns 0 on success, -1 on a JSON
+ * error (reported through 'opts'), a read or seek error, or a write error.
+ * The writer is flushed but not freed. */
+int TOONc_transcodeJSONToTOON(FILE *in, toonWriter *out, size_t window,
+        int flags, const toonParseOptions *opts) {
+    if (!in || !out) return -1;
+
+    jsonStream js;
+    js.in = in;
+    js.buf = tmalloc(TOON_STREAM_CHUNK);
+    js.pos = js.avail = 0;
+    js.base = ftello(in);
+    if (js.base < 0) js.base = 0;
+    js.line = 1;
+    js.bol = js.base;
+    js.rec_cap = 4096;
+    js.rec = tmalloc(js.rec_cap);
+    js.rec_len = 0;
+    js.recording = 0;
+    js.w = out;
+    js.window = window ? window : TOON_STREAM_WINDOW;
+    js.flags = flags;
+    js.opts = opts;
+    js.failed = 0;
+
+    int c = jsPeek(&js);
+    if (c == '{') {
+        jsAdvance(&js);
+        jsStreamObject(&js, 0);
+    } else if (c == '[') {
+        jsStreamArray(&js, NULL, 0);
+    } else {
+        toonObject *value = jsReadValue(&js);
+        if (value) {
+            TOONc_writeTOON(out, value);
+            TOONc_free(value);
+        }
+    }
+
+    if (!js.failed && jsPeek(&js) != -1)
+        jsFail(&js, TOON_ERR_UNEXPECTED_CHAR);
+
+    int failed = js.failed || ferror(in);
+    tfree(js.buf);
+    tfree(js.rec);
+
+    if (TOONc_writerFlush(out) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * Binary snapshots
+ *
+ * A snapshot is a parsed tree laid out for reading in place, so reloading a
+ * large document is an mmap() and a header check instead of a parse:
+ *
+ *   header    magic, version, byte order and the section offsets
+ *   nodes     16-byte records: type, key (pool offset) and a 64-bit payload
+ *   pool      every key and string once, NUL-terminated
+ *
+ * References are node indices rather than pointers. The members of an
+ * object and the items of a list are stored contiguously, so a container's
+ * payload is just (first, count) and item i is first + i. Arrays the TOON
+ * encoder would write as tables are stored by column instead: the table
+ * record spans one column record per column (carrying the column name),
+ * and each column spans its cells, which are ordinary scalar records.
+ *
+ * Snapshots are written in host byte order and refused on a host with a
+ * different one. Reading never trusts the file further than the bounds
+ * checks in each accessor, so a damaged snapshot yields TOON_SNAP_NONE and
+ * empty values rather than wild reads.
+ * -------------------------------------------------------------------------- */
+
+#define SNAP_MAGIC      "TOONSNAP"
+#define SNAP_VERSION    1
+#define SNAP_BYTE_ORDER 0x01020304u
+#define SNAP_NO_KEY     0xFFFFFFFFu
+#define SNAP_COLUMN     9           /* Internal: one column of a KV_TABLE. */
+
+typedef struct snapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t size;          /* Whole image, header included. */
+    uint64_t nodes;         /* Offset of the node records. */
+    uint64_t count;
+    uint64_t pool;          /* Offset of the string pool. */
+    uint64_t pool_size;
+    uint32_t root;
+    uint32_t reserved;
+} snapHeader;
+
+typedef struct snapNode {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t key;
+    union {
+        int64_t i;
+        double d;
+        struct { uint32_t off, len; } str;
+        struct { uint32_t first, count; } span;
+    } v;
+} snapNode;
+
+typedef struct snapBuilder {
+    snapNode *nodes;
+    toonObject **src;       /* Tree node each record is filled from. */
+    size_t count, cap;
+    char *pool;
+    size_t pool_len, pool_cap;
+    uint32_t *slots;        /* Interning table: pool offset + 1, 0 if free. */
+    uint32_t *slot_lens;
+    size_t slot_cap, slot_used;
+    int failed;             /* Ran past 32-bit offsets. */
+} snapBuilder;
+
+static uint32_t snapHash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void snapInsertSlot(snapBuilder *b, uint32_t off, uint32_t len) {
+    size_t mask = b->slot_cap - 1;
+    size_t i = snapHash(b->pool + off, len) & mask;
+    while (b->slots[i]) i = (i + 1) & mask;
+    b->slots[i] = off + 1;
+    b->slot_lens[i] = len;
+}
+
+/* Return the pool offset of 's', adding it on first use. Keys and repeated
+ * values (table cells in particular) are stored once. */
+static uint32_t snapIntern(snapBuilder *b, const char *s, size_t len) {
+    if (len >= UINT32_MAX || b->pool_len + len + 1 >= UINT32_MAX) {
+        b->failed = 1;
+        return 0;
+    }
+
+    size_t mask = b->slot_cap - 1;
+    size_t i = snapHash(s, len) & mask;
+    while (b->slots[i]) {
+        uint32_t off = b->slots[i] - 1;
+        if (b->slot_lens[i] == len && memcmp(b->pool + off, s, len) == 0)
+            return off;
+        i = (i + 1) & mask;
+    }
+
+    if (b->pool_len + len + 1 > b->pool_cap) {
+        while (b->pool_len + len + 1 > b->pool_cap) b->pool_cap *= 2;
+        b->pool = trealloc(b->pool, b->pool_cap);
+    }
+    uint32_t off = (uint32_t)b->pool_len;
+    memcpy(b->pool + off, s, len);
+    b->pool[off + len] = '\0';
+    b->pool_len += len + 1;
+
+    /* Keep the table at most half full. */
+    if (++b->slot_used * 2 > b->slot_cap) {
+        uint32_t *old = b->slots, *old_lens = b->slot_lens;
+        size_t old_cap = b->slot_cap;
+        b->slot_cap *= 2;
+        b->slots = tcalloc(b->slot_cap, sizeof(uint32_t));
+        b->slot_lens = tmalloc(b->slot_cap * sizeof(uint32_t));
+        for (size_t j = 0; j < old_cap; j++) {
+            if (old[j]) snapInsertSlot(b, old[j] - 1, old_lens[j]);
+        }
+        tfree(old);
+        tfree(old_lens);
+    }
+    snapInsertSlot(b, off, (uint32_t)len);
+    return off;
+}
+
+/* Reserve 'n' consecutive zeroed records and return the first index. */
+static uint32_t snapAlloc(snapBuilder *b, size_t n) {
+    if (b->count + n >= UINT32_MAX) {
+        b->failed = 1;
+        return 0;
+    }
+    if (b->count + n > b->cap) {
+        while (b->count + n > b->cap) b->cap *= 2;
+        b->nodes = trealloc(b->nodes, b->cap * sizeof(snapNode));
+        b->src = trealloc(b->src, b->cap * sizeof(toonObject *));
+    }
+    memset(b->nodes + b->count, 0, n * sizeof(snapNode));
+    memset(b->src + b->count, 0, n * sizeof(toonObject *));
+    uint32_t first = (uint32_t)b->count;
+    b->count += n;
+    return first;
+}
+
+/* Lay out the column records and cells of a tabular list. */
+static void snapFillTable(snapBuilder *b, uint32_t idx, toonObject *list) {
+    toonObject *first = list->array.items[0];
+    size_t rows = list->array.len, ncols = 0;
+    for (toonObject *c = first->child; c; c = c->next) ncols++;
+
+    uint32_t cols = snapAlloc(b, ncols);
+    uint32_t col = cols;
+    for (toonObject *c = first->child; c && !b->failed; c = c->next, col++) {
+        uint32_t key = snapIntern(b, c->key, strlen(c->key));
+        uint32_t cells = snapAlloc(b, rows);
+        snapNode *n = &b->nodes[col];
+        n->type = SNAP_COLUMN;
+        n->key = key;
+        n->v.span.first = cells;
+        n->v.span.count = (uint32_t)rows;
+    }
+    if (b->failed) return;
+
+    /* Cells are filled later like any other record; here each one just
+     * gets its source, read row by row in header order. */
+    for (size_t r = 0; r < rows; r++) {
+        toonObject *row = list->array.items[r];
+        toonObject *hint = row->child;
+        col = cols;
+        for (toonObject *c = first->child; c; c = c->next, col++) {
+            b->src[b->nodes[col].v.span.first + r] = rowLookup(row, hint, c->key);
+            if (hint) hint = hint->next;
+        }
+    }
+
+    b->nodes[idx].type = KV_TABLE;
+    b->nodes[idx].v.span.first = cols;
+    b->nodes[idx].v.span.count = (uint32_t)ncols;
+}
+
+/* Fill record 'idx' from its tree node, reserving its children's records.
+ * Called in index order, so the layout is breadth first. */
+static void snapFill(snapBuilder *b, uint32_t idx) {
+    toonObject *o = b->src[idx];
+    uint32_t key = o->key ? snapIntern(b, o->key, strlen(o->key)) : SNAP_NO_KEY;
+    b->nodes[idx].key = key;
+
+    switch (o->kvtype) {
+    case KV_STRING: {
+        uint32_t off = snapIntern(b, o->str.ptr, o->str.len);
+        snapNode *n = &b->nodes[idx];
+        n->type = KV_STRING;
+        n->v.str.off = off;
+        n->v.str.len = (uint32_t)o->str.len;
+        break;
+    }
+    case KV_INT:
+        b->nodes[idx].type = KV_INT;
+        b->nodes[idx].v.i = o->i;
+        break;
+    case KV_DOUBLE:
+        b->nodes[idx].type = KV_DOUBLE;
+        b->nodes[idx].v.d = o->d;
+        break;
+    case KV_BOOL:
+        b->nodes[idx].type = KV_BOOL;
+        b->nodes[idx].v.i = o->boolean;
+        break;
+    case KV_OBJ: {
+        size_t n = 0;
+        for (toonObject *c = o->child; c; c = c->next) n++;
+        uint32_t first = snapAlloc(b, n);
+        if (b->failed) return;
+        size_t k = 0;
+        for (toonObject *c = o->child; c; c = c->next)
+            b->src[first + k++] = c;
+        b->nodes[idx].type = KV_OBJ;
+        b->nodes[idx].v.span.first = first;
+        b->nodes[idx].v.span.count = (uint32_t)n;
+        break;
+    }
+    case KV_LIST: {
+        if (isTabular(o)) {
+            snapFillTable(b, idx, o);
+            break;
+        }
+        size_t n = o->array.len;
+        uint32_t first = snapAlloc(b, n);
+        if (b->failed) return;
+        for (size_t k = 0; k < n; k++)
+            b->src[first + k] = o->array.items[k];
+        b->nodes[idx].type = KV_LIST;
+        b->nodes[idx].v.span.first = first;
+        b->nodes[idx].v.span.count = (uint32_t)n;
+        break;
+    }
+    default:
+        b->nodes[idx].type = KV_NULL;
+        break;
+    }
+}
+
+/* Write a snapshot of 'root' to 'w'. Returns 0 on success, -1 if the tree
+ * is too large for 32-bit offsets or the writer failed. */
+int TOONc_writeSnapshot(toonWriter *w, toonObject *root) {
+    if (!w || !root) return -1;
+
+    snapBuilder b;
+    b.cap = 1024;
+    b.count = 0;
+    b.nodes = tmalloc(b.cap * sizeof(snapNode));
+    b.src = tmalloc(b.cap * sizeof(toonObject *));
+    b.pool_cap = 4096;
+    b.pool_len = 0;
+    b.pool = tmalloc(b.pool_cap);
+    b.slot_cap = 1024;
+    b.slot_used = 0;
+    b.slots = tcalloc(b.slot_cap, sizeof(uint32_t));
+    b.slot_lens = tmalloc(b.slot_cap * sizeof(uint32_t));
+    b.failed = 0;
+
+    uint32_t top = snapAlloc(&b, 1);
+    b.src[top] = root;
+    for (size_t i = 0; i < b.count && !b.failed; i++) {
+        /* Column records are complete when reserved. */
+        if (b.src[i]) snapFill(&b, (uint32_t)i);
+    }
+
+    /* The pool always ends in a NUL, which readers rely on. */
+    if (b.pool_len == 0) b.pool[b.pool_len++] = '\0';
+
+    int rc = -1;
+    if (!b.failed) {
+        snapHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, SNAP_MAGIC, 8);
+        h.version = SNAP_VERSION;
+        h.byte_order = SNAP_BYTE_ORDER;
+        h.nodes = sizeof(h);
+        h.count = b.count;
+        h.pool = h.nodes + b.count * sizeof(snapNode);
+        h.pool_size = b.pool_len;
+        h.size = h.pool + h.pool_size;
+        h.root = top;
+
+        TOONc_writerWrite(w, &h, sizeof(h));
+        TOONc_writerWrite(w, b.nodes, b.count * sizeof(snapNode));
+        TOONc_writerWrite(w, b.pool, b.pool_len);
+        rc = w->error ? -1 : 0;
+    }
+
+    tfree(b.nodes);
+    tfree(b.src);
+    tfree(b.pool);
+    tfree(b.slots);
+    tfree(b.slot_lens);
+    return rc;
+}
+
+/* Write a snapshot of 'root' to the file at 'path'. */
+int TOONc_snapSave(toonObject *root, const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return -1;
+
+    toonWriter w;
+    TOONc_writerInitFile(&w, fp);
+    int rc = TOONc_writeSnapshot(&w, root);
+    if (TOONc_writerFree(&w) != 0) rc = -1;
+    if (fclose(fp) != 0) rc = -1;
+    return rc;
+}
+
+/* Check the header of the image at 'base' and describe it in 's'. */
+static int snapAttach(toonSnapshot *s, const char *base, size_t size) {
+    snapHeader h;
+    if (size < sizeof(h)) return -1;
+    memcpy(&h, base, sizeof(h));
+
+    if (memcmp(h.magic, SNAP_MAGIC, 8) != 0 ||
+            h.version != SNAP_VERSION ||
+            h.byte_order != SNAP_BYTE_ORDER ||
+            h.size != size ||
+            h.nodes % 8 != 0 ||
+            h.nodes > size ||
+            h.count > (size - h.nodes) / sizeof(snapNode) ||
+            h.pool > size ||
+            h.pool_size == 0 ||
+            h.pool_size > size - h.pool ||
+            h.pool_size >= UINT32_MAX ||
+            h.root >= h.count ||
+            base[h.pool + h.pool_size - 1] != '\0')
+        return -1;
+
+    s->base = base;
+    s->size = size;
+    s->nodes = base + h.nodes;
+    s->count = (uint32_t)h.count;
+    s->pool = base + h.pool;
+    s->pool_size = h.pool_size;
+    s->root = h.root;
+    return 0;
+}
+
+/* Map the snapshot at 'path' read-only. Returns NULL if it can't be opened
+ * or its header doesn't check out. */
+toonSnapshot *TOONc_snapOpen(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    toonSnapshot *s = tmalloc(sizeof(*s));
+    if (snapAttach(s, base, size) != 0) {
+        munmap(base, size);
+        tfree(s);
+        return NULL;
+    }
+    s->mapped = 1;
+    return s;
+}
+
+/* Use a snapshot already in memory. The buffer is not copied: it must stay
+ * valid, and 8-byte aligned, until TOONc_snapClose(). */
+toonSnapshot *TOONc_snapOpenBuffer(const void *buf, size_t len) {
+    if (!buf || ((uintptr_t)buf & 7)) return NULL;
+
+    toonSnapshot *s = tmalloc(sizeof(*s));
+    if (snapAttach(s, buf, len) != 0) {
+        tfree(s);
+        return NULL;
+    }
+    s->mapped = 0;
+    return s;
+}
+
+void TOONc_snapClose(toonSnapshot *s) {
+    if (!s) return;
+    if (s->mapped) munmap((void *)s->base, s->size);
+    tfree(s);
+}
+
+FORCE_INLINE const snapNode *snapAt(const toonSnapshot *s, toonSnapRef n) {
+    if (UNLIKELY(!s || n >= s->count)) return NULL;
+    return (const snapNode *)s->nodes + n;
+}
+
+/* Does the span of container 'node' (at 'n') hold together? The writer
+ * always places children after their parent, so a span that points back,
+ * or past the end, marks a damaged image. Opening only checks the header,
+ * so every accessor that follows a span checks it here; this also keeps
+ * any walk over the nodes finite. */
+FORCE_INLINE int snapSpanOk(const toonSnapshot *s, toonSnapRef n, const snapNode *node) {
+    return node->v.span.first > n && node->v.span.first <= s->count &&
+           node->v.span.count <= s->count - node->v.span.first;
+}
+
+toonSnapRef TOONc_snapRoot(const toonSnapshot *s) {
+    return s ? s->root : TOON_SNAP_NONE;
+}
+
+/* KV_* type of a node (KV_TABLE for column-encoded arrays), or -1. */
+int TOONc_snapType(const toonSnapshot *s, toonSnapRef n) {
+    const snapNode *node = snapAt(s, n);
+    if (!node || node->type == SNAP_COLUMN) return -1;
+    return node->type;
+}
+
+const char *TOONc_snapKey(const toonSnapshot *s, toonSnapRef n) {
+    const snapNode *node = snapAt(s, n);
+    if (!node || node->key >= s->pool_size) return NULL;
+    return s->pool + node->key;
+}
+
+const char *TOONc_snapString(const toonSnapshot *s, toonSnapRef n, size_t *len) {
+    const snapNode *node = snapAt(s, n);
+    if (!node || node->type != KV_STRING ||
+            node->v.str.off >= s->pool_size ||
+            node->v.str.len >= s->pool_size - node->v.str.off)
+        return NULL;
+    if (len) *len = node->v.str.len;
+    return s->pool + node->v.str.off;
+}
+
+int TOONc_snapInt(const toonSnapshot *s, toonSnapRef n) {
+    const snapNode *node = snapAt(s, n);
+    return node && node->type == KV_INT ? (int)node->v.i : 0;
+}
+
+double TOONc_snapDouble(const toonSnapshot *s, toonSnapRef n) {
+    const snapNode *node = snapAt(s, n);
+    return node && node->type == KV_DOUBLE ? node->v.d : 0.0;
+}
+
+int TOONc_snapBool(const toonSnapshot *s, toonSnapRef n) {
+    const snapNode *node = snapAt(s, n);
+    return node && node->type == KV_BOOL ? (int)node->v.i : 0;
+}
+
+static const snapNode *snapColumnAt(const toonSnapshot *s, toonSnapRef table, size_t col) {
+    const snapNode *node = snapAt(s, table);
+    if (!node || node->type != KV_TABLE || !snapSpanOk(s, table, node) ||
+            col >= node->v.span.count)
+        return NULL;
+    toonSnapRef at = node->v.span.first + (toonSnapRef)col;
+    const snapNode *c = snapAt(s, at);
+    return c && c->type == SNAP_COLUMN && snapSpanOk(s, at, c) ? c : NULL;
+}
+
+/* Number of members, items or table rows. */
+size_t TOONc_snapLength(const toonSnapshot *s, toonSnapRef n) {
+    const snapNode *node = snapAt(s, n);
+    if (!node) return 0;
+    if (node->type == KV_OBJ || node->type == KV_LIST)
+        return snapSpanOk(s, n, node) ? node->v.span.count : 0;
+    if (node->type == KV_TABLE) {
+        const snapNode *col = snapColumnAt(s, n, 0);
+        return col ? col->v.span.count : 0;
+    }
+    return 0;
+}
+
+/* The i-th member of an object or item of a list. */
+toonSnapRef TOONc_snapChild(const toonSnapshot *s, toonSnapRef n, size_t i) {
+    const snapNode *node = snapAt(s, n);
+    if (!node || (node->type != KV_OBJ && node->type != KV_LIST) ||
+            !snapSpanOk(s, n, node) || i >= node->v.span.count)
+        return TOON_SNAP_NONE;
+    return node->v.span.first + (toonSnapRef)i;
+}
+
+/* Look up a dot-separated path of member names, like TOONc_get(). */
+toonSnapRef TOONc_snapGet(const toonSnapshot *s, toonSnapRef n, const char *path) {
+    if (!path || !snapAt(s, n)) return TOON_SNAP_NONE;
+
+    const char *p = path;
+    while (*p) {
+        if (*p == '.') {
+            p++;
+            continue;
+        }
+        const char *seg = p;
+        while (*p && *p != '.') p++;
+        size_t len = p - seg;
+
+        const snapNode *node = snapAt(s, n);
+        if (!node || node->type != KV_OBJ || !snapSpanOk(s, n, node))
+            return TOON_SNAP_NONE;
+
+        toonSnapRef found = TOON_SNAP_NONE;
+        for (uint32_t i = 0; i < node->v.span.count; i++) {
+            const char *key = TOONc_snapKey(s, node->v.span.first + i);
+            if (key && strncmp(key, seg, len) == 0 && key[len] == '\0') {
+                found = node->v.span.first + i;
+                break;
+            }
+        }
+        if (found == TOON_SNAP_NONE) return TOON_SNAP_NONE;
+        n = found;
+    }
+    return n;
+}
+
+size_t TOONc_snapColumns(const toonSnapshot *s, toonSnapRef table) {
+    const snapNode *node = snapAt(s, table);
+    return node && node->type == KV_TABLE && snapSpanOk(s, table, node) ?
+           node->v.span.count : 0;
+}
+
+const char *TOONc_snapColumn(const toonSnapshot *s, toonSnapRef table, size_t col) {
+    const snapNode *c = snapColumnAt(s, table, col);
+    return c && c->key < s->pool_size ? s->pool + c->key : NULL;
+}
+
+/* The scalar stored at (row, col) of a table. */
+toonSnapRef TOONc_snapCell(const toonSnapshot *s, toonSnapRef table, size_t row, size_t col) {
+    const snapNode *c = snapColumnAt(s, table, col);
+    if (!c || row >= c->v.span.count) return TOON_SNAP_NONE;
+    return c->v.span.first + (toonSnapRef)row;
+}
+
+/* Copy a snapshot node back into an ordinary tree. Tables come back as
+ * lists of row objects. */
+toonObject *TOONc_snapThaw(const toonSnapshot *s, toonSnapRef n) {
+    const snapNode *node = snapAt(s, n);
+    if (!node) return NULL;
+    if ((node->type == KV_OBJ || node->type == KV_LIST || node->type == KV_TABLE) &&
+            !snapSpanOk(s, n, node))
+        return NULL;
+
+    toonObject *o;
+    switch (node->type) {
+    case KV_STRING: {
+        size_t len;
+        const char *str = TOONc_snapString(s, n, &len);
+        o = str ? newStringObj((char *)str, len) : newNullObj();
+        break;
+    }
+    case KV_INT:    o = newIntObj((int)node->v.i); break;
+    case KV_DOUBLE: o = newDoubleObj(node->v.d); break;
+    case KV_BOOL:   o = newBoolObj((int)node->v.i); break;
+    case KV_OBJ: {
+        o = newObject(KV_OBJ);
+        toonObject *last = NULL;
+        for (uint32_t i = 0; i < node->v.span.count; i++) {
+            toonObject *child = TOONc_snapThaw(s, node->v.span.first + i);
+            if (!child) continue;
+            if (last) last->next = child;
+            else o->child = child;
+            last = child;
+        }
+        break;
+    }
+    case KV_LIST:
+        o = newListObj();
+        for (uint32_t i = 0; i < node->v.span.count; i++) {
+            toonObject *item = TOONc_snapThaw(s, node->v.span.first + i);
+            if (item) listPush(o, item);
+        }
+        break;
+    case KV_TABLE: {
+        o = newListObj();
+        size_t rows = TOONc_snapLength(s, n);
+        size_t ncols = TOONc_snapColumns(s, n);
+        for (size_t r = 0; r < rows; r++) {
+            toonObject *row = newObject(KV_OBJ);
+            toonObject *last = NULL;
+            for (size_t c = 0; c < ncols; c++) {
+                toonObject *cell = TOONc_snapThaw(s, TOONc_snapCell(s, n, r, c));
+                if (!cell) continue;
+                if (last) last->next = cell;
+                else row->child = cell;
+                last = cell;
+            }
+            listPush(o, row);
+        }
+        break;
+    }
+    default:
+        o = newNullObj();
+        break;
+    }
+
+    const char *key = TOONc_snapKey(s, n);
+    if (key) {
+        size_t len = strlen(key);
+        o->key = tmalloc(len + 1);
+        memcpy(o->key, key, len + 1);
+    }
+    return o;
+}
+
+/* -----------------------------------------------------------------------------
+ * CBOR
+ *
+ * Binary encoding of trees for service-to-service transport (RFC 8949).
+ * Objects become maps with text keys, lists become arrays, integers use the
+ * shortest head, and doubles are sent as float32 when that is exact and as
+ * float64 otherwise.
+ *
+ * Arrays the TOON encoder would write as tables are sent the same compact
+ * way: tag TOON_CBOR_TABLE_TAG wrapping [[col1, col2, ...], [v1, v2, ...],
+ * ...], i.e. one header shared by all rows. Peers that don't know the tag
+ * still see plain nested arrays. TOON_CBOR_NO_TABLES turns this off.
+ *
+ * The decoder accepts any well-formed CBOR: definite and indefinite
+ * lengths, half/single/double floats, byte strings (as strings), integer
+ * map keys (as decimal text) and unknown tags (ignored).
+ * -------------------------------------------------------------------------- */
+
+#define CBOR_UINT   0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+#define CBOR_BREAK  0xFF
+
+/* Write an initial byte plus argument in the shortest form. */
+static void cborHead(toonWriter *w, int major, uint64_t v) {
+    unsigned char b[9];
+    size_t n;
+    unsigned char m = (unsigned char)(major << 5);
+
+    if (v < 24) {
+        b[0] = m | (unsigned char)v;
+        n = 1;
+    } else if (v <= 0xFF) {
+        b[0] = m | 24;
+        b[1] = (unsigned char)v;
+        n = 2;
+    } else if (v <= 0xFFFF) {
+        b[0] = m | 25;
+        b[1] = (unsigned char)(v >> 8);
+        b[2] = (unsigned char)v;
+        n = 3;
+    } else if (v <= 0xFFFFFFFFu) {
+        b[0] = m | 26;
+        for (int i = 0; i < 4; i++) b[1 + i] = (unsigned char)(v >> (24 - 8 * i));
+        n = 5;
+    } else {
+        b[0] = m | 27;
+        for (int i = 0; i < 8; i++) b[1 + i] = (unsigned char)(v >> (56 - 8 * i));
+        n = 9;
+    }
+    writerPut(w, (const char *)b, n);
+}
+
+static void cborText(toonWriter *w, const char *s, size_t len) {
+    cborHead(w, CBOR_TEXT, len);
+    writerPut(w, s, len);
+}
+
+static void cborDouble(toonWriter *w, double d) {
+    unsigned char b[9];
+    float f = (float)d;
+
+    /* float32 when it round-trips (NaN included). */
+    if ((double)f == d || d != d) {
+        uint32_t u;
+        memcpy(&u, &f, 4);
+        b[0] = 0xFA;
+        for (int i = 0; i < 4; i++) b[1 + i] = (unsigned char)(u >> (24 - 8 * i));
+        writerPut(w, (const char *)b, 5);
+        return;
+    }
+
+    uint64_t u;
+    memcpy(&u, &d, 8);
+    b[0] = 0xFB;
+    for (int i = 0; i < 8; i++) b[1 + i] = (unsigned char)(u >> (56 - 8 * i));
+    writerPut(w, (const char *)b, 9);
+}
+
+static void cborScalar(toonWriter *w, toonObject *o) {
+    switch (o->kvtype) {
+    case KV_STRING:
+        cborText(w, o->str.ptr, o->str.len);
+        break;
+    case KV_INT:
+        if (o->i >= 0) cborHead(w, CBOR_UINT, (uint64_t)o->i);
+        else cborHead(w, CBOR_NEGINT, (uint64_t)(-(int64_t)o->i - 1));
+        break;
+    case KV_DOUBLE:
+        cborDouble(w, o->d);
+        break;
+    case KV_BOOL:
+        writerPutc(w, o->boolean ? (char)0xF5 : (char)0xF4);
+        break;
+    default:
+        writerPutc(w, (char)0xF6);
+        break;
+    }
+}
+
+static void cborValue(toonWriter *w, toonObject *o, int flags) {
+    switch (o->kvtype) {
+    case KV_OBJ: {
+        size_t n = 0;
+        for (toonObject *c = o->child; c; c = c->next) n++;
+        cborHead(w, CBOR_MAP, n);
+        for (toonObject *c = o->child; c; c = c->next) {
+            const char *key = c->key ? c->key : "";
+            cborText(w, key, strlen(key));
+            cborValue(w, c, flags);
+        }
+        break;
+    }
+    case KV_LIST:
+        if (!(flags & TOON_CBOR_NO_TABLES) && isTabular(o)) {
+            toonObject *first = o->array.items[0];
+            size_t ncols = 0;
+            for (toonObject *c = first->child; c; c = c->next) ncols++;
+
+            cborHead(w, CBOR_TAG, TOON_CBOR_TABLE_TAG);
+            cborHead(w, CBOR_ARRAY, o->array.len + 1);
+            cborHead(w, CBOR_ARRAY, ncols);
+            for (toonObject *c = first->child; c; c = c->next)
+                cborText(w, c->key, strlen(c->key));
+
+            for (size_t i = 0; i < o->array.len; i++) {
+                toonObject *row = o->array.items[i];
+                toonObject *hint = row->child;
+                cborHead(w, CBOR_ARRAY, ncols);
+                for (toonObject *c = first->child; c; c = c->next) {
+                    cborScalar(w, rowLookup(row, hint, c->key));
+                    if (hint) hint = hint->next;
+                }
+            }
+            break;
+        }
+        cborHead(w, CBOR_ARRAY, o->array.len);
+        for (size_t i = 0; i < o->array.len; i++)
+            cborValue(w, o->array.items[i], flags);
+        break;
+    default:
+        cborScalar(w, o);
+        break;
+    }
+}
+
+/* Encode 'obj' as one CBOR data item. A keyed object is encoded by value;
+ * its key is not part of the item. */
+void TOONc_writeCBOR(toonWriter *w, toonObject *obj, int flags) {
+    if (!w || !obj) return;
+    cborValue(w, obj, flags);
+}
+
+/* Encode 'obj' as CBOR into a newly allocated buffer (release with free()). */
+unsigned char *TOONc_toCBOR(toonObject *obj, size_t *len, int flags) {
+    toonWriter w;
+    TOONc_writerInitMemory(&w);
+    TOONc_writeCBOR(&w, obj, flags);
+    return (unsigned char *)TOONc_writerRelease(&w, len);
+}
+
+typedef struct cborReader {
+    const unsigned char *p;
+    const unsigned char *end;
+} cborReader;
+
+/* Read an initial byte and its argument. 'indefinite' is set for
+ * additional information 31. Returns -1 on truncated or reserved input. */
+static int cborReadHead(cborReader *r, int *major, uint64_t *arg, int *indefinite) {
+    if (r->p >= r->end) return -1;
+    unsigned char ib = *r->p++;
+    int info = ib & 0x1F;
+
+    *major = ib >> 5;
+    *indefinite = 0;
+
+    if (info < 24) {
+        *arg = info;
+        return 0;
+    }
+    if (info == 31) {
+        *indefinite = 1;
+        *arg = 0;
+        return 0;
+    }
+    if (info > 27) return -1;
+
+    size_t n = (size_t)1 << (info - 24);
+    if ((size_t)(r->end - r->p) < n) return -1;
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) v = (v << 8) | r->p[i];
+    r->p += n;
+    *arg = v;
+    return 0;
+}
+
+static double cborHalf(uint16_t h) {
+    int exp = (h >> 10) & 0x1F;
+    int mant = h & 0x3FF;
+    double v;
+    if (exp == 0) v = ldexp(mant, -24);
+    else if (exp != 31) v = ldexp(mant + 1024, exp - 25);
+    else v = mant == 0 ? HUGE_VAL : NAN;
+    return (h & 0x8000) ? -v : v;
+}
+
+/* Read a text or byte string (definite or chunked) into a new buffer. */
+static char *cborReadString(cborReader *r, int major, uint64_t arg,
+        int indefinite, size_t *len) {
+    if (!indefinite) {
+        if (arg > (uint64_t)(r->end - r->p)) return NULL;
+        char *s = tmalloc((size_t)arg + 1);
+        memcpy(s, r->p, (size_t)arg);
+        s[arg] = '\0';
+        r->p += arg;
+        *len = (size_t)arg;
+        return s;
+    }
+
+    size_t n = 0, cap = 64;
+    char *s = tmalloc(cap);
+    for (;;) {
+        if (r->p < r->end && *r->p == CBOR_BREAK) {
+            r->p++;
+            s[n] = '\0';
+            *len = n;
+            return s;
+        }
+        int cm, cind;
+        uint64_t clen;
+        if (cborReadHead(r, &cm, &clen, &cind) != 0 || cm != major || cind ||
+                clen > (uint64_t)(r->end - r->p))
+            break;
+        if (n + clen + 1 > cap) {
+            while (n + clen + 1 > cap) cap *= 2;
+            s = trealloc(s, cap);
+        }
+        memcpy(s + n, r->p, (size_t)clen);
+        n += (size_t)clen;
+        r->p += clen;
+    }
+    tfree(s);
+    return NULL;
+}
+
+static toonObject *cborReadValue(cborReader *r, int depth);
+
+/* True (and consumed) if an indefinite container ends here. */
+static int cborAtBreak(cborReader *r) {
+    if (r->p < r->end && *r->p == CBOR_BREAK) {
+        r->p++;
+        return 1;
+    }
+    return 0;
+}
+
+/* Convert [[cols], [row]...] (the content of a table tag) into a list of
+ * row objects. Returns NULL if the content doesn't have that shape. */
+static toonObject *cborExpandTable(toonObject *content) {
+    if (content->kvtype != KV_LIST || content->array.len == 0) return NULL;
+    toonObject *header = content->array.items[0];
+    if (header->kvtype != KV_LIST) return NULL;
+
+    size_t ncols = header->array.len;
+    for (size_t c = 0; c < ncols; c++) {
+        if (header->array.items[c]->kvtype != KV_STRING) return NULL;
+    }
+    for (size_t i = 1; i < content->array.len; i++) {
+        toonObject *row = content->array.items[i];
+        if (row->kvtype != KV_LIST || row->array.len != ncols) return NULL;
+    }
+
+    toonObject *list = newListObj();
+    for (size_t i = 1; i < content->array.len; i++) {
+        toonObject *row = content->array.items[i];
+        toonObject *obj = newObject(KV_OBJ);
+        toonObject *last = NULL;
+        for (size_t c = 0; c < ncols; c++) {
+            toonObject *cell = row->array.items[c];
+            toonObject *name = header->array.items[c];
+            cell->key = tmalloc(name->str.len + 1);
+            memcpy(cell->key, name->str.ptr, name->str.len + 1);
+            cell->indent = 1;
+            if (last) last->next = cell;
+            else obj->child = cell;
+            last = cell;
+        }
+        /* The cells now belong to the row object. */
+        row->array.len = 0;
+        listPush(list, obj);
+    }
+    return list;
+}
+
+static toonObject *cborReadValue(cborReader *r, int depth) {
+    int major, indefinite;
+    uint64_t arg;
+
+    if (depth >= JSON_MAX_DEPTH) return NULL;
+    const unsigned char *head = r->p;
+    if (cborReadHead(r, &major, &arg, &indefinite) != 0) return NULL;
+
+    switch (major) {
+    case CBOR_UINT:
+    case CBOR_NEGINT:
+        if (indefinite) return NULL;
+        if (major == CBOR_UINT) {
+            if (arg <= INT_MAX) return newIntObj((int)arg);
+            return newDoubleObj((double)arg);
+        }
+        if (arg <= (uint64_t)INT_MAX) return newIntObj(-(int)arg - 1);
+        return newDoubleObj(-1.0 - (double)arg);
+
+    case CBOR_BYTES:
+    case CBOR_TEXT: {
+        size_t len;
+        char *s = cborReadString(r, major, arg, indefinite, &len);
+        if (!s) return NULL;
+        toonObject *o = newObject(KV_STRING);
+        o->str.ptr = s;
+        o->str.len = len;
+        return o;
+    }
+
+    case CBOR_ARRAY: {
+        toonObject *list = newListObj();
+        for (uint64_t i = 0; indefinite || i < arg; i++) {
+            if (indefinite && cborAtBreak(r)) return list;
+
+            /* Every item takes at least one byte, so a count larger than
+             * the rest of the input is rejected before reading on. */
+            toonObject *item = NULL;
+            if (indefinite || arg - i <= (uint64_t)(r->end - r->p))
+                item = cborReadValue(r, depth + 1);
+            if (!item) {
+                TOONc_free(list);
+                return NULL;
+            }
+            listPush(list, item);
+        }
+        return list;
+    }
+
+    case CBOR_MAP: {
+        toonObject *obj = newObject(KV_OBJ);
+        toonObject *last = NULL;
+        uint64_t i = 0;
+        for (;; i++) {
+            if (indefinite ? cborAtBreak(r) : i == arg) return obj;
+            if (!indefinite && arg - i > (uint64_t)(r->end - r->p)) break;
+
+            toonObject *key = cborReadValue(r, depth + 1);
+            if (!key) break;
+            char *name;
+            if (key->kvtype == KV_STRING) {
+                name = key->str.ptr;
+                key->str.ptr = NULL;
+                key->kvtype = KV_NULL;
+            } else if (key->kvtype == KV_INT) {
+                name = tmalloc(16);
+                name[formatInt(name, key->i)] = '\0';
+            } else {
+                TOONc_free(key);
+                break;
+            }
+            TOONc_free(key);
+
+            toonObject *value = cborReadValue(r, depth + 1);
+            if (!value) {
+                tfree(name);
+                break;
+            }
+            value->key = name;
+            value->indent = depth;
+            if (last) last->next = value;
+            else obj->child = value;
+            last = value;
+        }
+        TOONc_free(obj);
+        return NULL;
+    }
+
+    case CBOR_TAG: {
+        if (indefinite) return NULL;
+        toonObject *content = cborReadValue(r, depth + 1);
+        if (!content || arg != TOON_CBOR_TABLE_TAG) return content;
+        toonObject *table = cborExpandTable(content);
+        if (!table) return content;
+        TOONc_free(content);
+        return table;
+    }
+
+    default: /* CBOR_SIMPLE */
+        if (indefinite) return NULL;
+        switch (*head & 0x1F) {
+        case 20: return newBoolObj(0);
+        case 21: return newBoolObj(1);
+        case 25: return newDoubleObj(cborHalf((uint16_t)arg));
+        case 26: {
+            uint32_t u = (uint32_t)arg;
+            float f;
+            memcpy(&f, &u, 4);
+            return newDoubleObj(f);
+        }
+        case 27: {
+            double d;
+            memcpy(&d, &arg, 8);
+            return newDoubleObj(d);
+        }
+        default:
+            /* null, undefined and unassigned simple values */
+            return newNullObj();
+        }
+    }
+}
+
+/* Decode one CBOR data item. Returns NULL if the input is malformed,
+ * truncated, nested deeper than the parser allows, or has trailing bytes. */
+toonObject *TOONc_parseCBOR(const void *buf, size_t len) {
+    if (!buf) return NULL;
+
+    cborReader r;
+    r.p = buf;
+    r.end = r.p + len;
+
+    toonObject *o = cborReadValue(&r, 0);
+    if (o && r.p != r.end) {
+        TOONc_free(o);
+        return NULL;
+    }
+    return o;
+}
+
+/* -----------------------------------------------------------------------------
+ * Shared documents and the document cache
+ *
+ * A toonDoc wraps a parsed tree with an atomic reference count so that
+ * several modules (and threads) can hold the same document: the tree is
+ * freed when the last reference is released, and nobody modifies it in the
+ * meantime. The read paths (TOONc_get(), array access, walking child and
+ * next, and every emitter) keep no state outside their stack frame, so
+ * any number of threads may run them on a document at once. The release
+ * that frees the tree is ordered after every other holder's reads by the
+ * acq_rel decrement.
+ *
+ * A toonCache hands out toonDocs by path. Each lookup stat()s the file and
+ * reuses the cached document while mtime, size, inode and device are
+ * unchanged; otherwise the file is parsed again. Parsing happens outside
+ * the cache lock, so a slow parse never blocks lookups of other files (two
+ * threads missing on the same file at once may both parse it; the second
+ * result is dropped). Entries are kept in LRU order and the least recently
+ * used are dropped while the total size is over the byte budget. Dropping
+ * an entry only releases the cache's reference: documents still held by
+ * callers stay valid.
+ * -------------------------------------------------------------------------- */
+
+/* Approximate heap footprint of a tree, for the cache budget. */
+static size_t treeBytes(toonObject *o) {
+    size_t total = 0;
+    for (; o; o = o->next) {
+        total += sizeof(toonObject);
+        if (o->key) total += strlen(o->key) + 1;
+        if (o->kvtype == KV_STRING) {
+            total += o->str.len + 1;
+        } else if (o->kvtype == KV_LIST) {
+            total += o->array.capacity * sizeof(toonObject *);
+            for (size_t i = 0; i < o->array.len; i++)
+                total += treeBytes(o->array.items[i]);
+        } else if (o->kvtype == KV_OBJ) {
+            total += treeBytes(o->child);
+        }
+    }
+    return total;
+}
+
+/* Wrap a tree in a document holding one reference. */
+static toonDoc *docNew(toonObject *root) {
+    toonDoc *doc = tmalloc(sizeof(*doc));
+    doc->root = root;
+    doc->bytes = sizeof(*doc) + treeBytes(root);
+    doc->refs = 1;
+    doc->source = NULL;
+    return doc;
+}
+
+static void docSourceFree(toonDoc *doc);
+
+toonDoc *TOONc_docRetain(toonDoc *doc) {
+    if (doc) __atomic_add_fetch(&doc->refs, 1, __ATOMIC_RELAXED);
+    return doc;
+}
+
+/* Freeze a tree into a document holding one reference. The document owns
+ * the tree from now on. */
+toonDoc *TOONc_docFromTree(toonObject *root) {
+    return root ? docNew(root) : NULL;
+}
+
+toonDoc *TOONc_docParseString(const char *str) {
+    return TOONc_docFromTree(TOONc_parseString(str));
+}
+
+toonDoc *TOONc_docParseFile(FILE *fp) {
+    return TOONc_docFromTree(TOONc_parseFile(fp));
+}
+
+/* Drop a reference; the last one frees the tree. */
+void TOONc_docRelease(toonDoc *doc) {
+    if (!doc) return;
+    if (__atomic_sub_fetch(&doc->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (doc->source) docSourceFree(doc);
+        else TOONc_free(doc->root);
+        tfree(doc);
+    }
+}
+
+typedef struct cacheEntry {
+    char *path;
+    struct stat st;               /* File identity when it was parsed. */
+    toonDoc *doc;                 /* The cache's own reference. */
+    struct cacheEntry *hnext;     /* Hash chain. */
+    struct cacheEntry *prev, *next; /* LRU list, most recent first. */
+} cacheEntry;
+
+struct toonCache {
+    pthread_mutex_t lock;
+    cacheEntry **buckets;
+    size_t nbuckets, count;
+    cacheEntry *head, *tail;
+    size_t bytes, budget;
+    size_t hits, misses;
+};
+
+static int sameFile(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev &&
+           a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static cacheEntry **cacheSlot(toonCache *c, const char *path) {
+    cacheEntry **slot = &c->buckets[snapHash(path, strlen(path)) & (c->nbuckets - 1)];
+    while (*slot && strcmp((*slot)->path, path) != 0) slot = &(*slot)->hnext;
+    return slot;
+}
+
+static void cacheUnlinkLRU(toonCache *c, cacheEntry *e) {
+    if (e->prev) e->prev->next = e->next;
+    else c->head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else c->tail = e->prev;
+}
+
+static void cachePushFront(toonCache *c, cacheEntry *e) {
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head) c->head->prev = e;
+    c->head = e;
+    if (!c->tail) c->tail = e;
+}
+
+/* Remove an entry from the index and the LRU list and drop its
+ * reference. Called with the lock held. */
+static void cacheDrop(toonCache *c, cacheEntry *e) {
+    cacheEntry **slot = cacheSlot(c, e->path);
+    *slot = e->hnext;
+    cacheUnlinkLRU(c, e);
+    c->bytes -= e->doc->bytes;
+    c->count--;
+    TOONc_docRelease(e->doc);
+    tfree(e->path);
+    tfree(e);
+}
+
+static void cacheGrow(toonCache *c) {
+    size_t n = c->nbuckets * 2;
+    cacheEntry **b = tcalloc(n, sizeof(cacheEntry *));
+    for (size_t i = 0; i < c->nbuckets; i++) {
+        cacheEntry *e = c->buckets[i];
+        while (e) {
+            cacheEntry *next = e->hnext;
+            size_t h = snapHash(e->path, strlen(e->path)) & (n - 1);
+            e->hnext = b[h];
+            b[h] = e;
+            e = next;
+        }
+    }
+    tfree(c->buckets);
+    c->buckets = b;
+    c->nbuckets = n;
+}
+
+/* Create a cache holding at most 'budget' bytes of parsed documents
+ * (0 for no limit). */
+toonCache *TOONc_cacheNew(size_t budget) {
+    toonCache *c = tcalloc(1, sizeof(*c));
+    pthread_mutex_init(&c->lock, NULL);
+    c->nbuckets = 16;
+    c->buckets = tcalloc(c->nbuckets, sizeof(cacheEntry *));
+    c->budget = budget;
+    return c;
+}
+
+/* Drop every entry. Documents still retained by callers stay valid. */
+void TOONc_cacheFree(toonCache *c) {
+    if (!c) return;
+    while (c->head) cacheDrop(c, c->head);
+    pthread_mutex_destroy(&c->lock);
+    tfree(c->buckets);
+    tfree(c);
+}
+
+/* Read a whole file into a NUL-terminated buffer, recording the identity
+ * of the file actually read (which may differ from an earlier stat() if it
+ * was replaced). Returns NULL if it can't be opened. */
+static char *readFileAt(const char *path, size_t *len, struct stat *st) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    if (fstat(fd, st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st->st_size, got = 0;
+    char *source = tmalloc(size + 1);
+    while (got < size) {
+        ssize_t n = read(fd, source + got, size - got);
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+    source[got] = '\0';
+    *len = got;
+    return source;
+}
+
+/* Parse the file at 'path' into a new document. */
+static toonDoc *cacheLoad(const char *path, struct stat *st) {
+    size_t len;
+    char *source = readFileAt(path, &len, st);
+    if (!source) return NULL;
+
+    toonObject *root = parse(source, NULL);
+    tfree(source);
+    if (!root) return NULL;
+    return docNew(root);
+}
+
+/* Return the parsed document for 'path' with a reference for the caller
+ * (release it with TOONc_docRelease()), or NULL if the file can't be read
+ * or parsed. */
+toonDoc *TOONc_cacheGet(toonCache *c, const char *path) {
+    if (!c || !path) return NULL;
+
+    struct stat now;
+    if (stat(path, &now) == -1) return NULL;
+
+    pthread_mutex_lock(&c->lock);
+    cacheEntry *e = *cacheSlot(c, path);
+    if (e && sameFile(&e->st, &now)) {
+        cacheUnlinkLRU(c, e);
+        cachePushFront(c, e);
+        c->hits++;
+        toonDoc *doc = TOONc_docRetain(e->doc);
+        pthread_mutex_unlock(&c->lock);
+        return doc;
+    }
+    c->misses++;
+    pthread_mutex_unlock(&c->lock);
+
+    struct stat st;
+    toonDoc *doc = cacheLoad(path, &st);
+    if (!doc) return NULL;
+
+    pthread_mutex_lock(&c->lock);
+    e = *cacheSlot(c, path);
+    if (e && sameFile(&e->st, &st)) {
+        /* Another thread loaded the same file meanwhile: share its copy. */
+        toonDoc *shared = TOONc_docRetain(e->doc);
+        pthread_mutex_unlock(&c->lock);
+        TOONc_docRelease(doc);
+        return shared;
+    }
+    if (e) cacheDrop(c, e);
+
+    e = tmalloc(sizeof(*e));
+    size_t len = strlen(path);
+    e->path = tmalloc(len + 1);
+    memcpy(e->path, path, len + 1);
+    e->st = st;
+    e->doc = TOONc_docRetain(doc);
+
+    if (c->count + 1 > c->nbuckets) cacheGrow(c);
+    cacheEntry **slot = cacheSlot(c, path);
+    e->hnext = *slot;
+    *slot = e;
+    cachePushFront(c, e);
+    c->count++;
+    c->bytes += doc->bytes;
+
+    /* Evict from the cold end, but always keep the document just loaded. */
+    while (c->budget && c->bytes > c->budget && c->tail != e)
+        cacheDrop(c, c->tail);
+    pthread_mutex_unlock(&c->lock);
+    return doc;
+}
+
+/* Snapshot of the cache counters; any pointer may be NULL. */
+void TOONc_cacheStats(toonCache *c, size_t *hits, size_t *misses, size_t *bytes) {
+    if (!c) return;
+    pthread_mutex_lock(&c->lock);
+    if (hits) *hits = c->hits;
+    if (misses) *misses = c->misses;
+    if (bytes) *bytes = c->bytes;
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* -----------------------------------------------------------------------------
+ * Hot-swappable document handles
+ *
+ * A toonHandle publishes the current version of a document to readers that
+ * never take a lock. A reader announces itself on the counter matching the
+ * parity of the current epoch, checks that the epoch didn't move, takes a
+ * reference on the current document and leaves the counter again: from
+ * then on the document's own refcount keeps it alive. A writer (writers
+ * are serialized by a mutex) swaps the pointer, advances the epoch and waits
+ * for the previous parity's counter to drain. After that no reader can
+ * still be about to retain the old document, so the handle's reference can
+ * be dropped; the tree is freed when the last reader releases it.
+ * -------------------------------------------------------------------------- */
+
+struct toonHandle {
+    toonDoc *doc;               /* Current document, one reference held. */
+    unsigned long epoch;
+    unsigned long readers[2];   /* Readers inside acquire, by epoch parity. */
+    pthread_mutex_t lock;       /* Serializes publishers. */
+};
+
+/* Create a handle publishing 'doc'; the handle takes over the caller's
+ * reference. */
+toonHandle *TOONc_handleNew(toonDoc *doc) {
+    toonHandle *h = tcalloc(1, sizeof(*h));
+    h->doc = doc;
+    pthread_mutex_init(&h->lock, NULL);
+    return h;
+}
+
+/* Drop the handle's reference. No reader may be inside acquire. */
+void TOONc_handleFree(toonHandle *h) {
+    if (!h) return;
+    TOONc_docRelease(h->doc);
+    pthread_mutex_destroy(&h->lock);
+    tfree(h);
+}
+
+/* Return the current document with a reference for the caller, to be
+ * dropped with TOONc_docRelease(). Lock-free: it only retries when a
+ * publisher advances the epoch at the same moment. */
+toonDoc *TOONc_handleAcquire(toonHandle *h) {
+    unsigned long e, *slot;
+    for (;;) {
+        e = __atomic_load_n(&h->epoch, __ATOMIC_SEQ_CST);
+        slot = &h->readers[e & 1];
+        __atomic_add_fetch(slot, 1, __ATOMIC_SEQ_CST);
+        if (LIKELY(__atomic_load_n(&h->epoch, __ATOMIC_SEQ_CST) == e)) break;
+        __atomic_sub_fetch(slot, 1, __ATOMIC_RELEASE);
+    }
+    toonDoc *doc = TOONc_docRetain(__atomic_load_n(&h->doc, __ATOMIC_ACQUIRE));
+    __atomic_sub_fetch(slot, 1, __ATOMIC_RELEASE);
+    return doc;
+}
+
+/* Publish 'doc' (taking over the caller's reference) and drop the handle's
+ * reference on the previous document once no reader can still pick it up. */
+void TOONc_handlePublish(toonHandle *h, toonDoc *doc) {
+    pthread_mutex_lock(&h->lock);
+    toonDoc *old = __atomic_exchange_n(&h->doc, doc, __ATOMIC_ACQ_REL);
+    unsigned long e = __atomic_fetch_add(&h->epoch, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&h->readers[e & 1], __ATOMIC_ACQUIRE) != 0)
+        sched_yield();
+    pthread_mutex_unlock(&h->lock);
+    TOONc_docRelease(old);
+}
+
+/* -----------------------------------------------------------------------------
+ * Incremental reloads and file watching
+ *
+ * A document built by TOONc_docReload() keeps its source text and splits it
+ * into top-level sections (see sectionMarks). When the text changes, the
+ * leading and trailing sections that lie in the unchanged prefix and suffix
+ * are shared with the previous document and only the text between them is
+ * parsed. A prefix section is kept only if the head line of the section
+ * after it is unchanged too, since that member is what resets the parser;
+ * the parse of the changed middle stops at the first line that used to
+ * start a section inside the unchanged suffix.
+ *
+ * Sections are refcounted and own their members. A document's root holds
+ * shallow copies of the members (a copy only differs in its next pointer),
+ * so documents sharing a section never share a sibling chain.
+ *
+ * The watcher uses inotify on the directories of the watched files (editors
+ * usually replace a file by renaming over it, which a watch on the file
+ * itself would miss) and reloads each changed file once per dispatch.
+ * -------------------------------------------------------------------------- */
+
+typedef struct toonSection {
+    toonObject *members;    /* Sibling chain, NULL-terminated */
+    size_t bytes;
+    int refs;               /* Atomic: documents using the section */
+    int line_rows;          /* First member is a table with one row per line */
+} toonSection;
+
+struct toonDocSource {
+    char *text;
+    size_t len;
+    size_t count, cap;
+    size_t *starts;         /* Offset of each section in text */
+    toonSection **sections;
+};
+
+static void sectionRelease(toonSection *sec) {
+    if (__atomic_sub_fetch(&sec->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        TOONc_free(sec->members);
+        tfree(sec);
+    }
+}
+
+static void docSourceFree(toonDoc *doc) {
+    struct toonDocSource *src = doc->source;
+    toonObject *copy = doc->root->child;
+    while (copy) {
+        toonObject *next = copy->next;
+        if (copy->kvtype == KV_OBJ) indexFree(copy->index);
+        tfree(copy);
+        copy = next;
+    }
+    doc->root->child = NULL;
+    TOONc_free(doc->root);
+    for (size_t i = 0; i < src->count; i++)
+        sectionRelease(src->sections[i]);
+    tfree(src->starts);
+    tfree(src->sections);
+    tfree(src->text);
+    tfree(src);
+}
+
+typedef struct docBuilder {
+    struct toonDocSource *src;
+    toonObject *root, *last;
+    size_t bytes;
+} docBuilder;
+
+/* Append a section, taking over one reference on it. */
+static void docAddSection(docBuilder *b, size_t start, toonSection *sec) {
+    struct toonDocSource *src = b->src;
+    if (src->count == src->cap) {
+        src->cap = src->cap ? src->cap * 2 : 16;
+        src->starts = trealloc(src->starts, src->cap * sizeof(size_t));
+        src->sections = trealloc(src->sections, src->cap * sizeof(toonSection *));
+    }
+    src->starts[src->count] = start;
+    src->sections[src->count++] = sec;
+
+    for (toonObject *m = sec->members; m; m = m->next) {
+        toonObject *copy = tmalloc(sizeof(*copy));
+        *copy = *m;
+        copy->next = NULL;
+        if (copy->kvtype == KV_OBJ) copy->index = NULL;  /* Each copy has its own */
+        if (b->last) b->last->next = copy;
+        else b->root->child = copy;
+        b->last = copy;
+        b->bytes += sizeof(*copy);
+    }
+    b->bytes += sec->bytes;
+}
+
+/* Cut the members from *chain up to 'until' into a new section. */
+static void docAddRun(docBuilder *b, size_t start, toonObject **chain,
+        toonObject *until, int line_rows) {
+    toonSection *sec = tmalloc(sizeof(*sec));
+    sec->line_rows = line_rows;
+    sec->members = NULL;
+    if (*chain != until) {
+        toonObject *last = *chain;
+        while (last->next != until) last = last->next;
+        last->next = NULL;
+        sec->members = *chain;
+        *chain = until;
+    }
+    sec->bytes = sizeof(*sec) + treeBytes(sec->members);
+    sec->refs = 1;
+    docAddSection(b, start, sec);
+}
+
+/* Turn what parseFrom() produced from offset 'from' into sections. */
+static void docAddParsed(docBuilder *b, toonObject *parsed, size_t from, const sectionMarks *m) {
+    toonObject *chain = parsed->child;
+    parsed->child = NULL;
+    TOONc_free(parsed);
+
+    /* Text before the first head, if any, still forms a section. */
+    size_t first = m->count ? m->offsets[0] : m->end;
+    if (first > from || chain != (m->count ? m->heads[0] : NULL))
+        docAddRun(b, from, &chain, m->count ? m->heads[0] : NULL, 0);
+    for (size_t k = 0; k < m->count; k++)
+        docAddRun(b, m->offsets[k], &chain, k + 1 < m->count ? m->heads[k + 1] : NULL,
+                  m->line_rows[k]);
+}
+
+static void sectionRetain(toonSection *sec) {
+    __atomic_add_fetch(&sec->refs, 1, __ATOMIC_RELAXED);
+}
+
+/* Build a document for 'text' (which it takes over) sharing sections with
+ * 'prev'. The first 'pre' and last 'suf' bytes are known to match the old
+ * text; pass DOC_UNKNOWN to have them measured. */
+#define DOC_UNKNOWN ((size_t)-1)
+
+static toonDoc *docRebuild(toonDoc *prev, char *text, size_t len, size_t pre, size_t suf) {
+    struct toonDocSource *old = prev ? prev->source : NULL;
+
+    docBuilder b = {0};
+    b.src = tcalloc(1, sizeof(*b.src));
+    b.src->text = text;
+    b.src->len = len;
+    b.root = newObject(KV_OBJ);
+
+    size_t reuse = 0, tail = 0, nstops = 0;
+    size_t *stops = NULL, *stop_index = NULL;
+    size_t suffix_old = 0, suffix_new = 0;
+    if (old && old->count) {
+        size_t min = old->len < len ? old->len : len;
+        if (pre == DOC_UNKNOWN) {
+            pre = 0;
+            while (pre < min && old->text[pre] == text[pre]) pre++;
+        }
+        if (suf == DOC_UNKNOWN) {
+            suf = 0;
+            while (suf < min - pre && old->text[old->len - 1 - suf] == text[len - 1 - suf])
+                suf++;
+        }
+        suffix_old = old->len - suf;
+        suffix_new = len - suf;
+
+        /* Start at the section holding the first changed byte. */
+        while (reuse + 1 < old->count && old->starts[reuse + 1] <= pre) reuse++;
+
+        stops = tmalloc(old->count * sizeof(size_t));
+        stop_index = tmalloc(old->count * sizeof(size_t));
+        for (size_t j = reuse + 1; j < old->count; j++) {
+            if (old->starts[j] < suffix_old) continue;
+            stops[nstops] = suffix_new + (old->starts[j] - suffix_old);
+            stop_index[nstops++] = j;
+        }
+        tail = old->count;
+    }
+
+    /* The sections before 'from' can be kept only if the line at 'from'
+     * still holds a top-level member (or is where parsing stops): otherwise
+     * what follows may nest into the previous section, so step back. */
+    sectionMarks m;
+    toonObject *parsed;
+    size_t from;
+    for (;;) {
+        from = reuse ? old->starts[reuse] : 0;
+        memset(&m, 0, sizeof(m));
+        m.stops = stops;
+        m.nstops = nstops;
+        parsed = parseFrom(text, text + from, NULL, &m);
+        if (reuse == 0 || m.end == from || (m.count && m.offsets[0] == from))
+            break;
+        TOONc_free(parsed);
+        tfree(m.offsets);
+        tfree(m.heads);
+        tfree(m.line_rows);
+        reuse--;
+    }
+
+    for (size_t i = 0; i < reuse; i++) {
+        sectionRetain(old->sections[i]);
+        docAddSection(&b, old->starts[i], old->sections[i]);
+    }
+    docAddParsed(&b, parsed, from, &m);
+    if (m.end < len) {
+        for (size_t k = 0; k < nstops; k++)
+            if (stops[k] == m.end) tail = stop_index[k];
+        for (size_t j = tail; j < old->count; j++) {
+            sectionRetain(old->sections[j]);
+            docAddSection(&b, suffix_new + (old->starts[j] - suffix_old), old->sections[j]);
+        }
+    }
+    tfree(m.offsets);
+    tfree(m.heads);
+    tfree(m.line_rows);
+    tfree(stops);
+    tfree(stop_index);
+
+    toonDoc *doc = tmalloc(sizeof(*doc));
+    doc->root = b.root;
+    doc->bytes = sizeof(*doc) + sizeof(*b.src) + len + 1 + sizeof(toonObject) + b.bytes;
+    doc->refs = 1;
+    doc->source = b.src;
+    return doc;
+}
+
+/* TOONc_docReload() for a buffer the new document takes over. */
+static toonDoc *docReloadOwned(toonDoc *prev, char *text, size_t len) {
+    struct toonDocSource *old = prev ? prev->source : NULL;
+    if (old && old->len == len && memcmp(old->text, text, len) == 0) {
+        tfree(text);
+        return TOONc_docRetain(prev);
+    }
+    return docRebuild(prev, text, len, DOC_UNKNOWN, DOC_UNKNOWN);
+}
+
+/* Parse 'text' into a new document, sharing the top-level sections that
+ * didn't change with 'prev' (which may be NULL). Returns 'prev' itself,
+ * with a new reference, if the text is identical. */
+toonDoc *TOONc_docReload(toonDoc *prev, const char *text, size_t len) {
+    if (!text) return NULL;
+    char *copy = tmalloc(len + 1);
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    return docReloadOwned(prev, copy, len);
+}
+
+static size_t countLines(const char *p, size_t n) {
+    size_t lines = 0;
+    const char *end = p + n;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        lines++;
+        p++;
+    }
+    return lines;
+}
+
+/* Edit in place the rows of a table whose rows are one line each, when the
+ * edit stays within its row lines and keeps the number of lines: the table
+ * then consumes the same lines as before and only the touched rows change.
+ * Returns -1 if this doesn't apply. */
+static int reparseRows(toonDoc *doc, size_t si, char *text, size_t len,
+        size_t off, size_t removed, size_t inserted) {
+    struct toonDocSource *src = doc->source;
+    toonSection *sec = src->sections[si];
+    const char *old = src->text;
+    if (!sec->line_rows || __atomic_load_n(&sec->refs, __ATOMIC_ACQUIRE) != 1)
+        return -1;
+
+    size_t head = src->starts[si];
+    const char *nl = memchr(old + head, '\n', src->len - head);
+    if (!nl || off <= (size_t)(nl - old)) return -1;
+    size_t lines = countLines(old + off, removed);
+    if (lines != countLines(text + off, inserted)) return -1;
+
+    /* The touched lines, as row indices. */
+    size_t first = off;
+    while (old[first - 1] != '\n') first--;
+    const char *e = memchr(old + off + removed, '\n', src->len - off - removed);
+    size_t old_end = e ? (size_t)(e - old) : src->len;
+    size_t new_end = old_end - removed + inserted;
+    size_t row = countLines(nl + 1, old + first - (nl + 1));
+    size_t count = lines + 1;
+    toonObject *table = sec->members;
+    if (row + count > table->array.len) return -1;
+
+    /* Column names come from the unchanged header line. */
+    toonParser parser = {0};
+    parser.source = text;
+    parser.p = text + head;
+    size_t keylen;
+    parseIndent(&parser);
+    parseKey(&parser, &keylen);
+    parseArraySize(&parser);
+    int ncols;
+    char **cols = parseTableColumns(&parser, &ncols);
+    parser.p = text + first - 1;    /* The newline before the first row. */
+    toonObject *rows = parseTableRows(&parser, cols, ncols, (int)count);
+    for (int i = 0; i < ncols; i++) tfree(cols[i]);
+    tfree(cols);
+    if (parser.ragged || rows->array.len != count || parser.p != text + new_end) {
+        TOONc_free(rows);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        TOONc_free(table->array.items[row + i]);
+        table->array.items[row + i] = rows->array.items[i];
+    }
+    rows->array.len = 0;
+    TOONc_free(rows);
+
+    for (size_t j = si + 1; j < src->count; j++)
+        src->starts[j] = src->starts[j] - removed + inserted;
+    tfree(src->text);
+    src->text = text;
+    src->len = len;
+    doc->bytes = doc->bytes - removed + inserted;
+    return 0;
+}
+
+/* Apply an edit to the source of a document and update its tree to match
+ * a full parse of the new text. The unit reparsed is a whole top-level
+ * section: an edit anywhere below a top-level member reparses that member
+ * with everything nested in it. The one finer case is an edit inside the
+ * rows of a table with one row per line, which reparses only the touched
+ * rows. The document must not be shared (one reference). Returns 0, or -1
+ * if the document has no source text, is shared or the range is invalid. */
+int TOONc_reparse(toonDoc *doc, size_t offset, size_t removed, const char *inserted) {
+    if (!doc || !doc->source) return -1;
+    struct toonDocSource *src = doc->source;
+    if (offset > src->len || removed > src->len - offset) return -1;
+    if (__atomic_load_n(&doc->refs, __ATOMIC_ACQUIRE) != 1) return -1;
+
+    size_t ins = inserted ? strlen(inserted) : 0;
+    if (!removed && !ins) return 0;
+
+    size_t len = src->len - removed + ins;
+    char *text = tmalloc(len + 1);
+    memcpy(text, src->text, offset);
+    if (ins) memcpy(text + offset, inserted, ins);
+    memcpy(text + offset + ins, src->text + offset + removed, src->len - offset - removed);
+    text[len] = '\0';
+
+    size_t si = 0;
+    while (si + 1 < src->count && src->starts[si + 1] <= offset) si++;
+    if (src->count && reparseRows(doc, si, text, len, offset, removed, ins) == 0)
+        return 0;
+
+    /* Rebuild into a new document and swap it in: releasing the swapped-out
+     * parts drops the sections that weren't carried over. */
+    toonDoc *next = docRebuild(doc, text, len, offset, src->len - offset - removed);
+    toonObject *root = doc->root;
+    size_t bytes = doc->bytes;
+    doc->root = next->root;
+    doc->source = next->source;
+    doc->bytes = next->bytes;
+    next->root = root;
+    next->source = src;
+    next->bytes = bytes;
+    TOONc_docRelease(next);
+    return 0;
+}
+
+#ifdef __linux__
+
+typedef struct watchEntry {
+    char *path;
+    const char *name;       /* Basename, inside path */
+    int wd;
+    int pending;
+    toonDoc *doc;
+    toonWatchCallback cb;
+    void *ctx;
+} watchEntry;
+
+struct toonWatcher {
+    int fd;
+    watchEntry *entries;
+    size_t count, cap;
+};
+
+toonWatcher *TOONc_watchNew(void) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) return NULL;
+    toonWatcher *w = tcalloc(1, sizeof(*w));
+    w->fd = fd;
+    return w;
+}
+
+void TOONc_watchFree(toonWatcher *w) {
+    if (!w) return;
+    for (size_t i = 0; i < w->count; i++) {
+        TOONc_docRelease(w->entries[i].doc);
+        tfree(w->entries[i].path);
+    }
+    tfree(w->entries);
+    close(w->fd);
+    tfree(w);
+}
+
+/* Load 'path' and watch it from now on. Returns 0, or -1 if the file
+ * can't be read or its directory can't be watched. */
+int TOONc_watchAdd(toonWatcher *w, const char *path, toonWatchCallback cb, void *ctx) {
+    if (!w || !path) return -1;
+
+    size_t plen = strlen(path);
+    char *copy = tmalloc(plen + 1);
+    memcpy(copy, path, plen + 1);
+    char *slash = strrchr(copy, '/');
+    int wd;
+    if (!slash) {
+        wd = inotify_add_watch(w->fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO);
+    } else if (slash == copy) {
+        wd = inotify_add_watch(w->fd, "/", IN_CLOSE_WRITE | IN_MOVED_TO);
+    } else {
+        *slash = '\0';
+        wd = inotify_add_watch(w->fd, copy, IN_CLOSE_WRITE | IN_MOVED_TO);
+        *slash = '/';
+    }
+
+    struct stat st;
+    size_t len;
+    char *text = wd == -1 ? NULL : readFileAt(path, &len, &st);
+    if (!text) {
+        tfree(copy);
+        return -1;
+    }
+
+    if (w->count == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 4;
+        w->entries = trealloc(w->entries, w->cap * sizeof(watchEntry));
+    }
+    watchEntry *e = &w->entries[w->count++];
+    e->path = copy;
+    e->name = slash ? slash + 1 : copy;
+    e->wd = wd;
+    e->pending = 0;
+    e->doc = docReloadOwned(NULL, text, len);
+    e->cb = cb;
+    e->ctx = ctx;
+    return 0;
+}
+
+int TOONc_watchFd(toonWatcher *w) {
+    return w ? w->fd : -1;
+}
+
+/* Current document of a watched file, with a reference for the caller. */
+toonDoc *TOONc_watchDoc(toonWatcher *w, const char *path) {
+    if (!w || !path) return NULL;
+    for (size_t i = 0; i < w->count; i++)
+        if (strcmp(w->entries[i].path, path) == 0)
+            return TOONc_docRetain(w->entries[i].doc);
+    return NULL;
+}
+
+/* Wait up to 'timeout_ms' (-1 forever, 0 to poll) for changes, reload the
+ * changed files and call their callbacks. Returns the number of documents
+ * replaced, or -1 on error. */
+int TOONc_watchDispatch(toonWatcher *w, int timeout_ms) {
+    if (!w) return -1;
+
+    struct pollfd pfd = {w->fd, POLLIN, 0};
+    int rc = poll(&pfd, 1, timeout_ms);
+    if (rc <= 0) return rc == -1 && errno != EINTR ? -1 : 0;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            for (size_t i = 0; i < w->count; i++) {
+                watchEntry *e = &w->entries[i];
+                if ((ev->mask & IN_Q_OVERFLOW) ||
+                    (ev->wd == e->wd && ev->len && strcmp(ev->name, e->name) == 0))
+                    e->pending = 1;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    int reloaded = 0;
+    for (size_t i = 0; i < w->count; i++) {
+        watchEntry *e = &w->entries[i];
+        if (!e->pending) continue;
+        e->pending = 0;
+
+        struct stat st;
+        size_t len;
+        char *text = readFileAt(e->path, &len, &st);
+        if (!text) continue;    /* Gone between the event and now. */
+        toonDoc *doc = docReloadOwned(e->doc, text, len);
+        if (doc == e->doc) {
+            TOONc_docRelease(doc);
+            continue;
+        }
+        toonDoc *old = e->doc;
+        e->doc = doc;
+        if (e->cb) e->cb(e->path, doc, e->ctx);
+        TOONc_docRelease(old);
+        reloaded++;
+    }
+    return reloaded;
+}
+
+#else /* !__linux__ */
+
+toonWatcher *TOONc_watchNew(void) { return NULL; }
+void TOONc_watchFree(toonWatcher *w) { (void)w; }
+int TOONc_watchAdd(toonWatcher *w, const char *path, toonWatchCallback cb, void *ctx) {
+    (void)w; (void)path; (void)cb; (void)ctx;
+    return -1;
+}
+int TOONc_watchFd(toonWatcher *w) { (void)w; return -1; }
+toonDoc *TOONc_watchDoc(toonWatcher *w, const char *path) { (void)w; (void)path; return NULL; }
+int TOONc_watchDispatch(toonWatcher *w, int timeout_ms) { (void)w; (void)timeout_ms; return -1; }
+
+#endif /* __linux__ */
+
 /* -----------------------------------------------------------------------------
  * Cure API function aliases
  *
@@ -35,6 +35,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /* ===================== Key-value types ======================*/
@@ -46,6 +47,20 @@ extern "C" {
 #define KV_OBJ    5
 #define KV_LIST   6
 #define KV_LOBJ   7
+#define KV_TABLE  8  /* Column-encoded array of flat objects (snapshots only) */
+
+/* ===================== Diagnostic codes ======================*/
+#define TOON_OK                  0
+#define TOON_ERR_EXPECTED_COLON  1  /* Key not followed by ':' */
+#define TOON_ERR_UNCLOSED_TABLE  2  /* Missing '}' in {col1,col2} header */
+#define TOON_ERR_MAX_DEPTH       3  /* Nesting deeper than the parser stack */
+#define TOON_ERR_UNEXPECTED_CHAR 4  /* Trailing garbage after a value, or a JSON syntax error */
+#define TOON_ERR_UNEXPECTED_END  5  /* JSON input ended inside a value */
+#define TOON_ERR_BAD_STRING      6  /* Control character or bad escape in a JSON string */
+
+/* ===================== Parse flags ======================*/
+#define TOON_PARSE_STRICT  (1 << 0) /* Abort on the first error */
+#define TOON_PARSE_PATH_INDEX (1 << 1) /* Index every dotted path for TOONc_get() */
 
 /* ======================= Data Structures ======================= */
 
@@ -69,16 +84,124 @@ typedef struct toonObject {
             size_t len;
             size_t capacity;
         } array;
+
+        struct toonIndex *index;    /* KV_OBJ: key index, built by lookups */
     };
 
     struct toonObject *child;
     struct toonObject *next;
 } toonObject;
 
+/* A single parser diagnostic. Columns are 1-based byte offsets. */
+typedef struct toonError {
+    int code;
+    int line;
+    int col;
+} toonError;
+
+typedef void (*toonErrorHandler)(const toonError *err, void *userdata);
+
+/* Where a node came from, as byte offsets into the parsed text. 'start' and
+ * 'end' cover a member's whole lines, down to its last descendant; items and
+ * table cells only have a value. Containers' values are the lines below. */
+typedef struct toonSpan {
+    size_t start, end;
+    size_t key, key_len;        /* key_len is 0 for items, rows and cells */
+    size_t value, value_len;    /* Value as written, quotes included */
+    int line;                   /* 1-based */
+} toonSpan;
+
+typedef struct toonSpanMap toonSpanMap;
+
+typedef struct toonParseOptions {
+    int flags;                  /* TOON_PARSE_* */
+    toonErrorHandler on_error;  /* Called once per diagnostic, may be NULL */
+    void *userdata;             /* Passed through to on_error */
+    toonSpanMap *spans;         /* Filled with every node's span, may be NULL */
+} toonParseOptions;
+
+/* Output sinks for toonWriter */
+#define TOON_SINK_MEMORY 0  /* Growable in-memory buffer */
+#define TOON_SINK_FD     1  /* File descriptor, drained with write()/writev() */
+#define TOON_SINK_FILE   2  /* stdio stream, drained with fwrite() */
+#define TOON_SINK_BUFFER 3  /* Fixed caller-owned buffer, never grows */
+#define TOON_SINK_COUNT  4  /* Discards output, only counts bytes */
+
+/* JSON output flags */
+#define TOON_JSON_PRETTY  0         /* Two-space indentation and newlines */
+#define TOON_JSON_COMPACT (1 << 0)  /* No whitespace at all */
+
+/* CBOR flags */
+#define TOON_CBOR_NO_TABLES  (1 << 0)     /* Encode tables as plain arrays of maps */
+#define TOON_CBOR_TABLE_TAG  0x544F4F4Eu  /* Tag ("TOON") for [[cols],[row]...] tables */
+
+/* JSON to TOON streaming flags */
+#define TOON_STREAM_TWO_PASS (1 << 0) /* Rescan long arrays instead of buffering them */
+
+/* Buffered output used by every emitter. Initialize with one of the
+ * TOONc_writerInit* functions and finish with TOONc_writerFree() or
+ * TOONc_writerRelease(). */
+typedef struct toonWriter {
+    char *buf;       /* Staging buffer (the whole output for memory sinks) */
+    size_t len;      /* Bytes pending in buf */
+    size_t cap;      /* Capacity of buf */
+    size_t written;  /* Bytes handed to the sink (buffer sinks: bytes that did not fit) */
+    int sink;        /* TOON_SINK_* */
+    int fd;
+    FILE *fp;
+    int error;       /* errno of the first failed write, sticky */
+} toonWriter;
+
+/* A read-only snapshot opened with TOONc_snapOpen() or
+ * TOONc_snapOpenBuffer(). Nodes are addressed by index. */
+typedef uint32_t toonSnapRef;
+#define TOON_SNAP_NONE 0xFFFFFFFFu
+
+typedef struct toonSnapshot {
+    const char *base;   /* Start of the image */
+    size_t size;
+    const void *nodes;  /* 16-byte node records */
+    uint32_t count;
+    uint32_t root;
+    const char *pool;   /* NUL-terminated keys and strings */
+    size_t pool_size;
+    int mapped;         /* Unmapped by TOONc_snapClose() */
+} toonSnapshot;
+
+/* A parsed tree shared between holders. The tree must not be modified
+ * once the document is shared; it is freed by the last TOONc_docRelease().
+ * Read-only calls on doc->root (TOONc_get(), TOONc_getArrayItem(),
+ * TOONc_getArrayLength(), child/next iteration and the TOONc_write*,
+ * TOONc_to* and TOONc_print* emitters) may run from many threads at once. */
+typedef struct toonDoc {
+    toonObject *root;
+    size_t bytes;       /* Approximate heap footprint */
+    int refs;           /* Atomic reference count */
+    struct toonDocSource *source;  /* Sections shared with reloads, or NULL */
+} toonDoc;
+
+/* Path-keyed document cache (see TOONc_cacheGet()) */
+typedef struct toonCache toonCache;
+
+/* Current version of a document for lock-free readers (see
+ * TOONc_handleAcquire()) */
+typedef struct toonHandle toonHandle;
+
+/* Reloads watched files as they change (see TOONc_watchAdd()) */
+typedef struct toonWatcher toonWatcher;
+
+/* Called with the freshly loaded document; retain it to keep it */
+typedef void (*toonWatchCallback)(const char *path, toonDoc *doc, void *ctx);
+
 typedef struct toonParser {
     char *source;
     char *p;
     int line;
+    const toonParseOptions *opts;
+    int errors;
+    int aborted;
+    int ragged;      /* Table rows that weren't exactly one line each */
+    toonSpanMap *spans;
 } toonParser;
 
 /* ======================= Memory Management ======================= */
@@ -116,13 +239,98 @@ toonObject *TOONc_parseFile(FILE *fp);
 toonObject *TOONc_parseString(const char *str);
 
 /**
- * Get an object by path (dot notation)
+ * Parse a TOON file with diagnostics and flags
+ * @param fp File pointer (will be closed by this function)
+ * @param opts Parse options, may be NULL
+ * @return Root toonObject or NULL on error (or on the first error in strict mode)
+ */
+toonObject *TOONc_parseFileWithOptions(FILE *fp, const toonParseOptions *opts);
+
+/**
+ * Parse a TOON string with diagnostics and flags
+ * @param str TOON formatted string
+ * @param opts Parse options, may be NULL
+ * @return Root toonObject or NULL on error (or on the first error in strict mode)
+ */
+toonObject *TOONc_parseStringWithOptions(const char *str, const toonParseOptions *opts);
+
+/**
+ * Parse a JSON document into a toonObject tree
+ *
+ * Objects become KV_OBJ, arrays KV_LIST, integers within int range KV_INT
+ * and all other numbers KV_DOUBLE.
+ * @param buf JSON text (need not be NUL-terminated)
+ * @param len Length of buf in bytes
+ * @return Top-level value (normally a keyless object) or NULL on error
+ */
+toonObject *TOONc_parseJSON(const char *buf, size_t len);
+
+/**
+ * Parse a JSON document, reporting the first error through opts
+ * @param buf JSON text (need not be NUL-terminated)
+ * @param len Length of buf in bytes
+ * @param opts Parse options, may be NULL (JSON errors always fail the parse)
+ * @return Top-level value or NULL on error
+ */
+toonObject *TOONc_parseJSONWithOptions(const char *buf, size_t len,
+        const toonParseOptions *opts);
+
+/**
+ * Describe a diagnostic code
+ * @param code One of the TOON_ERR_* codes
+ * @return Static, human-readable message
+ */
+const char *TOONc_strerror(int code);
+
+/**
+ * Get an object by path (dot notation). Keeps no state between calls and
+ * only allocates to index a wide object once: safe to call from many
+ * threads on a shared tree
  * @param root Root object
  * @param path Path like "context.task" or "friends"
  * @return Found object or NULL
  */
 toonObject *TOONc_get(toonObject *root, const char *path);
 
+/**
+ * TOONc_get() for a path that isn't NUL-terminated
+ * @param root Root object
+ * @param path Path bytes, e.g. a slice of a larger buffer
+ * @param len Length of the path
+ * @return Found object or NULL
+ */
+toonObject *TOONc_getn(toonObject *root, const char *path, size_t len);
+
+/* Forget the key index lookups built for 'obj'. Call it after adding,
+ * removing or renaming children of an object that was looked up in. */
+void TOONc_dropIndex(toonObject *obj);
+
+/* A path compiled once and resolved against any number of trees */
+typedef struct toonPath toonPath;
+
+/**
+ * Compile a path for TOONc_getCompiled()
+ * @param path Dot notation with optional array indices, like "hikes[2].name"
+ * @return Compiled path, or NULL if an index is malformed
+ */
+toonPath *TOONc_compilePath(const char *path);
+void TOONc_freePath(toonPath *q);
+
+/* Resolve a compiled path without allocating. NULL if it doesn't exist */
+toonObject *TOONc_getCompiled(toonObject *root, const toonPath *q);
+
+/**
+ * Resolve many compiled paths in one descent, searching each object on
+ * the way once for every path that goes through it
+ * @param root Root object
+ * @param paths Compiled paths, in any order
+ * @param n Number of paths
+ * @param out Receives the node for each path, or NULL
+ * @return Number of paths found
+ */
+size_t TOONc_getMany(toonObject *root, toonPath *const paths[], size_t n,
+        toonObject *out[]);
+
 /**
  * Get item of an array 
  * @param arr Array object
@@ -138,6 +346,32 @@ toonObject *TOONc_getArrayItem(toonObject *arr, size_t index);
  */
 size_t TOONc_getArrayLength(toonObject *arr);
 
+/* A table view: the cells of a list of objects laid out by row and column
+ * for O(1) access (see TOONc_tableOpen()). Columns come from the first
+ * row. The view borrows from the tree: close it before freeing or
+ * changing the list. */
+typedef struct toonTable toonTable;
+#define TOON_TABLE_NONE ((size_t)-1)
+
+/**
+ * Build a table view of a list
+ * @param list Array whose first item is an object
+ * @return The view, or NULL if 'list' isn't an array of objects
+ */
+toonTable *TOONc_tableOpen(toonObject *list);
+void TOONc_tableClose(toonTable *t);
+
+size_t TOONc_tableRows(const toonTable *t);
+size_t TOONc_tableColumns(const toonTable *t);
+const char *TOONc_tableColumn(const toonTable *t, size_t col);
+
+/* Position of a column, to resolve once before a loop. TOON_TABLE_NONE if
+ * the table has no such column. */
+size_t TOONc_tableColumnIndex(const toonTable *t, const char *name);
+
+/* The cell at 'row' and 'col', or NULL if it's missing or out of range */
+toonObject *TOONc_tableCell(const toonTable *t, size_t row, size_t col);
+
 /**
  * Print recursively an object
  * @param o Generic object
@@ -165,6 +399,416 @@ void TOONc_free(toonObject *obj);
  */
 void TOONc_toJSON(toonObject *obj, FILE *fp, int depth);
 
+/* ======================= Buffered Output ======================= */
+
+void TOONc_writerInitMemory(toonWriter *w);
+void TOONc_writerInitFd(toonWriter *w, int fd);
+void TOONc_writerInitFile(toonWriter *w, FILE *fp);
+void TOONc_writerInitBuffer(toonWriter *w, char *buf, size_t cap);
+
+/**
+ * Append raw bytes to a writer
+ * @param w Writer
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+void TOONc_writerWrite(toonWriter *w, const void *data, size_t len);
+
+/**
+ * Hand pending bytes to the sink (no-op for memory writers)
+ * @param w Writer
+ * @return 0 on success, -1 on a write error (see w->error)
+ */
+int TOONc_writerFlush(toonWriter *w);
+
+/**
+ * Take a memory writer's output; other sinks are flushed and yield NULL
+ * @param w Writer (reset afterwards)
+ * @param len If not NULL, receives the output length
+ * @return NUL-terminated buffer to release with free(), or NULL
+ */
+char *TOONc_writerRelease(toonWriter *w, size_t *len);
+
+/**
+ * Flush pending output and release the writer's buffer
+ * @param w Writer
+ * @return 0 on success, -1 if any write failed
+ */
+int TOONc_writerFree(toonWriter *w);
+
+/**
+ * Write an object as JSON
+ * @param w Destination writer
+ * @param obj Object to convert
+ * @param depth Initial indentation depth (ignored when compact)
+ * @param flags TOON_JSON_PRETTY or TOON_JSON_COMPACT
+ */
+void TOONc_writeJSON(toonWriter *w, toonObject *obj, int depth, int flags);
+
+/**
+ * Convert an object to JSON in a caller-supplied buffer
+ * @param obj Object to convert
+ * @param buf Destination buffer (may be NULL when cap is 0)
+ * @param cap Size of buf in bytes
+ * @param needed If not NULL, receives the exact output length (without NUL)
+ * @param flags TOON_JSON_PRETTY or TOON_JSON_COMPACT
+ * @return 0 if the output and its NUL fit in buf, -1 otherwise
+ */
+int TOONc_toJSONBuffer(toonObject *obj, char *buf, size_t cap, size_t *needed, int flags);
+
+/**
+ * Exact length of the JSON TOONc_toJSONBuffer() would produce
+ * @param obj Object to measure
+ * @param flags TOON_JSON_PRETTY or TOON_JSON_COMPACT
+ * @return Output size in bytes, excluding the NUL
+ */
+size_t TOONc_measureJSON(toonObject *obj, int flags);
+
+/**
+ * Exact length of the TOON TOONc_toTOON() would produce
+ * @param obj Object to measure
+ * @return Output size in bytes, excluding the NUL
+ */
+size_t TOONc_measureTOON(toonObject *obj);
+
+/**
+ * Encode an object as TOON in a caller-supplied buffer
+ * @param obj Object to encode
+ * @param buf Destination buffer (may be NULL when cap is 0)
+ * @param cap Size of buf in bytes
+ * @param needed If not NULL, receives the exact output length (without NUL)
+ * @return 0 if the output and its NUL fit in buf, -1 otherwise
+ */
+int TOONc_toTOONBuffer(toonObject *obj, char *buf, size_t cap, size_t *needed);
+
+/**
+ * Write an object as TOON (see TOONc_toTOON)
+ * @param w Destination writer
+ * @param obj Object to encode
+ */
+void TOONc_writeTOON(toonWriter *w, toonObject *obj);
+
+/**
+ * Transcode TOON to JSON without building a tree
+ *
+ * Reads 'in' incrementally, holding only the current line, the nesting
+ * stack and the current table header. Output is identical to parsing the
+ * same input and calling TOONc_writeJSON() at depth 0.
+ * @param in Input stream
+ * @param out Destination writer (flushed, not freed)
+ * @param flags TOON_JSON_PRETTY or TOON_JSON_COMPACT
+ * @param opts Parse options (may be NULL)
+ * @return 0 on success, -1 on I/O error or an aborted strict parse
+ */
+int TOONc_transcodeTOONToJSON(FILE *in, toonWriter *out, int flags,
+        const toonParseOptions *opts);
+
+/**
+ * Transcode JSON to TOON without building the whole tree
+ *
+ * Objects are streamed member by member. Arrays are buffered up to
+ * 'window' elements to choose between inline, table and list form; with
+ * TOON_STREAM_TWO_PASS longer arrays are counted and checked in a first
+ * pass and written element by element in a second one (the input must be
+ * seekable), otherwise they are buffered whole. Output is identical to
+ * TOONc_writeTOON() on TOONc_parseJSON() of the same input.
+ * @param in Input stream
+ * @param out Destination writer (flushed, not freed)
+ * @param window Elements buffered per array before it counts as long (0 = 1024)
+ * @param flags 0 or TOON_STREAM_TWO_PASS
+ * @param opts Parse options for JSON diagnostics (may be NULL)
+ * @return 0 on success, -1 on a JSON, I/O or seek error
+ */
+int TOONc_transcodeJSONToTOON(FILE *in, toonWriter *out, size_t window,
+        int flags, const toonParseOptions *opts);
+
+/**
+ * Write an object tree in the TOONc_printObject debug format
+ * @param w Destination writer
+ * @param o Generic object
+ * @param depth Indentation depth
+ */
+void TOONc_writeObject(toonWriter *w, toonObject *o, int depth);
+
+/**
+ * Encode an object tree as TOON
+ *
+ * Uniform arrays of flat objects become key[N]{cols}: tables, arrays of
+ * primitives are written inline, and strings are quoted only when needed.
+ * @param obj Object to encode (a keyless root object encodes its properties)
+ * @param len If not NULL, receives the output length
+ * @return Newly allocated NUL-terminated string (release with free())
+ */
+char *TOONc_toTOON(toonObject *obj, size_t *len);
+
+/* ======================= CBOR ======================= */
+
+/**
+ * Encode an object as a CBOR data item (RFC 8949)
+ *
+ * Tables are sent as tag TOON_CBOR_TABLE_TAG over [[cols], [row]...]
+ * unless TOON_CBOR_NO_TABLES is given.
+ * @param w Destination writer
+ * @param obj Object to encode (its own key is not encoded)
+ * @param flags 0 or TOON_CBOR_NO_TABLES
+ */
+void TOONc_writeCBOR(toonWriter *w, toonObject *obj, int flags);
+
+/**
+ * Encode an object as CBOR into a new buffer
+ * @param obj Object to encode
+ * @param len If not NULL, receives the encoded size
+ * @param flags 0 or TOON_CBOR_NO_TABLES
+ * @return Newly allocated buffer (release with free())
+ */
+unsigned char *TOONc_toCBOR(toonObject *obj, size_t *len, int flags);
+
+/**
+ * Decode a CBOR data item into a toonObject tree
+ * @param buf Encoded data
+ * @param len Size of buf
+ * @return Decoded tree, or NULL if malformed, truncated or followed by extra bytes
+ */
+toonObject *TOONc_parseCBOR(const void *buf, size_t len);
+
+/* ======================= Binary snapshots ======================= */
+
+/**
+ * Write a binary snapshot of a tree
+ *
+ * The image uses node indices instead of pointers, a string pool with
+ * each distinct key and string stored once, and column-major storage for
+ * arrays that would be written as TOON tables.
+ * @param w Destination writer
+ * @param root Tree to store
+ * @return 0 on success, -1 on a write error or if the tree exceeds 32-bit offsets
+ */
+int TOONc_writeSnapshot(toonWriter *w, toonObject *root);
+
+/**
+ * Write a binary snapshot of a tree to a file
+ * @param root Tree to store
+ * @param path Destination file (created or truncated)
+ * @return 0 on success, -1 on error
+ */
+int TOONc_snapSave(toonObject *root, const char *path);
+
+/**
+ * Map a snapshot file read-only
+ * @param path Snapshot file
+ * @return Snapshot, or NULL if unreadable or the header doesn't match
+ */
+toonSnapshot *TOONc_snapOpen(const char *path);
+
+/**
+ * Use a snapshot image already in memory (not copied)
+ * @param buf 8-byte aligned image, valid until TOONc_snapClose()
+ * @param len Size of the image
+ * @return Snapshot, or NULL if the header doesn't match
+ */
+toonSnapshot *TOONc_snapOpenBuffer(const void *buf, size_t len);
+
+/**
+ * Release a snapshot (unmapping it if it was opened from a file)
+ * @param s Snapshot
+ */
+void TOONc_snapClose(toonSnapshot *s);
+
+/* Node accessors. Invalid references and type mismatches give
+ * TOON_SNAP_NONE, NULL or 0 like the TOON_GET_* macros. */
+toonSnapRef TOONc_snapRoot(const toonSnapshot *s);
+int TOONc_snapType(const toonSnapshot *s, toonSnapRef n);       /* KV_*, -1 if invalid */
+const char *TOONc_snapKey(const toonSnapshot *s, toonSnapRef n);
+const char *TOONc_snapString(const toonSnapshot *s, toonSnapRef n, size_t *len);
+int TOONc_snapInt(const toonSnapshot *s, toonSnapRef n);
+double TOONc_snapDouble(const toonSnapshot *s, toonSnapRef n);
+int TOONc_snapBool(const toonSnapshot *s, toonSnapRef n);
+size_t TOONc_snapLength(const toonSnapshot *s, toonSnapRef n);  /* members, items or rows */
+toonSnapRef TOONc_snapChild(const toonSnapshot *s, toonSnapRef n, size_t i);
+toonSnapRef TOONc_snapGet(const toonSnapshot *s, toonSnapRef n, const char *path);
+
+/* KV_TABLE accessors */
+size_t TOONc_snapColumns(const toonSnapshot *s, toonSnapRef table);
+const char *TOONc_snapColumn(const toonSnapshot *s, toonSnapRef table, size_t col);
+toonSnapRef TOONc_snapCell(const toonSnapshot *s, toonSnapRef table, size_t row, size_t col);
+
+/**
+ * Copy a snapshot node into a newly allocated tree (tables become lists
+ * of row objects)
+ * @param s Snapshot
+ * @param n Node to copy
+ * @return New tree (free with TOONc_free()) or NULL if n is invalid
+ */
+toonObject *TOONc_snapThaw(const toonSnapshot *s, toonSnapRef n);
+
+/* ======================= Shared Documents ======================= */
+
+/**
+ * Freeze a tree into a shared document with one reference
+ * @param root Tree, owned by the document from now on
+ * @return Document, or NULL if root is NULL
+ */
+toonDoc *TOONc_docFromTree(toonObject *root);
+
+/* Parse straight into a document (NULL on failure) */
+toonDoc *TOONc_docParseString(const char *str);
+toonDoc *TOONc_docParseFile(FILE *fp);
+
+/* Take or drop a reference on a shared document */
+toonDoc *TOONc_docRetain(toonDoc *doc);
+void TOONc_docRelease(toonDoc *doc);
+
+/**
+ * Create a document cache
+ * @param budget Maximum bytes of cached documents, 0 for no limit
+ * @return New cache
+ */
+toonCache *TOONc_cacheNew(size_t budget);
+
+/**
+ * Free a cache. Documents still retained by callers stay valid.
+ * @param c Cache
+ */
+void TOONc_cacheFree(toonCache *c);
+
+/**
+ * Get the parsed document for a file, parsing it only if it isn't cached
+ * or its mtime, size or inode changed since. Thread-safe.
+ * @param c Cache
+ * @param path File path
+ * @return Document with a reference for the caller (TOONc_docRelease()),
+ *         or NULL if the file can't be read or parsed
+ */
+toonDoc *TOONc_cacheGet(toonCache *c, const char *path);
+
+/* Lookup counters and the bytes currently cached; pointers may be NULL */
+void TOONc_cacheStats(toonCache *c, size_t *hits, size_t *misses, size_t *bytes);
+
+/**
+ * Create a handle publishing a document
+ * @param doc Initial document; the handle takes over the caller's reference
+ * @return New handle
+ */
+toonHandle *TOONc_handleNew(toonDoc *doc);
+
+/**
+ * Free a handle, dropping its reference on the current document. Must not
+ * race with TOONc_handleAcquire().
+ * @param h Handle
+ */
+void TOONc_handleFree(toonHandle *h);
+
+/**
+ * Get the current document without taking a lock
+ * @param h Handle
+ * @return Document with a reference for the caller (TOONc_docRelease())
+ */
+toonDoc *TOONc_handleAcquire(toonHandle *h);
+
+/**
+ * Replace the current document. The previous one is freed once the last
+ * reader holding it releases it. Publishers are serialized.
+ * @param h Handle
+ * @param doc New document; the handle takes over the caller's reference
+ */
+void TOONc_handlePublish(toonHandle *h, toonDoc *doc);
+
+/**
+ * Parse text into a document that shares the top-level sections unchanged
+ * since 'prev', reparsing only the text between them
+ * @param prev Previous version (from TOONc_docReload() or a watcher), or NULL
+ * @param text New text
+ * @param len Length of text
+ * @return New document, or prev with a new reference if the text is identical
+ */
+toonDoc *TOONc_docReload(toonDoc *prev, const char *text, size_t len);
+
+/**
+ * Apply an edit to a document's source text and update its tree in place.
+ * Each top-level section the edit touches is reparsed whole, nested
+ * members included, so a document under a single top-level key is
+ * reparsed entirely; only an edit within the rows of a one-row-per-line
+ * table reparses just those rows. The tree ends up identical to a full
+ * parse of the edited text.
+ * @param doc Document from TOONc_docReload(), holding its only reference
+ * @param offset Byte offset of the edit
+ * @param removed Bytes removed at offset
+ * @param inserted Text inserted at offset (NULL for none)
+ * @return 0, or -1 if the document has no source, is shared or the range
+ *         is out of bounds
+ */
+int TOONc_reparse(toonDoc *doc, size_t offset, size_t removed, const char *inserted);
+
+/**
+ * Create a file watcher (Linux only: elsewhere this returns NULL)
+ * @return New watcher, or NULL
+ */
+toonWatcher *TOONc_watchNew(void);
+void TOONc_watchFree(toonWatcher *w);
+
+/**
+ * Load a file and reload it incrementally whenever it changes
+ * @param w Watcher
+ * @param path TOON file
+ * @param cb Called from TOONc_watchDispatch() with each new version (may be NULL)
+ * @param ctx Passed to cb
+ * @return 0, or -1 if the file can't be read or watched
+ */
+int TOONc_watchAdd(toonWatcher *w, const char *path, toonWatchCallback cb, void *ctx);
+
+/* Current version of a watched file, with a reference for the caller */
+toonDoc *TOONc_watchDoc(toonWatcher *w, const char *path);
+
+/* Descriptor that becomes readable when a dispatch has work, for poll() */
+int TOONc_watchFd(toonWatcher *w);
+
+/**
+ * Wait for changes and reload the changed files
+ * @param w Watcher
+ * @param timeout_ms Milliseconds to wait, -1 forever, 0 not at all
+ * @return Number of documents replaced, or -1 on error
+ */
+int TOONc_watchDispatch(toonWatcher *w, int timeout_ms);
+
+/* ======================= Source Spans ======================= */
+
+/* Side table for toonParseOptions.spans. Each parse replaces its contents. */
+toonSpanMap *TOONc_spanMapNew(void);
+void TOONc_spanMapFree(toonSpanMap *m);
+
+/**
+ * Look up where a node was parsed from
+ * @param m Span map filled by the parse that built the tree
+ * @param node Any node of that tree, including the root
+ * @return Span, or NULL if the node wasn't produced by that parse
+ */
+const toonSpan *TOONc_spanOf(const toonSpanMap *m, const toonObject *node);
+
+/* The text the spans refer to (a copy owned by the map) */
+const char *TOONc_spanSource(const toonSpanMap *m, size_t *len);
+
+/* Number of nodes with a span */
+size_t TOONc_spanCount(const toonSpanMap *m);
+
+/* Mark a node as changed, so TOONc_writeTOONSpans() encodes it (and the
+ * members holding it) again. Only needed with TOON_SPANS_TOUCHED: without
+ * it every node is compared against the parse, string bytes included */
+void TOONc_spanTouch(toonSpanMap *m, const toonObject *node);
+
+/* TOONc_writeTOONSpans() flags */
+#define TOON_SPANS_TOUCHED (1 << 0) /* Only touched nodes count as changed */
+
+/**
+ * Write a parsed tree as TOON, copying the source text of every subtree
+ * that is unchanged since the parse and encoding only what changed
+ * @param w Writer
+ * @param obj Tree built by the parse that filled 'spans'
+ * @param spans Span map of that parse (NULL behaves like TOONc_writeTOON)
+ * @param flags TOON_SPANS_* (0 compares every node against the parse)
+ */
+void TOONc_writeTOONSpans(toonWriter *w, toonObject *obj, const toonSpanMap *spans,
+        int flags);
+
 /* ======================= Type Checking Macros ======================= */
 
 #define TOON_IS_STRING(obj)  ((obj) && (obj)->kvtype == KV_STRING)